@@ -100,7 +100,7 @@ int
 nth_kday(int n, int dow, struct date *date)
 {
 	if (n == 0)
-		errx(1, "%s: invalid n = 0!", __func__);
+		fatal("%s: invalid n = 0!", __func__);
 
 	int rd = fixed_from_gregorian(date);
 	int kday;
@@ -0,0 +1,378 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2020 The DragonFly Project.  All rights reserved.
+ *
+ * This code is derived from software contributed to The DragonFly Project
+ * by Aaron LI <aly@aaronly.me>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of The DragonFly Project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific, prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Persistent cache of the compiled calendar files.
+ *
+ * A calendar file is compiled into a sequence of records (see io.c),
+ * which are saved into a cache file under the directory specified by
+ * '-C'.  The cache file is keyed by the path of the calendar file, the
+ * locale and the calendar in effect when the file is processed, and is
+ * valid as long as the calendar file has the same inode, mtime (to the
+ * nanosecond) and size.
+ *
+ * Only the cache files owned by the user (or root) and not writable by
+ * the others are trusted, and the loaded records are still checked (see
+ * io.c), so that a shared cache directory cannot be used to inject the
+ * events of another user.
+ *
+ * The cache file is privately mapped and the strings are NUL-terminated
+ * in place, so the records can be directly referenced without copying.
+ * The integers are stored in the host byte order, because the cache is
+ * not meant to be shared across machines.
+ */
+
+#include <sys/param.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "calendar.h"
+#include "cache.h"
+#include "context.h"
+#include "nnames.h"
+#include "utils.h"
+
+#define CACHE_MAGIC	"CALCACHE"
+#define CACHE_VERSION	3
+
+/* nanoseconds of the mtime, which is named differently on macOS */
+#ifdef __APPLE__
+#define ST_MTIME_NSEC(sb)	((sb)->st_mtimespec.tv_nsec)
+#else
+#define ST_MTIME_NSEC(sb)	((sb)->st_mtim.tv_nsec)
+#endif
+
+struct cache_header {
+	char	 magic[8];	/* CACHE_MAGIC */
+	uint32_t version;	/* CACHE_VERSION */
+	uint32_t reserved;
+	struct cache_stamp stamp;  /* stamp of the calendar file */
+	uint64_t datalen;	/* length of data following the header */
+};
+
+static bool	cache_filename(const struct cache_key *key, char *buf,
+			       size_t size);
+static bool	write_all(int fd, const void *p, size_t len);
+
+
+void
+cache_put(struct cache_buf *cb, const void *p, size_t len)
+{
+	if (cb->cap - cb->len < len) {
+		while (cb->cap - cb->len < len)
+			cb->cap = (cb->cap > 0) ? cb->cap * 2 : 4096;
+		cb->data = xrealloc(cb->data, cb->cap);
+	}
+	memcpy(cb->data + cb->len, p, len);
+	cb->len += len;
+}
+
+void
+cache_put_u32(struct cache_buf *cb, uint32_t v)
+{
+	cache_put(cb, &v, sizeof(v));
+}
+
+/*
+ * Put the string $s (NULL is stored as an empty string) with its length
+ * and the terminating NUL.
+ */
+void
+cache_put_str(struct cache_buf *cb, const char *s)
+{
+	size_t len = (s != NULL) ? strlen(s) : 0;
+
+	cache_put_u32(cb, (uint32_t)len);
+	cache_put(cb, (s != NULL) ? s : "", len + 1);
+}
+
+bool
+cache_get(struct cache_reader *rd, void *p, size_t len)
+{
+	if ((size_t)(rd->end - rd->pos) < len)
+		return false;
+	memcpy(p, rd->pos, len);
+	rd->pos += len;
+	return true;
+}
+
+bool
+cache_get_u32(struct cache_reader *rd, uint32_t *v)
+{
+	return cache_get(rd, v, sizeof(*v));
+}
+
+/*
+ * Return the string at the reader cursor, which is stable in the mapped
+ * cache file, or NULL if the cache file is corrupted.
+ */
+char *
+cache_get_str(struct cache_reader *rd)
+{
+	uint32_t len;
+	char *s;
+
+	if (!cache_get_u32(rd, &len))
+		return NULL;
+	if ((size_t)(rd->end - rd->pos) <= len || rd->pos[len] != '\0')
+		return NULL;
+
+	s = rd->pos;
+	rd->pos += len + 1;
+	return s;
+}
+
+
+void
+cache_stamp_init(struct cache_stamp *st, const struct stat *sb)
+{
+	memset(st, 0, sizeof(*st));
+	st->mtime = (int64_t)sb->st_mtime;
+	st->mtime_nsec = (int64_t)ST_MTIME_NSEC(sb);
+	st->size = (int64_t)sb->st_size;
+	st->ino = (uint64_t)sb->st_ino;
+	st->dev = (uint64_t)sb->st_dev;
+}
+
+bool
+cache_stamp_equal(const struct cache_stamp *a, const struct cache_stamp *b)
+{
+	return (a->mtime == b->mtime &&
+		a->mtime_nsec == b->mtime_nsec &&
+		a->size == b->size &&
+		a->ino == b->ino &&
+		a->dev == b->dev);
+}
+
+/*
+ * Initialize the cache key of the calendar file $path with the current
+ * locale, calendar and cache directory of context $ctx, which must be
+ * done before processing the file.  The path is resolved, because the
+ * calendar directories can be relative to the current directory.
+ */
+void
+cache_key_init(struct cache_key *key, struct cal_context *ctx,
+	       const char *path)
+{
+	if ((key->path = realpath(path, NULL)) == NULL)
+		key->path = xstrdup(path);
+	key->locale = xstrdup(nlocale_name(&ctx->names));
+	key->calendar = ctx->calendar->name;
+	key->dir = ctx->options.cache_dir;
+}
+
+void
+cache_key_free(struct cache_key *key)
+{
+	free(key->path);
+	free(key->locale);
+	key->path = key->locale = NULL;
+}
+
+/*
+ * Compose the cache file name from the cache key $key.
+ */
+static bool
+cache_filename(const struct cache_key *key, char *buf, size_t size)
+{
+	uint64_t h = HASH_INIT;
+	int n;
+
+	if (key->dir == NULL)
+		return false;
+
+	h = hash_string(h, key->path);
+	h = hash_string(h, key->locale);
+	h = hash_string(h, key->calendar);
+
+	n = snprintf(buf, size, "%s/%016llx.cache", key->dir,
+		     (unsigned long long)h);
+	return (n > 0 && (size_t)n < size);
+}
+
+/*
+ * Load the cache file of key $key for the calendar file with status $sb.
+ * Return the privately mapped cache file (of length $maplen) with the
+ * reader $rd positioned at the first record, or NULL if there is no
+ * valid cache file.
+ */
+char *
+cache_load(const struct cache_key *key, const struct stat *sb,
+	   struct cache_reader *rd, size_t *maplen)
+{
+	struct cache_header hdr;
+	struct cache_stamp stamp;
+	struct stat csb;
+	char fpath[MAXPATHLEN];
+	char *data, *s;
+	size_t len;
+	int fd;
+
+	if (!cache_filename(key, fpath, sizeof(fpath)))
+		return NULL;
+	if ((fd = open(fpath, O_RDONLY)) == -1)
+		return NULL;
+
+	if (fstat(fd, &csb) == -1 || !S_ISREG(csb.st_mode) ||
+	    (size_t)csb.st_size <= sizeof(hdr)) {
+		close(fd);
+		return NULL;
+	}
+	if ((csb.st_uid != geteuid() && csb.st_uid != 0) ||
+	    (csb.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
+		DPRINTF("%s: untrusted cache file: %s\n", __func__, fpath);
+		close(fd);
+		return NULL;
+	}
+
+	len = (size_t)csb.st_size;
+	data = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return NULL;
+
+	memcpy(&hdr, data, sizeof(hdr));
+	if (memcmp(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic)) != 0 ||
+	    hdr.version != CACHE_VERSION ||
+	    hdr.datalen != len - sizeof(hdr)) {
+		DPRINTF("%s: invalid cache file: %s\n", __func__, fpath);
+		goto fail;
+	}
+	cache_stamp_init(&stamp, sb);
+	if (!cache_stamp_equal(&hdr.stamp, &stamp)) {
+		DPRINTF("%s: stale cache file: %s\n", __func__, fpath);
+		goto fail;
+	}
+
+	rd->pos = data + sizeof(hdr);
+	rd->end = data + len;
+	if ((s = cache_get_str(rd)) == NULL || strcmp(s, key->path) != 0 ||
+	    (s = cache_get_str(rd)) == NULL || strcmp(s, key->locale) != 0 ||
+	    (s = cache_get_str(rd)) == NULL ||
+	    strcmp(s, key->calendar) != 0) {
+		DPRINTF("%s: mismatched cache file: %s\n", __func__, fpath);
+		goto fail;
+	}
+
+	DPRINTF("%s: loaded cache file %s for %s\n",
+		__func__, fpath, key->path);
+	*maplen = len;
+	return data;
+
+fail:
+	munmap(data, len);
+	return NULL;
+}
+
+/*
+ * Save the compiled records $cb of the calendar file with status $sb
+ * into the cache file of key $key, which is atomically replaced.
+ */
+bool
+cache_save(const struct cache_key *key, const struct stat *sb,
+	   const struct cache_buf *cb)
+{
+	struct cache_header hdr;
+	struct cache_buf keys = { 0 };
+	char fpath[MAXPATHLEN], tpath[MAXPATHLEN];
+	bool ok = false;
+	int fd, n;
+
+	if (!cache_filename(key, fpath, sizeof(fpath)))
+		goto out;
+	n = snprintf(tpath, sizeof(tpath), "%s/.cache.XXXXXX", key->dir);
+	if (n < 0 || (size_t)n >= sizeof(tpath))
+		goto out;
+
+	cache_put_str(&keys, key->path);
+	cache_put_str(&keys, key->locale);
+	cache_put_str(&keys, key->calendar);
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic));
+	hdr.version = CACHE_VERSION;
+	cache_stamp_init(&hdr.stamp, sb);
+	hdr.datalen = keys.len + cb->len;
+
+	if ((fd = mkstemp(tpath)) == -1) {
+		DPRINTF("%s: cannot create cache file in %s\n",
+			__func__, key->dir);
+		goto out;
+	}
+	/* Let the cache be shared with other users (e.g., in '-a' mode) */
+	fchmod(fd, 0644);
+
+	ok = (write_all(fd, &hdr, sizeof(hdr)) &&
+	      write_all(fd, keys.data, keys.len) &&
+	      write_all(fd, cb->data, cb->len));
+	if (close(fd) == -1)
+		ok = false;
+	if (ok && rename(tpath, fpath) == -1)
+		ok = false;
+	if (!ok) {
+		DPRINTF("%s: failed to write cache file %s\n",
+			__func__, fpath);
+		unlink(tpath);
+	} else {
+		DPRINTF("%s: saved cache file %s for %s\n",
+			__func__, fpath, key->path);
+	}
+
+out:
+	free(keys.data);
+	return ok;
+}
+
+static bool
+write_all(int fd, const void *p, size_t len)
+{
+	const char *s = p;
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = write(fd, s, len)) == -1)
+			return false;
+		s += n;
+		len -= (size_t)n;
+	}
+	return true;
+}
@@ -0,0 +1,100 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2020 The DragonFly Project.  All rights reserved.
+ *
+ * This code is derived from software contributed to The DragonFly Project
+ * by Aaron LI <aly@aaronly.me>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of The DragonFly Project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific, prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef CACHE_H_
+#define CACHE_H_
+
+#include <sys/stat.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Growable buffer to compile the records of a calendar file */
+struct cache_buf {
+	char	*data;
+	size_t	 len;
+	size_t	 cap;
+};
+
+/* Cursor to read the records of a loaded cache file */
+struct cache_reader {
+	char	*pos;
+	char	*end;
+};
+
+/*
+ * Identity and modification stamp of a calendar file, to check whether
+ * its compiled records are still valid
+ */
+struct cache_stamp {
+	int64_t	 mtime;		/* seconds of the mtime */
+	int64_t	 mtime_nsec;	/* nanoseconds of the mtime */
+	int64_t	 size;
+	uint64_t ino;
+	uint64_t dev;
+};
+
+/* Key of the cache file of a calendar file */
+struct cache_key {
+	char	*path;		/* absolute path of the calendar file */
+	char	*locale;	/* locale when the file is processed */
+	const char *calendar;	/* calendar when the file is processed */
+	const char *dir;	/* cache directory; not part of the key */
+};
+
+struct cal_context;
+
+void	 cache_put(struct cache_buf *cb, const void *p, size_t len);
+void	 cache_put_u32(struct cache_buf *cb, uint32_t v);
+void	 cache_put_str(struct cache_buf *cb, const char *s);
+bool	 cache_get(struct cache_reader *rd, void *p, size_t len);
+bool	 cache_get_u32(struct cache_reader *rd, uint32_t *v);
+char	*cache_get_str(struct cache_reader *rd);
+
+void	 cache_stamp_init(struct cache_stamp *st, const struct stat *sb);
+bool	 cache_stamp_equal(const struct cache_stamp *a,
+			   const struct cache_stamp *b);
+
+void	 cache_key_init(struct cache_key *key, struct cal_context *ctx,
+			const char *path);
+void	 cache_key_free(struct cache_key *key);
+char	*cache_load(const struct cache_key *key, const struct stat *sb,
+		    struct cache_reader *rd, size_t *maplen);
+bool	 cache_save(const struct cache_key *key, const struct stat *sb,
+		    const struct cache_buf *cb);
+
+#endif
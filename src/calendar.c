@@ -38,12 +38,19 @@
 
 #include <sys/param.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 
+#include <assert.h>
 #include <err.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <grp.h>  /* required on Linux for initgroups() */
 #include <locale.h>
 #include <math.h>
+#include <paths.h>
+#include <poll.h>
 #include <pwd.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -59,64 +66,19 @@
 #include "chinese.h"
 #include "dates.h"
 #include "days.h"
+#include "ephemeris.h"
 #include "gregorian.h"
 #include "io.h"
 #include "julian.h"
+#include "libcalendar.h"
 #include "moon.h"
 #include "nnames.h"
 #include "parsedata.h"
+#include "server.h"
 #include "sun.h"
 #include "utils.h"
 
 
-struct cal_options Options = {
-	.time = 0.5,  /* noon */
-	.allmode = false,
-	.debug = 0,
-};
-
-/* paths to search for calendar files for inclusion */
-const char *calendarDirs[] = {
-	".",  /* i.e., '~/.calendar' */
-	CALENDAR_ETCDIR,
-	CALENDAR_DIR,
-	NULL,
-};
-
-/* currently selected calendar to use */
-struct calendar *Calendar;
-
-/* all supported calendars */
-static struct calendar calendars[] = {
-	{  /* the default */
-		.id = CAL_GREGORIAN,
-		.name = "Gregorian",
-		.format_date = NULL,
-		.find_days_ymd = find_days_ymd,
-		.find_days_dom = find_days_dom,
-		.find_days_month = find_days_month,
-		.find_days_mdow = find_days_mdow,
-	},
-	{
-		.id = CAL_JULIAN,
-		.name = "Julian",
-		.format_date = julian_format_date,
-		.find_days_ymd = julian_find_days_ymd,
-		.find_days_dom = julian_find_days_dom,
-		.find_days_month = julian_find_days_month,
-		.find_days_mdow = NULL,
-	},
-	{
-		.id = CAL_CHINESE,
-		.name = "Chinese",
-		.format_date = chinese_format_date,
-		.find_days_ymd = chinese_find_days_ymd,
-		.find_days_dom = chinese_find_days_dom,
-		.find_days_month = NULL,
-		.find_days_mdow = NULL,
-	},
-};
-
 /* user's calendar home directory (relative to $HOME) */
 static const char *calendarHome = ".calendar";
 /* default calendar file to use if exists in current dir or ~/.calendar */
@@ -129,39 +91,47 @@ static const char *calendarNoMail = "nomail";
 static const int user_timeout = 10;
 /* maximum time in seconds that 'calendar -a' can spend in total */
 static const int total_timeout = 3600;
+/* self-pipe to wake up the 'calendar -a' event loop on SIGCHLD */
+static int sigchld_pipe[2] = { -1, -1 };
+
+/* options from the command line, which are then set in the context */
+static struct cal_options options;
+/* process the calendar files of all users (see '-a') */
+static bool allmode = false;
+
+/* query of the batch mode (see '-b') */
+struct batch_query {
+	int	today;
+	int	day_begin;
+	int	day_end;
+};
 
 static bool	cd_home(const char *home);
 static int	get_fixed_of_today(void);
+static double	get_monotonic_time(void);
 static double	get_time_of_now(void);
 static int	get_utc_offset(void);
+static void	get_date_range(int today, int days_before, int days_after,
+			       int friday, int *begin, int *end);
 static void	handle_sigchld(int signo __unused);
+static bool	parse_batch_query(char *s, int days_before, int days_after,
+				  int friday, struct batch_query *bq);
 static void	print_datetime(double t, const struct location *loc);
 static void	print_location(const struct location *loc, bool warn);
+static void	process_all_users(struct cal_context *ctx, int njobs);
+static int	process_batch(struct cal_context *ctx, FILE *fp,
+			      const struct batch_query *queries, size_t n);
+static int	query_server(const char *path, FILE *fp);
+static struct batch_query *read_batch(const char *file, int days_before,
+				      int days_after, int friday,
+				      size_t *count);
+static void	send_mail(char *data, size_t len);
+static pid_t	spawn_user(struct cal_context *ctx, struct passwd *pw,
+			   FILE *fp);
 static void	usage(const char *progname) __dead2;
+static void	write_mailheader(struct strbuf *sb);
 
 
-bool
-set_calendar(const char *name)
-{
-	struct calendar *cal;
-
-	if (name == NULL) {
-		Calendar = &calendars[0];
-		return true;
-	}
-
-	for (size_t i = 0; i < nitems(calendars); i++) {
-		cal = &calendars[i];
-		if (strcasecmp(name, cal->name) == 0) {
-			Calendar = cal;
-			return true;
-		}
-	}
-
-	warnx("%s: unknown calendar: |%s|", __func__, name);
-	return false;
-}
-
 
 int
 main(int argc, char *argv[])
@@ -171,29 +141,38 @@ main(int argc, char *argv[])
 	int	days_before = 0;
 	int	days_after = 0;
 	int	Friday = 5;  /* days before weekend */
-	int	dow;
+	int	njobs = 1;
+	int	debug = 0;
+	int	eph_first, eph_last;
 	int	ch, utc_offset;
-	struct passwd *pw;
+	int	status = SERVER_UNAVAILABLE;
 	struct location loc = { 0 };
 	const char *show_info = NULL;
 	const char *calfile = NULL;
 	const char *calhome = NULL;
+	const char *batch_file = NULL;
+	const char *client_socket = NULL;
+	const char *server_socket = NULL;
 	const char *optstring;
+	struct cal_context *ctx;
+	struct batch_query *queries = NULL;
+	size_t nqueries = 0;
+	struct iovec iov;
 	FILE *fp = NULL;
 
-	Options.location = &loc;
-	Options.time = get_time_of_now();
-	Options.today = get_fixed_of_today();
+	options.location = &loc;
+	options.time = get_time_of_now();
+	options.today = get_fixed_of_today();
 	loc.zone = get_utc_offset() / (3600.0 * 24.0);
 
-	optstring = "-A:aB:dF:f:hH:L:l:s:T:t:U:W:";
+	optstring = "-A:aB:b:C:c:dE:F:f:hH:j:L:l:S:s:T:t:U:W:";
 	while ((ch = getopt(argc, argv, optstring)) != -1) {
 		switch (ch) {
 		case '-':		/* backward compatible */
 		case 'a':
 			if (getuid() != 0)
 				errx(1, "must be root to run with '-a'");
-			Options.allmode = true;
+			allmode = true;
 			break;
 
 		case 'W': /* don't need to specially deal with Fridays */
@@ -201,18 +180,39 @@ main(int argc, char *argv[])
 			/* FALLTHROUGH */
 		case 'A': /* days after current date */
 			days_after = (int)strtol(optarg, NULL, 10);
-			if (days_after < 0)
-				errx(1, "number of days must be positive");
+			if (days_after < 0 || days_after > CAL_DAYS_MAX)
+				errx(1, "number of days must be in [0, %d]",
+				     CAL_DAYS_MAX);
 			break;
 
 		case 'B': /* days before current date */
 			days_before = (int)strtol(optarg, NULL, 10);
-			if (days_before < 0)
-				errx(1, "number of days must be positive");
+			if (days_before < 0 || days_before > CAL_DAYS_MAX)
+				errx(1, "number of days must be in [0, %d]",
+				     CAL_DAYS_MAX);
+			break;
+
+		case 'b': /* batch of queries */
+			batch_file = optarg;
+			break;
+
+		case 'C': /* directory of compiled calendar files */
+			options.cache_dir = optarg;
+			break;
+
+		case 'c': /* query the daemon on the socket */
+			client_socket = optarg;
 			break;
 
 		case 'd': /* show debug information */
-			Options.debug++;
+			debug++;
+			break;
+
+		case 'E': /* span of years of the tabulated ephemeris */
+			if (sscanf(optarg, "%d:%d", &eph_first, &eph_last) != 2 ||
+			    eph_first > eph_last ||
+			    !ephemeris_set_span(eph_first, eph_last))
+				errx(1, "invalid ephemeris span: |%s|", optarg);
 			break;
 
 		case 'F': /* change when the weekend starts */
@@ -229,6 +229,12 @@ main(int argc, char *argv[])
 			calhome = optarg;
 			break;
 
+		case 'j': /* number of concurrent jobs or threads */
+			njobs = (int)strtol(optarg, NULL, 10);
+			if (njobs <= 0)
+				errx(1, "number of jobs must be positive");
+			break;
+
 		case 'L': /* location */
 			if (!parse_location(optarg, &loc.latitude,
 					    &loc.longitude, &loc.elevation)) {
@@ -237,17 +243,21 @@ main(int argc, char *argv[])
 			L_flag = true;
 			break;
 
+		case 'S': /* run as daemon on the socket */
+			server_socket = optarg;
+			break;
+
 		case 's': /* show info of specified category */
 			show_info = optarg;
 			break;
 
 		case 'T': /* specify time of day */
-			if (!parse_time(optarg, &Options.time))
+			if (!parse_time(optarg, &options.time))
 				errx(1, "invalid time: |%s|", optarg);
 			break;
 
 		case 't': /* specify date */
-			if (!parse_date(optarg, &Options.today))
+			if (!parse_date(optarg, &options.today))
 				errx(1, "invalid date: |%s|", optarg);
 			break;
 
@@ -266,157 +276,88 @@ main(int argc, char *argv[])
 	if (argc > optind)
 		usage(argv[0]);
 
-	if (Options.allmode && calfile != NULL)
+	if (allmode && calfile != NULL)
 		errx(1, "flags -a and -f cannot be used together");
-	if (Options.allmode && calhome != NULL)
+	if (allmode && calhome != NULL)
 		errx(1, "flags -a and -H cannot be used together");
+	if (server_socket != NULL &&
+	    (allmode || calfile != NULL || calhome != NULL))
+		errx(1, "flag -S cannot be used with -a, -f or -H");
+	if (batch_file != NULL &&
+	    (allmode || client_socket != NULL ||
+	     server_socket != NULL || show_info != NULL))
+		errx(1, "flag -b cannot be used with -a, -c, -S or -s");
+	if (batch_file != NULL && strcmp(batch_file, "-") == 0 &&
+	    calfile != NULL && strcmp(calfile, "/dev/stdin") == 0)
+		errx(1, "flags -b and -f cannot both read standard input");
 
 	if (!L_flag)
 		loc.longitude = loc.zone * 360.0;
 
-	/* Friday displays Monday's events */
-	dow = dayofweek_from_fixed(Options.today);
-	if (days_after == 0 && Friday != -1)
-		days_after = (dow == Friday) ? 3 : 1;
+	/* read the queries before changing the directory and timezone */
+	if (batch_file != NULL) {
+		queries = read_batch(batch_file, days_before, days_after,
+				     Friday, &nqueries);
+	}
 
-	Options.day_begin = Options.today - days_before;
-	Options.day_end = Options.today + days_after;
-	generate_dates();
-	set_calendar(NULL);
+	get_date_range(options.today, days_before, days_after, Friday,
+		       &options.day_begin, &options.day_end);
 
 	setlocale(LC_ALL, "");
-	set_nnames();
 
 	if (setenv("TZ", "UTC", 1) != 0)
 		err(1, "setenv");
 	tzset();
 	/* We're in UTC from now on */
 
+	cal_set_debug(debug);
+	if ((ctx = cal_context_new()) == NULL)
+		errx(1, "cannot create the calendar context");
+	cal_context_set_cache_dir(ctx, options.cache_dir);
+	cal_context_set_location(ctx, loc.latitude, loc.longitude,
+				 loc.elevation, loc.zone);
+	cal_context_set_time(ctx, options.time);
+	cal_context_set_threads(ctx, njobs);
+	if (!cal_context_set_range(ctx, options.today, options.day_begin,
+				   options.day_end))
+		errx(1, "invalid date range");
+
 	if (show_info != NULL) {
-		double t = Options.today + Options.time;
+		double t = options.today + options.time;
 		if (strcmp(show_info, "chinese") == 0) {
-			show_chinese_calendar(Options.today);
+			show_chinese_calendar(options.today);
 		} else if (strcmp(show_info, "julian") == 0) {
-			show_julian_calendar(Options.today);
+			show_julian_calendar(options.today);
 		} else if (strcmp(show_info, "moon") == 0) {
-			print_datetime(t, Options.location);
-			print_location(Options.location, !L_flag);
-			show_moon_info(t, Options.location);
+			print_datetime(t, options.location);
+			print_location(options.location, !L_flag);
+			show_moon_info(t, options.location);
 		} else if (strcmp(show_info, "sun") == 0) {
-			print_datetime(t, Options.location);
-			print_location(Options.location, !L_flag);
-			show_sun_info(t, Options.location);
+			print_datetime(t, options.location);
+			print_location(options.location, !L_flag);
+			show_sun_info(t, options.location);
 		} else {
 			errx(1, "unknown -s value: |%s|", show_info);
 		}
 
-		exit(0);
-	}
-
-	if (Options.allmode) {
-		pid_t kid, deadkid, gkid;
-		time_t t;
-		bool reaped;
-		int kidstat, runningkids;
-		unsigned int sleeptime;
-
-		if (signal(SIGCHLD, handle_sigchld) == SIG_ERR)
-			err(1, "signal");
-		runningkids = 0;
-		t = time(NULL);
-
-		while ((pw = getpwent()) != NULL) {
-			/*
-			 * Enter '~/.calendar' and only try 'calendar'
-			 */
-			if (!cd_home(pw->pw_dir))
-				continue;
-			if (access(calendarNoMail, F_OK) == 0)
-				continue;
-			if ((fp = fopen(calendarFile, "r")) == NULL)
-				continue;
-
-			sleeptime = user_timeout;
-			kid = fork();
-			if (kid < 0) {
-				warn("fork");
-				continue;
-			}
-			if (kid == 0) {
-				gkid = getpid();
-				if (setpgid(gkid, gkid) == -1)
-					err(1, "setpgid");
-				if (setgid(pw->pw_gid) == -1)
-					err(1, "setgid(%u)", pw->pw_gid);
-				if (initgroups(pw->pw_name, pw->pw_gid) == -1)
-					err(1, "initgroups(%s)", pw->pw_name);
-				if (setuid(pw->pw_uid) == -1)
-					err(1, "setuid(%u)", pw->pw_uid);
-
-				ret = cal(fp);
-				fclose(fp);
-				_exit(ret);
-			}
-			/*
-			 * Parent: wait a reasonable time, then kill child
-			 * if necessary.
-			 */
-			runningkids++;
-			reaped = false;
-			do {
-				sleeptime = sleep(sleeptime);
-				/*
-				 * Note that there is the possibility, if the
-				 * sleep stops early due to some other signal,
-				 * of the child terminating and not getting
-				 * detected during the next sleep.  In that
-				 * unlikely worst case, we just sleep too long
-				 * for that user.
-				 */
-				for (;;) {
-					deadkid = waitpid(-1, &kidstat, WNOHANG);
-					if (deadkid <= 0)
-						break;
-					runningkids--;
-					if (deadkid == kid) {
-						reaped = true;
-						sleeptime = 0;
-					}
-				}
-			} while (sleeptime);
-
-			if (!reaped) {
-				/*
-				 * It doesn't really matter if the kill fails;
-				 * there is only one more zombie now.
-				 */
-				gkid = getpgid(kid);
-				if (gkid != getpgrp())
-					killpg(gkid, SIGTERM);
-				else
-					kill(kid, SIGTERM);
-				warnx("user %s (uid %u) did not finish in time "
-				      "(%d seconds)",
-				      pw->pw_name, pw->pw_uid, user_timeout);
-			}
-
-			if (time(NULL) - t > total_timeout) {
-				errx(2, "'calendar -a' timed out (%d seconds); "
-					"stop at user %s (uid %u)",
-					total_timeout, pw->pw_name, pw->pw_uid);
-			}
-		}
-
-		for (;;) {
-			deadkid = waitpid(-1, &kidstat, WNOHANG);
-			if (deadkid <= 0)
-				break;
-			runningkids--;
-		}
-		if (runningkids) {
-			warnx("%d child processes still running when "
-			      "'calendar -a' finished", runningkids);
-		}
+	} else if (server_socket != NULL) {
+		if (!server_run(server_socket, calendarFileSys,
+				options.cache_dir))
+			ret = 1;
+
+	} else if (allmode) {
+		/*
+		 * Parse and resolve the system calendar files once, which
+		 * are then inherited by every child and replayed when the
+		 * user includes them, so that each child only needs to parse
+		 * the user's own calendar file.
+		 */
+		if (chdir(calendarDirs[1]) == 0)
+			cal_context_preload(ctx, calendarFileSys);
+
+		/* The children already run in parallel */
+		cal_context_set_threads(ctx, 1);
+		process_all_users(ctx, njobs);
 
 	} else {
 		if (calfile && (fp = fopen(calfile, "r")) == NULL)
@@ -454,11 +395,35 @@ main(int argc, char *argv[])
 				errx(1, "Cannot find calendar file");
 		}
 
-		ret = cal(fp);
+		if (batch_file != NULL)
+			status = process_batch(ctx, fp, queries, nqueries);
+		else if (client_socket != NULL)
+			status = query_server(client_socket, fp);
+		if (status == SERVER_UNAVAILABLE) {
+			/* no daemon to answer; process in-place */
+			rewind(fp);
+			if (cal_context_load(ctx, fp) &&
+			    (iov.iov_base = cal_context_format(ctx,
+					&iov.iov_len)) != NULL) {
+				fflush(stdout);
+				if (!write_iov(STDOUT_FILENO, &iov, 1))
+					warn("write");
+				free(iov.iov_base);
+				status = SERVER_OK;
+			}
+		}
+		if (status != SERVER_OK)
+			ret = 1;
 		fclose(fp);
 	}
 
-	free_dates();
+	if (debug) {
+		ephemeris_show_stats();
+		nth_new_moon_show_stats();
+	}
+
+	cal_context_free(ctx);
+	free(queries);
 	return (ret);
 }
 
@@ -466,7 +431,500 @@ main(int argc, char *argv[])
 static void
 handle_sigchld(int signo __unused)
 {
-	/* empty; just let the main() to reap the child */
+	int saved_errno = errno;
+
+	/* wake up the event loop to reap the child */
+	if (sigchld_pipe[1] != -1 && write(sigchld_pipe[1], "", 1) == -1) {
+		/* the pipe is full, so the loop will wake up anyway */
+	}
+	errno = saved_errno;
+}
+
+static double
+get_monotonic_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Fork a child to process the calendar file $fp of user $pw.
+ * Return the PID of the child, or -1 on failure.
+ */
+static pid_t
+spawn_user(struct cal_context *ctx, struct passwd *pw, FILE *fp)
+{
+	pid_t kid, gkid;
+	size_t len;
+	char *data;
+
+	kid = fork();
+	if (kid < 0) {
+		warn("fork");
+		return -1;
+	}
+	if (kid > 0)
+		return kid;
+
+	close(sigchld_pipe[0]);
+	close(sigchld_pipe[1]);
+	sigchld_pipe[0] = sigchld_pipe[1] = -1;
+	signal(SIGCHLD, SIG_DFL);
+
+	gkid = getpid();
+	if (setpgid(gkid, gkid) == -1)
+		err(1, "setpgid");
+	if (setgid(pw->pw_gid) == -1)
+		err(1, "setgid(%u)", pw->pw_gid);
+	if (initgroups(pw->pw_name, pw->pw_gid) == -1)
+		err(1, "initgroups(%s)", pw->pw_name);
+	if (setuid(pw->pw_uid) == -1)
+		err(1, "setuid(%u)", pw->pw_uid);
+
+	if (!cal_context_load(ctx, fp))
+		_exit(1);
+	fclose(fp);
+
+	/*
+	 * Format the events in memory, so the mail can be skipped if there
+	 * is no output.
+	 */
+	if ((data = cal_context_format(ctx, &len)) == NULL)
+		_exit(1);
+	send_mail(data, len);
+	free(data);
+	_exit(0);
+}
+
+/*
+ * Process the calendar files of all users, with up to $njobs children
+ * running at the same time.  A single event loop reaps the children,
+ * which are woken up by SIGCHLD through a self-pipe, and kills the ones
+ * that exceed 'user_timeout'.
+ */
+static void
+process_all_users(struct cal_context *ctx, int njobs)
+{
+	struct user_job {
+		pid_t	 pid;		/* 0 if the slot is free */
+		uid_t	 uid;
+		char	*name;
+		double	 start;
+		double	 deadline;
+		bool	 killed;	/* SIGTERM has been sent */
+	} *jobs, *job;
+	struct passwd *pw;
+	struct pollfd pfd;
+	FILE *fp;
+	pid_t kid, pgid;
+	double t_begin, now, next;
+	double busy = 0.0;
+	bool exhausted = false;
+	int nrunning = 0, nmax = 0;
+	int nusers = 0, nfailed = 0, ntimedout = 0;
+	int kidstat, timeout, sig;
+	char c;
+
+	if (pipe(sigchld_pipe) == -1)
+		err(1, "pipe");
+	for (int i = 0; i < 2; i++) {
+		fcntl(sigchld_pipe[i], F_SETFL, O_NONBLOCK);
+		fcntl(sigchld_pipe[i], F_SETFD, FD_CLOEXEC);
+	}
+	if (signal(SIGCHLD, handle_sigchld) == SIG_ERR)
+		err(1, "signal");
+
+	jobs = xcalloc((size_t)njobs, sizeof(*jobs));
+	t_begin = get_monotonic_time();
+
+	for (;;) {
+		/* Start the children for the next users */
+		while (nrunning < njobs && !exhausted) {
+			if ((pw = getpwent()) == NULL) {
+				exhausted = true;
+				break;
+			}
+			/*
+			 * Enter '~/.calendar' and only try 'calendar'
+			 */
+			if (!cd_home(pw->pw_dir))
+				continue;
+			if (access(calendarNoMail, F_OK) == 0)
+				continue;
+			if ((fp = fopen(calendarFile, "r")) == NULL)
+				continue;
+
+			kid = spawn_user(ctx, pw, fp);
+			fclose(fp);
+			if (kid < 0)
+				continue;
+
+			for (job = jobs; job->pid != 0; job++)
+				;
+			job->pid = kid;
+			job->uid = pw->pw_uid;
+			job->name = xstrdup(pw->pw_name);
+			job->start = get_monotonic_time();
+			job->deadline = job->start + user_timeout;
+			job->killed = false;
+			nusers++;
+			if (++nrunning > nmax)
+				nmax = nrunning;
+		}
+
+		if (nrunning == 0 && exhausted)
+			break;
+
+		/* Wait for a child to exit or the nearest deadline */
+		now = get_monotonic_time();
+		next = now + user_timeout;
+		for (int i = 0; i < njobs; i++) {
+			if (jobs[i].pid != 0 && jobs[i].deadline < next)
+				next = jobs[i].deadline;
+		}
+		timeout = (next > now) ? (int)ceil((next - now) * 1000) : 0;
+		pfd.fd = sigchld_pipe[0];
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, timeout) == -1 && errno != EINTR)
+			err(1, "poll");
+		while (read(sigchld_pipe[0], &c, 1) == 1)
+			;
+
+		/* Reap the exited children */
+		while ((kid = waitpid(-1, &kidstat, WNOHANG)) > 0) {
+			for (job = jobs; job < jobs + njobs; job++) {
+				if (job->pid == kid)
+					break;
+			}
+			if (job == jobs + njobs)
+				continue;  /* e.g., a killed child */
+
+			now = get_monotonic_time();
+			busy += now - job->start;
+			if (!WIFEXITED(kidstat) || WEXITSTATUS(kidstat) != 0)
+				nfailed++;
+			DPRINTF("%s: user %s (uid %u) finished in %.3f seconds "
+				"(status 0x%x)\n", __func__, job->name,
+				job->uid, now - job->start, kidstat);
+			free(job->name);
+			job->pid = 0;
+			nrunning--;
+		}
+
+		/*
+		 * Kill the children that did not finish in time; try
+		 * SIGTERM first and then SIGKILL after one more second.
+		 */
+		now = get_monotonic_time();
+		for (job = jobs; job < jobs + njobs; job++) {
+			if (job->pid == 0 || job->deadline > now)
+				continue;
+
+			if (!job->killed) {
+				warnx("user %s (uid %u) did not finish in time "
+				      "(%d seconds)",
+				      job->name, job->uid, user_timeout);
+				ntimedout++;
+				job->killed = true;
+				sig = SIGTERM;
+			} else {
+				sig = SIGKILL;
+			}
+			job->deadline = now + 1.0;
+
+			/*
+			 * It doesn't really matter if the kill fails;
+			 * the child will be reaped anyway.
+			 */
+			pgid = getpgid(job->pid);
+			if (pgid > 0 && pgid != getpgrp())
+				killpg(pgid, sig);
+			else
+				kill(job->pid, sig);
+		}
+
+		if (now - t_begin > total_timeout) {
+			errx(2, "'calendar -a' timed out (%d seconds); "
+				"stop after %d users", total_timeout, nusers);
+		}
+	}
+
+	/* Report the throughput, e.g., to the mail of the cron job */
+	now = get_monotonic_time();
+	warnx("processed %d users in %.3f seconds (%.1f users/second) "
+	      "with up to %d concurrent jobs; %d failed, %d timed out; "
+	      "average %.3f seconds per user",
+	      nusers, now - t_begin,
+	      (now > t_begin) ? nusers / (now - t_begin) : 0.0,
+	      nmax, nfailed, ntimedout,
+	      (nusers > 0) ? busy / nusers : 0.0);
+
+	free(jobs);
+	signal(SIGCHLD, SIG_DFL);
+	close(sigchld_pipe[0]);
+	close(sigchld_pipe[1]);
+	sigchld_pipe[0] = sigchld_pipe[1] = -1;
+}
+
+static void
+send_mail(char *data, size_t len)
+{
+	struct strbuf header = { 0 };
+	struct iovec iov[2];
+	int pdes[2];
+
+	assert(allmode == true);
+
+	if (len == 0) {
+		DPRINTF("%s: no events; skip sending mail\n", __func__);
+		return;
+	}
+	if (pipe(pdes) < 0) {
+		warnx("pipe");
+		return;
+	}
+
+	switch (fork()) {
+	case -1:
+		close(pdes[0]);
+		close(pdes[1]);
+		return;
+	case 0:
+		/* child -- set stdin to pipe output */
+		if (pdes[0] != STDIN_FILENO) {
+			dup2(pdes[0], STDIN_FILENO);
+			close(pdes[0]);
+		}
+		close(pdes[1]);
+		execl(_PATH_SENDMAIL, "sendmail", "-i", "-t", "-F",
+		      "\"Reminder Service\"", (char *)NULL);
+		warn(_PATH_SENDMAIL);
+		_exit(1);
+	}
+	/* parent -- write the header and the events to pipe input */
+	close(pdes[0]);
+
+	write_mailheader(&header);
+	iov[0].iov_base = header.data;
+	iov[0].iov_len = header.len;
+	iov[1].iov_base = data;
+	iov[1].iov_len = len;
+	if (!write_iov(pdes[1], iov, (int)nitems(iov)))
+		warn("%s: write", __func__);
+	close(pdes[1]);
+	strbuf_free(&header);
+
+	while (wait(NULL) >= 0)
+		;
+}
+
+/*
+ * Process the calendar file $fp once for the date ranges of all the $n
+ * batch queries, and write out the events of each query after a header
+ * line of '# YYYY-MM-DD -A days -B days'.
+ */
+static int
+process_batch(struct cal_context *ctx, FILE *fp,
+	      const struct batch_query *queries, size_t n)
+{
+	const struct batch_query *bq;
+	struct strbuf header = { 0 };
+	struct iovec iov[2];
+	struct date date;
+	char *data;
+	int begin, end;
+
+	if (n == 0)
+		return SERVER_OK;
+
+	/* cover all the queries to load the calendar file only once */
+	begin = queries[0].day_begin;
+	end = queries[0].day_end;
+	for (size_t i = 1; i < n; i++) {
+		if (queries[i].day_begin < begin)
+			begin = queries[i].day_begin;
+		if (queries[i].day_end > end)
+			end = queries[i].day_end;
+	}
+	DPRINTF("%s: %zu queries in [%d, %d]\n", __func__, n, begin, end);
+
+	if (!cal_context_set_range(ctx, queries[0].today, begin, end) ||
+	    !cal_context_load(ctx, fp))
+		return SERVER_FAILED;
+
+	fflush(stdout);
+	for (size_t i = 0; i < n; i++) {
+		bq = &queries[i];
+		gregorian_from_fixed(bq->today, &date);
+		header.len = 0;
+		strbuf_printf(&header, "# %d-%02d-%02d -A %d -B %d\n",
+			      date.year, date.month, date.day,
+			      bq->day_end - bq->today,
+			      bq->today - bq->day_begin);
+		iov[0].iov_base = header.data;
+		iov[0].iov_len = header.len;
+		iov[1].iov_base = cal_context_format_range(ctx,
+				bq->day_begin, bq->day_end, &iov[1].iov_len);
+		data = iov[1].iov_base;  /* iov is modified by write_iov() */
+		if (data == NULL) {
+			strbuf_free(&header);
+			return SERVER_FAILED;
+		}
+		if (!write_iov(STDOUT_FILENO, iov, (int)nitems(iov)))
+			warn("write");
+		free(data);
+	}
+	strbuf_free(&header);
+
+	return SERVER_OK;
+}
+
+/*
+ * Query the daemon on socket $path to process the calendar file $fp, and
+ * write out the events.  Return SERVER_UNAVAILABLE if there is no daemon
+ * to answer, so the file is to be processed in-place.
+ */
+static int
+query_server(const char *path, FILE *fp)
+{
+	struct server_query q = { .magic = SERVER_MAGIC };
+	struct iovec iov;
+	struct stat sb;
+	size_t len;
+	char *data;
+	int dir_fd, status;
+
+	/* the daemon may have consumed a pipe before giving up */
+	if (fstat(fileno(fp), &sb) == -1 || !S_ISREG(sb.st_mode))
+		return SERVER_UNAVAILABLE;
+	if ((dir_fd = open(".", O_RDONLY)) == -1)
+		return SERVER_UNAVAILABLE;
+
+	q.today = options.today;
+	q.day_begin = options.day_begin;
+	q.day_end = options.day_end;
+	q.time = options.time;
+	q.latitude = options.location->latitude;
+	q.longitude = options.location->longitude;
+	q.elevation = options.location->elevation;
+	q.zone = options.location->zone;
+	snprintf(q.locale, sizeof(q.locale), "%s", setlocale(LC_ALL, NULL));
+
+	status = server_query(path, &q, fileno(fp), dir_fd, &data, &len);
+	close(dir_fd);
+
+	if (status == SERVER_OK) {
+		iov.iov_base = data;
+		iov.iov_len = len;
+		fflush(stdout);
+		if (!write_iov(STDOUT_FILENO, &iov, 1))
+			warn("write");
+	}
+	free(data);
+
+	return status;
+}
+
+/*
+ * Read the batch queries from $file ('-' for the standard input), one per
+ * line of 'date [-A num] [-B num]' with the date in the format of the '-t'
+ * flag, while the days not given default to the '-A' and '-B' flags.
+ * Empty lines and lines beginning with '#' are skipped.
+ */
+static struct batch_query *
+read_batch(const char *file, int days_before, int days_after, int friday,
+	   size_t *count)
+{
+	struct batch_query *queries = NULL;
+	size_t n = 0, cap = 0;
+	char line[256], query[256], *p;
+	int lineno = 0;
+	FILE *fp;
+
+	if (strcmp(file, "-") == 0)
+		fp = stdin;
+	else if ((fp = fopen(file, "r")) == NULL)
+		errx(1, "Cannot open batch file: '%s'", file);
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		lineno++;
+		p = trimr(triml(line));
+		if (*p == '\0' || *p == '#')
+			continue;
+
+		if (n == cap) {
+			cap = (cap == 0) ? 64 : cap * 2;
+			queries = xrealloc(queries, cap * sizeof(*queries));
+		}
+		snprintf(query, sizeof(query), "%s", p);
+		if (!parse_batch_query(p, days_before, days_after, friday,
+				       &queries[n])) {
+			errx(1, "%s:%d: invalid query: |%s|",
+			     file, lineno, query);
+		}
+		n++;
+	}
+
+	if (fp != stdin)
+		fclose(fp);
+
+	*count = n;
+	return queries;
+}
+
+static bool
+parse_batch_query(char *s, int days_before, int days_after, int friday,
+		  struct batch_query *bq)
+{
+	const char *sep = " \t";
+	char *p, *end;
+	int *days;
+	long v;
+
+	if ((p = strtok(s, sep)) == NULL || !parse_date(p, &bq->today))
+		return false;
+
+	while ((p = strtok(NULL, sep)) != NULL) {
+		if (strcmp(p, "-A") == 0)
+			days = &days_after;
+		else if (strcmp(p, "-B") == 0)
+			days = &days_before;
+		else
+			return false;
+
+		if ((p = strtok(NULL, sep)) == NULL)
+			return false;
+		errno = 0;
+		v = strtol(p, &end, 10);
+		if (*end != '\0' || errno != 0 || v < 0 || v > CAL_DAYS_MAX)
+			return false;
+		*days = (int)v;
+	}
+
+	get_date_range(bq->today, days_before, days_after, friday,
+		       &bq->day_begin, &bq->day_end);
+	return true;
+}
+
+/*
+ * Get the date range [$begin, $end] of $days_before and $days_after around
+ * $today.  If $days_after is 0, the day before the weekend (i.e., $friday
+ * or -1 to disable) displays the events of the weekend and next Monday,
+ * while the other days display the next day.
+ */
+static void
+get_date_range(int today, int days_before, int days_after, int friday,
+	       int *begin, int *end)
+{
+	if (days_after == 0 && friday != -1) {
+		days_after = (dayofweek_from_fixed(today) == friday) ?
+			3 : 1;
+	}
+
+	*begin = today - days_before;
+	*end = today + days_after;
 }
 
 static double
@@ -567,10 +1025,36 @@ usage(const char *progname)
 {
 	fprintf(stderr,
 		"usage:\n"
-		"%s [-A days] [-a] [-B days] [-d] [-F friday]\n"
-		"\t[-f calendar_file] [-H calendar_home]\n"
-		"\t[-L latitude,longitude[,elevation]] [-s category]\n"
-		"\t[-T hh:mm[:ss]] [-t [[[CC]YY]MM]DD] [-U ±hh[[:]mm]] [-W days]\n",
+		"%s [-A days] [-a] [-B days] [-b batch_file] [-C cache_dir]\n"
+		"\t[-c socket] [-d] [-E first_year:last_year] [-F friday]\n"
+		"\t[-f calendar_file] [-H calendar_home] [-j jobs]\n"
+		"\t[-L latitude,longitude[,elevation]] [-S socket]\n"
+		"\t[-s category] [-T hh:mm[:ss]] [-t [[[CC]YY]MM]DD]\n"
+		"\t[-U ±hh[[:]mm]] [-W days]\n",
 		progname);
 	exit(1);
 }
+
+static void
+write_mailheader(struct strbuf *sb)
+{
+	uid_t uid = getuid();
+	struct passwd *pw = getpwuid(uid);
+	struct date date;
+	char dayname[32] = { 0 };
+	int dow;
+
+	gregorian_from_fixed(options.today, &date);
+	dow = dayofweek_from_fixed(options.today);
+	sprintf(dayname, "%s, %d %s %d",
+		dow_names[dow].f_name, date.day,
+		month_names[date.month-1].f_name, date.year);
+
+	strbuf_printf(sb,
+		"From: %s (Reminder Service)\n"
+		"To: %s\n"
+		"Subject: %s's Calendar\n"
+		"Precedence: bulk\n"
+		"Auto-Submitted: auto-generated\n\n",
+		pw->pw_name, pw->pw_name, dayname);
+}
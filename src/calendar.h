@@ -48,23 +48,17 @@
 #define __dead2		__attribute__((__noreturn__))
 #endif
 
-/*
- * Maximum number of repeats of an event.  100 should be enough, which is
- * about the number of weeks in 2 years).  If you need more, then you may
- * be using this program wrong...
- */
-#define CAL_MAX_REPEAT	100
-
 #define DPRINTF(...) \
-	if (Options.debug) fprintf(stderr, __VA_ARGS__)
+	if (cal_debug) fprintf(stderr, __VA_ARGS__)
 #define DPRINTF2(...) \
-	if (Options.debug >= 2) fprintf(stderr, __VA_ARGS__)
+	if (cal_debug >= 2) fprintf(stderr, __VA_ARGS__)
 #define DPRINTF3(...) \
-	if (Options.debug >= 3) fprintf(stderr, __VA_ARGS__)
+	if (cal_debug >= 3) fprintf(stderr, __VA_ARGS__)
 
 
 struct location;
-struct cal_day;
+struct cal_context;
+struct cal_matches;
 
 struct cal_options {
 	struct location *location;
@@ -72,8 +66,9 @@ struct cal_options {
 	int today;  /* R.D. of today to remind events */
 	int day_begin;  /* beginning of date range to remind events */
 	int day_end;  /* end of date range to remind events */
-	int debug;  /* debug log level (higher means more verbose) */
-	bool allmode;  /* whether to process calendars for all users */
+	int nthreads;  /* number of threads to resolve the entries */
+	const char *cache_dir;  /* directory of compiled calendar files */
+	int include_fd;  /* directory of included files; -1 for cwd */
 };
 
 /* IDs of supported calendars */
@@ -87,19 +82,19 @@ struct calendar {
 	int	id;  /* enum ID of the calendar */
 	const char *name;
 	int	(*format_date)(char *buf, size_t size, int rd);
-	int	(*find_days_ymd)(int year, int month, int day,
-				 struct cal_day **dayp, char **edp);
-	int	(*find_days_dom)(int dom, struct cal_day **dayp, char **edp);
-	int	(*find_days_month)(int month, struct cal_day **dayp,
-				   char **edp);
-	int	(*find_days_mdow)(int month, int dow, int index,
-				  struct cal_day **dayp, char **edp);
+	int	(*find_days_ymd)(struct cal_context *ctx, int year, int month,
+				 int day, struct cal_matches *matches);
+	int	(*find_days_dom)(struct cal_context *ctx, int dom,
+				 struct cal_matches *matches);
+	int	(*find_days_month)(struct cal_context *ctx, int month,
+				   struct cal_matches *matches);
+	int	(*find_days_mdow)(struct cal_context *ctx, int month, int dow,
+				  int index, struct cal_matches *matches);
 };
 
-extern struct cal_options Options;
-extern struct calendar *Calendar;
+extern int cal_debug;  /* debug log level (higher means more verbose) */
 extern const char *calendarDirs[];  /* paths to search for calendar files */
 
-bool	set_calendar(const char *name);
+bool	set_calendar(struct cal_context *ctx, const char *name);
 
 #endif
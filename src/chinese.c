@@ -52,6 +52,9 @@
  * the first lunar month that is wholly within a solar month.
  */
 
+#include <assert.h>
+#include <err.h>
+#include <inttypes.h>
 #include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -59,6 +62,7 @@
 #include "calendar.h"
 #include "basics.h"
 #include "chinese.h"
+#include "context.h"
 #include "dates.h"
 #include "gregorian.h"
 #include "moon.h"
@@ -71,6 +75,99 @@
  */
 static const int epoch = -963099;  /* Gregorian: -2636, February, 15 */
 
+/*
+ * Elapsed years since the epoch of the Chinese year starting in Gregorian
+ * year $g_year.
+ */
+#define CHINESE_ELAPSED_YEARS(g_year)	((g_year) + 2637)
+
+/*
+ * Table of the Chinese years starting in the Gregorian years from
+ * CHINESE_TABLE_FIRST to CHINESE_TABLE_LAST, generated with the
+ * astronomical calculations below by 'chinese_check_table()'.
+ * Each year is packed as:
+ * - bits 0-12: whether the i-th month (counting the leap month) of the
+ *   year is 30 days long (otherwise 29 days);
+ * - bits 13-16: the month [1, 12] that the leap month follows, or 0 if
+ *   the year has no leap month;
+ * - bits 17-22: days of the New Year after the Gregorian January 1.
+ */
+#define CHINESE_TABLE_FIRST	1900
+#define CHINESE_TABLE_LAST	2200
+
+static const uint32_t chinese_years[] = {
+	0x3d16d2, 0x620752, 0x4c0ea5, 0x38b64a, 0x5c064b, 0x440a9b,
+	0x30955a, 0x56056a, 0x400b59, 0x2a5752, 0x500752, 0x3adb25,
+	0x600b25, 0x480a4b, 0x32b4ab, 0x5802ad, 0x42056b, 0x2c4b69,
+	0x520da9, 0x3efd92, 0x640e92, 0x4c0d25, 0x36ba4d, 0x5c0a56,
+	0x4602b6, 0x2e95b5, 0x5606d4, 0x400ea9, 0x2c5e92, 0x500e92,
+	0x3acd26, 0x5e052b, 0x480a57, 0x32b2b6, 0x580b5a, 0x4406d4,
+	0x2e6ec9, 0x520749, 0x3cf693, 0x620a93, 0x4c052b, 0x34ca5b,
+	0x5a0aad, 0x46056a, 0x309b55, 0x560ba4, 0x400b49, 0x2a5a93,
+	0x500a95, 0x38f52d, 0x5e0536, 0x480aad, 0x34b5aa, 0x5805b2,
+	0x420da5, 0x2e7d4a, 0x540d4a, 0x3d0a95, 0x600a97, 0x4c0556,
+	0x36cab5, 0x5a0ad5, 0x4606d2, 0x308ea5, 0x560ea5, 0x40064a,
+	0x286c97, 0x4e0a9b, 0x3af55a, 0x5e056a, 0x480b69, 0x34b752,
+	0x5a0b52, 0x420b25, 0x2c964b, 0x520a4b, 0x3d14ab, 0x6002ad,
+	0x4a056d, 0x36cb69, 0x5c0da9, 0x460d92, 0x309d25, 0x560d25,
+	0x415a4d, 0x640a56, 0x4e02b6, 0x38c5b5, 0x5e06d5, 0x480ea9,
+	0x34be92, 0x5a0e92, 0x440d26, 0x2c6a56, 0x500a57, 0x3d14d6,
+	0x62035a, 0x4a06d5, 0x36b6c9, 0x5c0749, 0x460693, 0x2e952b,
+	0x54052b, 0x3e0a5b, 0x2a555a, 0x4e056a, 0x38fb55, 0x600ba4,
+	0x4a0b49, 0x32ba93, 0x580a95, 0x42052d, 0x2c8aad, 0x500ab5,
+	0x3d35aa, 0x6205d2, 0x4c0da5, 0x36dd4a, 0x5c0d4a, 0x460c95,
+	0x30952e, 0x540556, 0x3e0ab5, 0x2a55b2, 0x5006d2, 0x38cea5,
+	0x5e0725, 0x48064b, 0x32ac97, 0x560cab, 0x42055a, 0x2c6ad6,
+	0x520b69, 0x3d7752, 0x620b52, 0x4c0b25, 0x36da4b, 0x5a0a4b,
+	0x4404ab, 0x2ea55b, 0x5405ad, 0x3e0b6a, 0x2a5b52, 0x500d92,
+	0x3afd25, 0x5e0d25, 0x480a55, 0x32b4ad, 0x5804b6, 0x4005b5,
+	0x2c6daa, 0x520ec9, 0x3f1e92, 0x620e92, 0x4c0d26, 0x36ca56,
+	0x5a0a57, 0x440556, 0x2e86d5, 0x540755, 0x400749, 0x286e93,
+	0x4e0693, 0x38f52b, 0x5e052b, 0x460a5b, 0x32b55a, 0x58056a,
+	0x420b65, 0x2c974a, 0x520b4a, 0x3d1a95, 0x620a95, 0x4a052d,
+	0x34caad, 0x5a0ab5, 0x4605aa, 0x2e8ba5, 0x540da5, 0x400d4a,
+	0x2a7c95, 0x4e0c96, 0x38f94e, 0x5e0556, 0x480ab5, 0x32b5b2,
+	0x5806d2, 0x420ea5, 0x2e8e4a, 0x50068b, 0x3b0c97, 0x6004ab,
+	0x4a055b, 0x34cad6, 0x5a0b6a, 0x460752, 0x309725, 0x540b45,
+	0x3e0a8b, 0x28549b, 0x4e04ab, 0x38e95b, 0x5e05ad, 0x4a0baa,
+	0x36bb52, 0x5a0d92, 0x440d25, 0x2e9a4b, 0x540a55, 0x3d34ad,
+	0x6204b6, 0x4c06b5, 0x38cdaa, 0x5c0ec9, 0x480e92, 0x329d26,
+	0x580d2a, 0x400a56, 0x2a74b6, 0x500556, 0x3aead5, 0x5e0b55,
+	0x4a074a, 0x34ae93, 0x5a0695, 0x42052b, 0x2c8a57, 0x520a9b,
+	0x3f755a, 0x62056a, 0x4c0b65, 0x38d74a, 0x5e0b4a, 0x460b15,
+	0x30b52b, 0x56054d, 0x400aad, 0x2a556a, 0x5005aa, 0x3aeba5,
+	0x600da5, 0x4a0d4a, 0x34bd15, 0x5a0d16, 0x44094e, 0x2c8aad,
+	0x520ad6, 0x3f75b4, 0x6406d2, 0x4c0ea5, 0x38ce8a, 0x5c068b,
+	0x460d17, 0x30a956, 0x54095b, 0x400ada, 0x2c76d4, 0x500754,
+	0x3af745, 0x600b45, 0x4a0a8b, 0x32d52b, 0x5804ad, 0x42096b,
+	0x2e8b5a, 0x520daa, 0x3f5b54, 0x640da2, 0x4e0d45, 0x36da95,
+	0x5c0a95, 0x46052d, 0x30aaad, 0x540ab5, 0x400daa, 0x2c7da4,
+	0x520ea2, 0x3afd46, 0x600d4a, 0x4a0a96, 0x34d536, 0x58055a,
+	0x420ad5, 0x2e96ca, 0x540752, 0x3c0ea5, 0x284d4a, 0x4c054b,
+	0x36ca97, 0x5a0aab, 0x46055a, 0x30aad5, 0x560b65, 0x400752,
+	0x2a7aa5, 0x500b25, 0x3afa4b, 0x5e094d, 0x480aad, 0x34d56a,
+	0x5a05b4,
+};
+
+/* Chinese month found in the above table */
+struct chinese_tmonth {
+	int	yidx;	/* index of the year in the table */
+	int	midx;	/* index of the month in the year */
+	int	start;	/* fixed date of the first day of the month */
+	int	len;	/* days of the month */
+};
+
+static int	chinese_table_newyear(int yidx);
+static void	chinese_table_month(int yidx, int midx, int *month, bool *leap);
+static bool	chinese_table_lookup(int rd, struct chinese_tmonth *tm);
+static bool	chinese_table_from_fixed(int rd, struct chinese_date *date);
+static bool	chinese_table_to_fixed(const struct chinese_date *date, int *rd);
+static int	chinese_month_start_before(int rd);
+static int	chinese_month_start_onafter(int rd);
+static int	chinese_new_year_astro(int year);
+static void	chinese_from_fixed_astro(int rd, struct chinese_date *date);
+static int	fixed_from_chinese_astro(const struct chinese_date *date);
+
 /*
  * Timezone (in fraction of days) of Beijing adopted in Chinese calendar
  * calculations.
@@ -236,8 +333,8 @@ chinese_new_year_onbefore(int rd)
  * Calculate the fixed date of Chinese New Year in Gregorian year $year.
  * Ref: Sec.(19.6), Eq.(19.26)
  */
-int
-chinese_new_year(int year)
+static int
+chinese_new_year_astro(int year)
 {
 	struct date date = { year, 7, 1 };
 	int july1 = fixed_from_gregorian(&date);
@@ -249,8 +346,8 @@ chinese_new_year(int year)
  * to the fixed date $rd.
  * Ref: Sec.(19.3), Eq.(19.16)
  */
-void
-chinese_from_fixed(int rd, struct chinese_date *date)
+static void
+chinese_from_fixed_astro(int rd, struct chinese_date *date)
 {
 	/* prior and following winter solstice */
 	int s1 = chinese_winter_solstice_onbefore(rd);
@@ -288,8 +385,8 @@ chinese_from_fixed(int rd, struct chinese_date *date)
  * (cycle, year, month, leap, day).
  * Ref: Sec.(19.3), Eq.(19.17)
  */
-int
-fixed_from_chinese(const struct chinese_date *date)
+static int
+fixed_from_chinese_astro(const struct chinese_date *date)
 {
 	int midyear = (int)floor(epoch + mean_tropical_year *
 				 ((date->cycle - 1) * 60 + date->year - 0.5));
@@ -299,7 +396,7 @@ fixed_from_chinese(const struct chinese_date *date)
 	int newmoon = chinese_new_moon_onafter(
 			newyear + (date->month - 1) * 29);
 	struct chinese_date date2;
-	chinese_from_fixed(newmoon, &date2);
+	chinese_from_fixed_astro(newmoon, &date2);
 	if (date->month != date2.month || date->leap != date2.leap) {
 		/* there was a prior leap month, so get the next month */
 		newmoon = chinese_new_moon_onafter(newmoon + 1);
@@ -308,6 +405,256 @@ fixed_from_chinese(const struct chinese_date *date)
 	return newmoon + date->day - 1;
 }
 
+/*
+ * Calculate the fixed date of the New Year of the $yidx-th year in the table.
+ */
+static int
+chinese_table_newyear(int yidx)
+{
+	return (gregorian_new_year(CHINESE_TABLE_FIRST + yidx) +
+		(int)(chinese_years[yidx] >> 17));
+}
+
+/*
+ * Determine the month number and whether it is a leap month of the
+ * $midx-th month of the $yidx-th year in the table.
+ */
+static void
+chinese_table_month(int yidx, int midx, int *month, bool *leap)
+{
+	int leap_month = (int)((chinese_years[yidx] >> 13) & 0xf);
+
+	*leap = (leap_month != 0 && midx == leap_month);
+	*month = (leap_month != 0 && midx >= leap_month) ? midx : midx + 1;
+}
+
+/*
+ * Find the Chinese month containing the fixed date $rd in the table.
+ * Return false if $rd is out of the table.
+ */
+static bool
+chinese_table_lookup(int rd, struct chinese_tmonth *tm)
+{
+	const int nyears = (int)nitems(chinese_years);
+	uint32_t info;
+	int nmonths;
+
+	tm->yidx = gregorian_year_from_fixed(rd) - CHINESE_TABLE_FIRST;
+	if (tm->yidx < 0 || tm->yidx >= nyears)
+		return false;
+	tm->start = chinese_table_newyear(tm->yidx);
+	if (rd < tm->start) {
+		if (--tm->yidx < 0)
+			return false;
+		tm->start = chinese_table_newyear(tm->yidx);
+	}
+
+	info = chinese_years[tm->yidx];
+	nmonths = ((info >> 13) & 0xf) ? 13 : 12;
+	for (tm->midx = 0; tm->midx < nmonths; tm->midx++) {
+		tm->len = 29 + (int)((info >> tm->midx) & 1);
+		if (rd < tm->start + tm->len)
+			return true;
+		tm->start += tm->len;
+	}
+
+	return false;
+}
+
+/*
+ * Same as 'chinese_from_fixed()' but use the table.
+ * Return false if $rd is out of the table.
+ */
+static bool
+chinese_table_from_fixed(int rd, struct chinese_date *date)
+{
+	struct chinese_tmonth tm;
+	int elapsed_years;
+
+	if (!chinese_table_lookup(rd, &tm))
+		return false;
+
+	elapsed_years = CHINESE_ELAPSED_YEARS(CHINESE_TABLE_FIRST + tm.yidx);
+	date->cycle = div_floor(elapsed_years - 1, 60) + 1;
+	date->year = mod1(elapsed_years, 60);
+	chinese_table_month(tm.yidx, tm.midx, &date->month, &date->leap);
+	date->day = rd - tm.start + 1;
+	return true;
+}
+
+/*
+ * Same as 'fixed_from_chinese()' but use the table.
+ * Return false if $date is out of the table.
+ */
+static bool
+chinese_table_to_fixed(const struct chinese_date *date, int *rd)
+{
+	uint32_t info;
+	int yidx, midx, nmonths, month;
+	bool leap;
+
+	yidx = ((date->cycle - 1) * 60 + date->year -
+		CHINESE_ELAPSED_YEARS(CHINESE_TABLE_FIRST));
+	if (yidx < 0 || yidx >= (int)nitems(chinese_years) ||
+	    date->month < 1 || date->month > 12)
+		return false;
+
+	info = chinese_years[yidx];
+	nmonths = ((info >> 13) & 0xf) ? 13 : 12;
+
+	/* the same month as the astronomical calculation resolves to */
+	midx = date->month - 1;
+	chinese_table_month(yidx, midx, &month, &leap);
+	if (month != date->month || leap != date->leap)
+		midx++;
+	if (midx >= nmonths)
+		return false;
+
+	*rd = chinese_table_newyear(yidx) + date->day - 1;
+	for (int i = 0; i < midx; i++)
+		*rd += 29 + (int)((info >> i) & 1);
+	return true;
+}
+
+/*
+ * Same as 'chinese_new_moon_before()' but use the table if possible.
+ */
+static int
+chinese_month_start_before(int rd)
+{
+	struct chinese_tmonth tm;
+
+	if (chinese_table_lookup(rd - 1, &tm))
+		return tm.start;
+	return chinese_new_moon_before(rd);
+}
+
+/*
+ * Same as 'chinese_new_moon_onafter()' but use the table if possible.
+ */
+static int
+chinese_month_start_onafter(int rd)
+{
+	struct chinese_tmonth tm;
+
+	if (chinese_table_lookup(rd, &tm))
+		return (rd == tm.start) ? rd : tm.start + tm.len;
+	return chinese_new_moon_onafter(rd);
+}
+
+/*
+ * Calculate the fixed date of Chinese New Year in Gregorian year $year.
+ */
+int
+chinese_new_year(int year)
+{
+	int yidx = year - CHINESE_TABLE_FIRST;
+
+	if (yidx >= 0 && yidx < (int)nitems(chinese_years))
+		return chinese_table_newyear(yidx);
+	return chinese_new_year_astro(year);
+}
+
+/*
+ * Calculate the Chinese date (cycle, year, month, leap, day) corresponding
+ * to the fixed date $rd.
+ */
+void
+chinese_from_fixed(int rd, struct chinese_date *date)
+{
+	if (!chinese_table_from_fixed(rd, date))
+		chinese_from_fixed_astro(rd, date);
+}
+
+/*
+ * Calculate the fixed date corresponding to the given Chinese date $date
+ * (cycle, year, month, leap, day).
+ */
+int
+fixed_from_chinese(const struct chinese_date *date)
+{
+	int rd;
+
+	if (chinese_table_to_fixed(date, &rd))
+		return rd;
+	return fixed_from_chinese_astro(date);
+}
+
+/*
+ * Pack the information of the Chinese year starting in Gregorian year
+ * $year for the table.
+ */
+static uint32_t
+chinese_table_pack(int year)
+{
+	struct chinese_date date;
+	int newyear = chinese_new_year_astro(year);
+	int next = chinese_new_year_astro(year + 1);
+	int m_next;
+	uint32_t info;
+
+	info = (uint32_t)(newyear - gregorian_new_year(year)) << 17;
+	for (int i = 0, m = newyear; m < next; i++, m = m_next) {
+		m_next = chinese_new_moon_onafter(m + 1);
+		if (m_next - m == 30)
+			info |= UINT32_C(1) << i;
+		chinese_from_fixed_astro(m, &date);
+		if (date.leap)
+			info |= (uint32_t)date.month << 13;
+	}
+
+	return info;
+}
+
+/*
+ * Regenerate the table with the astronomical calculations and check it
+ * against the built-in one, as well as the conversions of every date in
+ * the table.  Print the regenerated table to stdout if $print is true.
+ * Return the number of mismatches.
+ */
+int
+chinese_check_table(bool print)
+{
+	struct chinese_date date, date2;
+	uint32_t info;
+	int rd, rd_end;
+	int errors = 0;
+
+	for (int i = 0; i <= CHINESE_TABLE_LAST - CHINESE_TABLE_FIRST; i++) {
+		info = chinese_table_pack(CHINESE_TABLE_FIRST + i);
+		if (print) {
+			printf("%s0x%06" PRIx32 ",", (i % 6 == 0) ? "\t" : " ",
+			       info);
+			if (i % 6 == 5)
+				printf("\n");
+		}
+		if (i >= (int)nitems(chinese_years) ||
+		    info != chinese_years[i]) {
+			warnx("%s: year %d: mismatch 0x%06" PRIx32,
+			      __func__, CHINESE_TABLE_FIRST + i, info);
+			errors++;
+		}
+	}
+	if (print)
+		printf("\n");
+
+	rd = chinese_table_newyear(0);
+	rd_end = chinese_new_year_astro(CHINESE_TABLE_LAST + 1);
+	for (; rd < rd_end; rd++) {
+		chinese_from_fixed(rd, &date);
+		chinese_from_fixed_astro(rd, &date2);
+		if (date.cycle != date2.cycle || date.year != date2.year ||
+		    date.month != date2.month || date.leap != date2.leap ||
+		    date.day != date2.day ||
+		    fixed_from_chinese(&date) != rd) {
+			warnx("%s: mismatch on R.D. %d", __func__, rd);
+			errors++;
+		}
+	}
+
+	return errors;
+}
+
 /*
  * Calculate the fixed date of Qīngmíng (清明) in Gregorian year $g_year.
  * Ref: Sec.(19.6), Eq.(19.28)
@@ -315,11 +662,11 @@ fixed_from_chinese(const struct chinese_date *date)
 int
 chinese_qingming(int g_year)
 {
-	double lambda = 15.0;  /* Solar longitude of Qīngmíng */
+	int lambda = 15;  /* Solar longitude of Qīngmíng */
 	struct date date = { g_year, 4, 1 }; /* Qīngmíng is around April 5 */
 	int rd = fixed_from_gregorian(&date);
 	double zone = chinese_zone(rd);
-	double t = solar_longitude_atafter(lambda, rd) + zone;
+	double t = solar_term(g_year, lambda) + zone;
 	return (int)floor(t);
 }
 
@@ -405,48 +752,26 @@ static const struct chinese_jieqi jieqis[] = {
 };
 
 /*
- * Calculate the fixed date (in China) of the following jiéqì on or after
- * the given fixed date $rd, with the calculated jiéqì information stored
- * in $jieqi.
- * If $type is C_JIEQI_ALL, find either major or minor jiéqì;
- * If $type is C_JIEQI_MAJOR, find only major jiéqì;
- * If $type is C_JIEQI_MINOR, find only minor jiéqì.
+ * Calculate the fixed date (in China) of the $n-th jiéqì (counting from 0)
+ * in Gregorian year $g_year, with the jiéqì information stored in $jieqi.
+ * The first jiéqì of a year is Xiǎohán (around January 5), and the last
+ * one is Dōngzhì (around December 22).
  */
 int
-chinese_jieqi_onafter(int rd, int type, const struct chinese_jieqi **jieqi)
+chinese_jieqi_nth(int g_year, int n, const struct chinese_jieqi **jieqi)
 {
-	const struct chinese_jieqi *jq1, *jq2;
-	const double zone = chinese_zone(rd);
-	double t_u = midnight_in_china(rd);
-	double lon = solar_longitude(t_u);
-	double lon1, lon2;
-	size_t n = nitems(jieqis);
-
-	for (size_t i = 0; i < n; i++) {
-		jq1 = &jieqis[i];
-		jq2 = &jieqis[(i+1) % n];
-		if ((type == C_JIEQI_MINOR && jq2->is_major) ||
-		    (type == C_JIEQI_MAJOR && !jq2->is_major)) {
-			jq2 = &jieqis[(i+2) % n];
-		}
+	const struct chinese_jieqi *jq;
+	double t_u;
 
-		lon1 = jq1->longitude;
-		lon2 = jq2->longitude;
-		if (lon2 < lon1)
-			lon2 += 360;
+	assert(n >= 0 && n < C_JIEQI_COUNT);
+	/* Xiǎohán is the 23rd in the table starting with Lìchūn */
+	jq = &jieqis[(n + 22) % C_JIEQI_COUNT];
+	t_u = solar_term(g_year, jq->longitude);
 
-		if ((lon >= lon1 && lon < lon2) ||
-		    (lon + 360 >= lon1 && lon + 360 < lon2)) {
-			break;
-		}
-	}
-
-	t_u = solar_longitude_atafter(jq2->longitude, floor(t_u));
-	*jieqi = jq2;
-	return (int)floor(t_u + zone);
+	*jieqi = jq;
+	return (int)floor(t_u + chinese_zone((int)floor(t_u)));
 }
 
-
 /*
  * Format the Chinese date of the given fixed date $rd in $buf.
  * Return the formatted string length.
@@ -468,34 +793,30 @@ chinese_format_date(char *buf, size_t size, int rd)
  * (NOTE: The year $year is ignored.)
  */
 int
-chinese_find_days_ymd(int year __unused, int month, int day,
-		      struct cal_day **dayp, char **edp __unused)
+chinese_find_days_ymd(struct cal_context *ctx, int year __unused, int month,
+		      int day, struct cal_matches *matches)
 {
 	struct cal_day *dp;
 	struct chinese_date cdate;
 	int rd, rd_begin, rd_end;
 	int count = 0;
 
-	rd_begin = chinese_new_moon_before(Options.day_begin);
-	rd_end = chinese_new_moon_onafter(Options.day_end);
+	rd_begin = chinese_month_start_before(ctx->options.day_begin);
+	rd_end = chinese_month_start_onafter(ctx->options.day_end);
 	rd = rd_begin;
 	while (rd <= rd_end) {
 		chinese_from_fixed(rd, &cdate);
 		if (cdate.month == month || month < 0) {
 			cdate.day = day;
 			rd = fixed_from_chinese(&cdate);
-			if ((dp = find_rd(rd, 0)) != NULL) {
-				if (count >= CAL_MAX_REPEAT) {
-					warnx("%s: too many repeats",
-					      __func__);
-					return count;
-				}
-				dayp[count++] = dp;
+			if ((dp = find_rd(ctx, rd, 0)) != NULL) {
+				matches_add(matches, dp, NULL);
+				count++;
 			}
 		}
 
 		/* go to next month */
-		rd = chinese_new_moon_onafter(rd + (day == 0 ? 2 : 1));
+		rd = chinese_month_start_onafter(rd + (day == 0 ? 2 : 1));
 	}
 
 	return count;
@@ -505,9 +826,10 @@ chinese_find_days_ymd(int year __unused, int month, int day,
  * Find days of the specified Chinese day of month ($dom) of all months.
  */
 int
-chinese_find_days_dom(int dom, struct cal_day **dayp, char **edp __unused)
+chinese_find_days_dom(struct cal_context *ctx, int dom,
+		      struct cal_matches *matches)
 {
-	return chinese_find_days_ymd(-1, -1, dom, dayp, NULL);
+	return chinese_find_days_ymd(ctx, -1, -1, dom, matches);
 }
 
 
@@ -548,7 +870,7 @@ show_chinese_calendar(int rd)
 	const struct chinese_jieqi *jq;
 	double t_jq;
 	char buf_time[32], buf_zone[32];
-	int lambda;
+	int lambda, year;
 
 	/* 1st solar term (Lìchūn) is generally around February 4 */
 	date_set(&gdate, g_year, 2, 1);
@@ -556,11 +878,17 @@ show_chinese_calendar(int rd)
 
 	format_zone(buf_zone, sizeof(buf_zone), zone);
 
+	/*
+	 * From the 1st solar term (Lìchūn) to the last (Dàhán), which is in
+	 * January of the next year.  Each term is searched from the day of
+	 * the previous one.
+	 */
 	printf("\n二十四节气 (solar terms):\n");
 	for (size_t i = 0; i < nitems(jieqis); i++) {
 		jq = &jieqis[i];
 		lambda = jq->longitude;
-		t_jq = solar_longitude_atafter(lambda, floor(t_jq)) + zone;
+		year = (lambda == 285 || lambda == 300) ? g_year + 1 : g_year;
+		t_jq = solar_term_atafter(year, lambda, floor(t_jq)) + zone;
 		gregorian_from_fixed(floor(t_jq), &gdate);
 		format_time(buf_time, sizeof(buf_time), t_jq);
 
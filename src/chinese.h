@@ -54,22 +54,26 @@ struct chinese_jieqi {
 	int		longitude;  /* longitude of Sun */
 };
 
-enum { C_JIEQI_ALL, C_JIEQI_MAJOR, C_JIEQI_MINOR };
+#define C_JIEQI_COUNT	24
 
-struct cal_day;
+struct cal_context;
+struct cal_matches;
 
 int	chinese_new_year(int year);
+int	chinese_check_table(bool print);
 
 void	chinese_from_fixed(int rd, struct chinese_date *date);
 int	fixed_from_chinese(const struct chinese_date *date);
 
 int	chinese_qingming(int g_year);
-int	chinese_jieqi_onafter(int rd, int type, const struct chinese_jieqi **jieqi);
+int	chinese_jieqi_nth(int g_year, int n,
+			  const struct chinese_jieqi **jieqi);
 
 int	chinese_format_date(char *buf, size_t size, int rd);
-int	chinese_find_days_ymd(int year, int month, int day, struct cal_day **dayp,
-			      char **edp);
-int	chinese_find_days_dom(int dom, struct cal_day **dayp, char **edp);
+int	chinese_find_days_ymd(struct cal_context *ctx, int year, int month,
+			      int day, struct cal_matches *matches);
+int	chinese_find_days_dom(struct cal_context *ctx, int dom,
+			      struct cal_matches *matches);
 void	show_chinese_calendar(int rd);
 
 #endif
@@ -0,0 +1,484 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2020 The DragonFly Project.  All rights reserved.
+ *
+ * This code is derived from software contributed to The DragonFly Project
+ * by Aaron LI <aly@aaronly.me>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of The DragonFly Project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific, prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Calendar contexts of libcalendar (see libcalendar.h).
+ *
+ * All the states of a run are kept in the context (see context.h), which
+ * is passed to the modules explicitly, so the contexts are independent
+ * and can be used on different threads at the same time.  The calls on
+ * one context are serialized by its lock.  The process-wide states are
+ * either read-only once set up (e.g., the national names of a locale),
+ * or memos keyed by their inputs and protected by their own locks (e.g.,
+ * the new moons and solar terms), which are shared by all the contexts.
+ *
+ * A fatal error (e.g., out of memory) in a call fails the call instead of
+ * exiting the process: the context is then reset to have no events, with
+ * the date range and preloaded files kept, but the memory allocated by
+ * the interrupted call may be leaked.
+ */
+
+#include <limits.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "calendar.h"
+#include "basics.h"
+#include "chinese.h"
+#include "context.h"
+#include "dates.h"
+#include "days.h"
+#include "io.h"
+#include "julian.h"
+#include "libcalendar.h"
+#include "nnames.h"
+#include "utils.h"
+
+
+/* debug log level of the process */
+int cal_debug = 0;
+
+/* paths to search for calendar files for inclusion */
+const char *calendarDirs[] = {
+	".",  /* i.e., '~/.calendar' */
+	CALENDAR_ETCDIR,
+	CALENDAR_DIR,
+	NULL,
+};
+
+/* all supported calendars */
+static struct calendar calendars[] = {
+	{  /* the default */
+		.id = CAL_GREGORIAN,
+		.name = "Gregorian",
+		.format_date = NULL,
+		.find_days_ymd = find_days_ymd,
+		.find_days_dom = find_days_dom,
+		.find_days_month = find_days_month,
+		.find_days_mdow = find_days_mdow,
+	},
+	{
+		.id = CAL_JULIAN,
+		.name = "Julian",
+		.format_date = julian_format_date,
+		.find_days_ymd = julian_find_days_ymd,
+		.find_days_dom = julian_find_days_dom,
+		.find_days_month = julian_find_days_month,
+		.find_days_mdow = NULL,
+	},
+	{
+		.id = CAL_CHINESE,
+		.name = "Chinese",
+		.format_date = chinese_format_date,
+		.find_days_ymd = chinese_find_days_ymd,
+		.find_days_dom = chinese_find_days_dom,
+		.find_days_month = NULL,
+		.find_days_mdow = NULL,
+	},
+};
+
+static void	context_lock(struct cal_context *ctx, struct fatal_jmp *fj);
+static void	context_unlock(struct cal_context *ctx, struct fatal_jmp *fj);
+static void	context_fail(struct cal_context *ctx);
+
+
+/*
+ * Set the calendar of context $ctx to the one named $name, or the default
+ * one if $name is NULL.
+ */
+bool
+set_calendar(struct cal_context *ctx, const char *name)
+{
+	struct calendar *cal;
+
+	if (name == NULL) {
+		ctx->calendar = &calendars[0];
+		return true;
+	}
+
+	for (size_t i = 0; i < nitems(calendars); i++) {
+		cal = &calendars[i];
+		if (strcasecmp(name, cal->name) == 0) {
+			ctx->calendar = cal;
+			return true;
+		}
+	}
+
+	warnx("%s: unknown calendar: |%s|", __func__, name);
+	return false;
+}
+
+/*
+ * Set the debug log level of the library to $level, which is process-wide
+ * as the logs are written to the standard error.
+ */
+void
+cal_set_debug(int level)
+{
+	cal_debug = level;
+}
+
+/*
+ * Create a calendar context, with the time of noon at the location of
+ * latitude and longitude 0 in UTC.  The date range must be set before
+ * loading calendar files.  Return NULL on failure.
+ */
+struct cal_context *
+cal_context_new(void)
+{
+	struct cal_context *ctx;
+	struct fatal_jmp fj;
+
+	fatal_push(&fj);
+	if (setjmp(fj.env) != 0)
+		return NULL;
+	ctx = xcalloc(1, sizeof(*ctx));
+	fatal_pop(&fj);
+
+	pthread_mutex_init(&ctx->lock, NULL);
+	ctx->options.time = 0.5;  /* noon */
+	ctx->options.nthreads = 1;
+	ctx->options.include_fd = -1;
+	ctx->options.location = &ctx->location;
+	ctx->calendar = &calendars[0];
+
+	return ctx;
+}
+
+void
+cal_context_free(struct cal_context *ctx)
+{
+	struct fatal_jmp fj;
+
+	if (ctx == NULL)
+		return;
+
+	context_lock(ctx, &fj);
+	if (setjmp(fj.env) != 0) {
+		context_fail(ctx);
+	} else {
+		cal_clear(ctx);
+		context_unlock(ctx, &fj);
+	}
+
+	cal_preload_freeall(ctx);
+	free_dates(ctx);
+	nnames_free(&ctx->names);
+	free(ctx->io.jobs);
+	pthread_mutex_destroy(&ctx->lock);
+	free(ctx);
+}
+
+/*
+ * Set the number of threads $n to resolve the dates of the calendar
+ * entries while loading the files.  The events are the same as resolved
+ * by one thread, in the same order.
+ */
+void
+cal_context_set_threads(struct cal_context *ctx, int n)
+{
+	pthread_mutex_lock(&ctx->lock);
+	ctx->options.nthreads = (n > 0) ? n : 1;
+	pthread_mutex_unlock(&ctx->lock);
+}
+
+/*
+ * Set the directory $dir to cache the compiled calendar files (see
+ * cache.c), or NULL to disable the cache.  The string must remain valid
+ * while the context is in use.
+ */
+void
+cal_context_set_cache_dir(struct cal_context *ctx, const char *dir)
+{
+	pthread_mutex_lock(&ctx->lock);
+	ctx->options.cache_dir = dir;
+	pthread_mutex_unlock(&ctx->lock);
+}
+
+/*
+ * Look up the included files in directory $dir_fd instead of the current
+ * directory (before the system directories), and reject the included
+ * paths that are absolute or contain '..', e.g., for the calendar files
+ * of another user (see server.c).  Pass -1 to restore the default.  The
+ * descriptor must remain open while loading the calendar files.
+ */
+void
+cal_context_set_include_dir(struct cal_context *ctx, int dir_fd)
+{
+	pthread_mutex_lock(&ctx->lock);
+	ctx->options.include_fd = dir_fd;
+	pthread_mutex_unlock(&ctx->lock);
+}
+
+/*
+ * Set the location for the Sun and Moon calculations, with the $zone
+ * (in fraction of days) as the offset of the standard time from UTC.
+ */
+void
+cal_context_set_location(struct cal_context *ctx, double latitude,
+			 double longitude, double elevation, double zone)
+{
+	pthread_mutex_lock(&ctx->lock);
+	ctx->location.latitude = latitude;
+	ctx->location.longitude = longitude;
+	ctx->location.elevation = elevation;
+	ctx->location.zone = zone;
+	pthread_mutex_unlock(&ctx->lock);
+}
+
+/*
+ * Set the time of now, in [0, 1) fraction of the day.
+ */
+void
+cal_context_set_time(struct cal_context *ctx, double time)
+{
+	pthread_mutex_lock(&ctx->lock);
+	ctx->options.time = time;
+	pthread_mutex_unlock(&ctx->lock);
+}
+
+/*
+ * Set today and the date range [$day_begin, $day_end] (in R.D.) to find
+ * the events in.  The loaded events and the preloaded files are released,
+ * since they are bound to the dates of the previous range.  Return false
+ * if the dates are out of the limits (see libcalendar.h).
+ */
+bool
+cal_context_set_range(struct cal_context *ctx, int today, int day_begin,
+		      int day_end)
+{
+	struct fatal_jmp fj;
+
+	if (today < CAL_DATE_MIN || today > CAL_DATE_MAX ||
+	    day_begin < CAL_DATE_MIN - CAL_DAYS_MAX ||
+	    day_end > CAL_DATE_MAX + CAL_DAYS_MAX ||
+	    day_begin > day_end)
+		return false;
+
+	context_lock(ctx, &fj);
+	if (setjmp(fj.env) != 0) {
+		/* The dates may be partially generated */
+		free_dates(ctx);
+		ctx->options.day_begin = 0;
+		ctx->options.day_end = -1;
+		ctx->ranged = false;
+		context_fail(ctx);
+		return false;
+	}
+
+	cal_clear(ctx);
+	cal_preload_freeall(ctx);
+	free_dates(ctx);
+	ctx->ranged = false;
+	ctx->options.today = today;
+	ctx->options.day_begin = day_begin;
+	ctx->options.day_end = day_end;
+	generate_dates(ctx);
+	ctx->ranged = true;
+
+	context_unlock(ctx, &fj);
+	return true;
+}
+
+/*
+ * Parse and resolve the calendar file $path in advance, so that it's
+ * replayed instead of parsed again when it's included by the calendar
+ * files loaded later.
+ */
+bool
+cal_context_preload(struct cal_context *ctx, const char *path)
+{
+	struct fatal_jmp fj;
+	bool ok;
+
+	context_lock(ctx, &fj);
+	if (setjmp(fj.env) != 0) {
+		context_fail(ctx);
+		return false;
+	}
+	ok = ctx->ranged && cal_preload(ctx, path);
+	context_unlock(ctx, &fj);
+
+	return ok;
+}
+
+/*
+ * Parse the calendar file $fp (and its included files), and add its events
+ * to the context.  The files are looked up relative to the current
+ * directory, then in the system calendar directories.
+ */
+bool
+cal_context_load(struct cal_context *ctx, FILE *fp)
+{
+	struct fatal_jmp fj;
+	bool ok;
+
+	context_lock(ctx, &fj);
+	if (setjmp(fj.env) != 0) {
+		context_fail(ctx);
+		return false;
+	}
+	ok = ctx->ranged && cal_load(ctx, fp);
+	context_unlock(ctx, &fj);
+
+	return ok;
+}
+
+/*
+ * Release the loaded events and the definitions of the calendar files,
+ * but keep the preloaded files.
+ */
+void
+cal_context_clear(struct cal_context *ctx)
+{
+	struct fatal_jmp fj;
+
+	context_lock(ctx, &fj);
+	if (setjmp(fj.env) != 0) {
+		context_fail(ctx);
+		return;
+	}
+	cal_clear(ctx);
+	context_unlock(ctx, &fj);
+}
+
+/*
+ * Call $func with every loaded event in the order of date, until it
+ * returns nonzero, which is then returned.  The strings of the event are
+ * only valid during the call, and $func must not call into the library
+ * with the same context.  Return -1 on failure.
+ */
+int
+cal_context_foreach_event(struct cal_context *ctx,
+		int (*func)(const struct cal_event_info *ev, void *arg),
+		void *arg)
+{
+	struct fatal_jmp fj;
+	volatile int ret = 0;  /* modified after setjmp() */
+
+	context_lock(ctx, &fj);
+	if (setjmp(fj.env) != 0) {
+		context_fail(ctx);
+		return -1;
+	}
+	if (ctx->ranged)
+		ret = event_foreach(ctx, func, arg);
+	context_unlock(ctx, &fj);
+
+	return ret;
+}
+
+/*
+ * Format the loaded events as calendar(1) prints them, and return the
+ * allocated string with its length stored in $len (if not NULL), or
+ * NULL on failure.
+ */
+char *
+cal_context_format(struct cal_context *ctx, size_t *len)
+{
+	/* The days are clipped to the date range */
+	return cal_context_format_range(ctx, INT_MIN, INT_MAX, len);
+}
+
+/*
+ * Same as cal_context_format() but only for the loaded events of the days
+ * in [$day_begin, $day_end] (in R.D.), e.g., to answer several queries
+ * within the date range with the calendar files loaded only once.
+ */
+char *
+cal_context_format_range(struct cal_context *ctx, int day_begin,
+			 int day_end, size_t *len)
+{
+	struct strbuf out = { 0 };
+	struct fatal_jmp fj;
+
+	context_lock(ctx, &fj);
+	if (setjmp(fj.env) != 0) {
+		context_fail(ctx);
+		return NULL;
+	}
+	if (ctx->ranged)
+		event_format_range(ctx, &out, day_begin, day_end);
+	if (out.data == NULL)
+		strbuf_puts(&out, "");
+	context_unlock(ctx, &fj);
+
+	if (len != NULL)
+		*len = out.len;
+	return out.data;
+}
+
+
+/*
+ * Lock the context $ctx, and set the recovery point $fj of the fatal
+ * errors, which the caller must then arm by setjmp(3) and handle by
+ * context_fail().
+ */
+static void
+context_lock(struct cal_context *ctx, struct fatal_jmp *fj)
+{
+	pthread_mutex_lock(&ctx->lock);
+	fatal_push(fj);
+}
+
+static void
+context_unlock(struct cal_context *ctx, struct fatal_jmp *fj)
+{
+	fatal_pop(fj);
+	pthread_mutex_unlock(&ctx->lock);
+}
+
+/*
+ * Reset the context $ctx after a fatal error interrupted the call, whose
+ * recovery point has been removed, and unlock it.
+ */
+static void
+context_fail(struct cal_context *ctx)
+{
+	struct fatal_jmp fj;
+
+	fatal_push(&fj);
+	if (setjmp(fj.env) == 0) {
+		cal_reset(ctx);
+		fatal_pop(&fj);
+	}
+	/* else: failed again; the context is left with the partial states */
+	pthread_mutex_unlock(&ctx->lock);
+}
@@ -36,41 +36,67 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 #include "calendar.h"
 #include "basics.h"
+#include "context.h"
 #include "dates.h"
 #include "gregorian.h"
 #include "io.h"
+#include "libcalendar.h"
+#include "nnames.h"
 #include "utils.h"
 
 
-struct event {
-	bool		 variable;  /* Whether a variable event ? */
+/*
+ * Formatted dates of a day, shared by all the events of the day that are
+ * added with the same locale, calendar and date order.
+ */
+struct day_format {
+	struct calendar	*calendar;
+	bool		 day_first;
 	char		 date[32];  /* Date in Gregorian calendar */
 	char		 date_user[64];  /* Date in user-chosen calendar */
+};
+
+struct event {
+	bool		 variable;  /* Whether a variable event ? */
+	const struct day_format *format;  /* Formatted dates */
 	struct cal_desc *description;  /* Event description */
 	char		*extra;  /* Extra data of the event */
 	struct event	*next;
 };
 
-static struct cal_day *cal_days = NULL;
+static void	add_month(struct cal_dates *dates, int year, int month,
+			  int rd_first, int rd_last);
+static const struct day_format *day_format(struct cal_context *ctx,
+					   struct cal_day *dp,
+					   bool day_first);
 
 
 void
-generate_dates(void)
+generate_dates(struct cal_context *ctx)
 {
+	struct cal_dates *dates = &ctx->dates;
 	struct cal_day *dp;
 	struct date date;
 	int daycount, dow, year, month, day;
 	int rd_month1, rd_nextmonth, rd_nextyear;
 
-	daycount = Options.day_end - Options.day_begin + 1;
-	cal_days = xcalloc((size_t)daycount, sizeof(struct cal_day));
-
-	dow = dayofweek_from_fixed(Options.day_begin);
-	gregorian_from_fixed(Options.day_begin, &date);
+	/* the range is bounded by cal_context_set_range(), so no overflow */
+	daycount = ctx->options.day_end - ctx->options.day_begin + 1;
+	dates->days = xcalloc((size_t)daycount, sizeof(struct cal_day));
+	/* a partial month at each end plus one month per 28 days */
+	dates->months = xcalloc((size_t)(daycount / 28 + 2),
+				sizeof(struct cal_month));
+	dates->month_count = 0;
+	memset(dates->month_heads, 0, sizeof(dates->month_heads));
+	dates->format_generation++;
+
+	dow = dayofweek_from_fixed(ctx->options.day_begin);
+	gregorian_from_fixed(ctx->options.day_begin, &date);
 	year = date.year;
 	month = date.month;
 	day = date.day;
@@ -87,10 +113,11 @@ generate_dates(void)
 		date_set(&date, date.year+1, 1, 1);
 		rd_nextyear = fixed_from_gregorian(&date);
 	}
+	add_month(dates, year, month, rd_month1, rd_nextmonth - 1);
 
 	for (int i = 0; i < daycount; i++) {
-		dp = &cal_days[i];
-		dp->rd = Options.day_begin + i;
+		dp = &dates->days[i];
+		dp->rd = ctx->options.day_begin + i;
 
 		if (dp->rd == rd_nextmonth) {
 			month++;
@@ -112,6 +139,8 @@ generate_dates(void)
 				date_set(&date, date.year+1, 1, 1);
 				rd_nextyear = fixed_from_gregorian(&date);
 			}
+			add_month(dates, year, month, rd_month1,
+				  rd_nextmonth - 1);
 		}
 
 		dp->year = year;
@@ -128,75 +157,166 @@ generate_dates(void)
 	}
 }
 
-void
-free_dates(void)
+/*
+ * Append the month ($year, $month) spanning [$rd_first, $rd_last] to
+ * the month index of $dates.
+ */
+static void
+add_month(struct cal_dates *dates, int year, int month, int rd_first,
+	  int rd_last)
 {
-	struct event *e;
-	struct cal_day *dp = NULL;
+	struct cal_month *mp, *tail;
 
-	while ((dp = loop_dates(dp)) != NULL) {
-		while ((e = dp->events) != NULL) {
-			dp->events = e->next;
-			free(e->extra);
-			free(e);
-		}
+	mp = &dates->months[dates->month_count++];
+	mp->year = year;
+	mp->month = month;
+	mp->rd_first = rd_first;
+	mp->rd_last = rd_last;
+	mp->next = NULL;
+
+	if ((tail = dates->month_heads[month-1]) == NULL) {
+		dates->month_heads[month-1] = mp;
+	} else {
+		while (tail->next != NULL)
+			tail = tail->next;
+		tail->next = mp;
 	}
-	free(cal_days);
+
+	DPRINTF2("%s: %d-%02d, rd:[%d, %d]\n",
+		 __func__, year, month, rd_first, rd_last);
+}
+
+/*
+ * NOTE: The events are allocated from the arena and have been released
+ * by arena_freeall() in cal_clear().
+ */
+void
+free_dates(struct cal_context *ctx)
+{
+	struct cal_dates *dates = &ctx->dates;
+
+	free(dates->days);
+	free(dates->months);
+	dates->days = NULL;
+	dates->months = NULL;
+	dates->month_count = 0;
 }
 
 struct cal_day *
-loop_dates(struct cal_day *dp)
+loop_dates(struct cal_context *ctx, struct cal_day *dp)
 {
-	int daycount = Options.day_end - Options.day_begin + 1;
+	struct cal_day *days = ctx->dates.days;
+	int daycount = ctx->options.day_end - ctx->options.day_begin + 1;
 
+	if (days == NULL)
+		return NULL;
 	if (dp == NULL)
-		dp = &cal_days[0];
+		dp = &days[0];
 	else
 		dp++;
 
-	if (dp < &cal_days[0] || dp > &cal_days[daycount-1])
+	if (dp < &days[0] || dp > &days[daycount-1])
 		return NULL;
 	else
 		return dp;
 }
 
+/*
+ * Iterate the months in the date range with month number $month, or all
+ * the months if $month < 0, in ascending order of date.
+ */
+struct cal_month *
+loop_months(struct cal_context *ctx, int month, struct cal_month *mp)
+{
+	struct cal_dates *dates = &ctx->dates;
+
+	if (month < 0) {
+		if (mp == NULL)
+			mp = &dates->months[0];
+		else
+			mp++;
+		return (mp < &dates->months[dates->month_count]) ? mp : NULL;
+	}
+
+	if (month < 1 || month > 12)
+		return NULL;
+	if (mp == NULL)
+		return dates->month_heads[month-1];
+	else
+		return mp->next;
+}
+
 
 struct cal_day *
-find_rd(int rd, int offset)
+find_rd(struct cal_context *ctx, int rd, int offset)
 {
 	rd += offset;
-	if (rd < Options.day_begin || rd > Options.day_end)
+	if (rd < ctx->options.day_begin || rd > ctx->options.day_end)
 		return NULL;
 
-	return &cal_days[rd - Options.day_begin];
+	return &ctx->dates.days[rd - ctx->options.day_begin];
 }
 
+/*
+ * Append the day $dp with the extra data $extra (may be NULL) to the
+ * matches $mt, which takes over $extra.
+ */
+void
+matches_add(struct cal_matches *mt, struct cal_day *dp, char *extra)
+{
+	size_t n;
+
+	if (mt->count == mt->cap) {
+		mt->cap = (mt->cap > 0) ? mt->cap * 2 : 64;
+		n = (size_t)mt->cap;
+		mt->days = xrealloc(mt->days, n * sizeof(*mt->days));
+		mt->extra = xrealloc(mt->extra, n * sizeof(*mt->extra));
+	}
+	mt->days[mt->count] = dp;
+	mt->extra[mt->count] = extra;
+	mt->count++;
+}
+
+/*
+ * Clear the matches $mt but keep the storage, freeing the extra data that
+ * have not been taken over.
+ */
+void
+matches_reset(struct cal_matches *mt)
+{
+	for (int i = 0; i < mt->count; i++) {
+		free(mt->extra[i]);
+		mt->extra[i] = NULL;
+	}
+	mt->count = 0;
+}
+
+void
+matches_free(struct cal_matches *mt)
+{
+	matches_reset(mt);
+	free(mt->days);
+	free(mt->extra);
+	memset(mt, 0, sizeof(*mt));
+}
 
+
+/*
+ * Add an event of description $desc on day $dp.  The extra data $extra
+ * (may be NULL) is copied, and the event lives until arena_freeall().
+ */
 struct event *
-event_add(struct cal_day *dp, bool day_first, bool variable,
-	  struct cal_desc *desc, char *extra)
+event_add(struct cal_context *ctx, struct cal_day *dp, bool day_first,
+	  bool variable, struct cal_desc *desc, const char *extra)
 {
 	struct event *e;
-	struct date gdate;
-	struct tm tm = { 0 };
-
-	e = xcalloc(1, sizeof(*e));
-
-	gregorian_from_fixed(dp->rd, &gdate);
-	tm.tm_year = gdate.year - 1900;
-	tm.tm_mon = gdate.month - 1;
-	tm.tm_mday = gdate.day;
-	strftime(e->date, sizeof(e->date),
-		 (day_first ? "%e %b" : "%b %e"), &tm);
-	if (Calendar->format_date != NULL) {
-		(Calendar->format_date)(e->date_user, sizeof(e->date_user),
-					dp->rd);
-	}
 
+	e = arena_alloc(&ctx->arena, sizeof(*e));
+	e->format = day_format(ctx, dp, day_first);
 	e->variable = variable;
 	e->description = desc;
 	if (extra != NULL && extra[0] != '\0')
-		e->extra = extra;
+		e->extra = arena_strdup(&ctx->arena, extra);
 
 	e->next = dp->events;
 	dp->events = e;
@@ -204,32 +324,160 @@ event_add(struct cal_day *dp, bool day_first, bool variable,
 	return (e);
 }
 
+/*
+ * Get the formatted dates of day $dp, which are formatted only once and
+ * then shared by the events of the day, unless the locale, calendar or
+ * $day_first changes.
+ */
+static const struct day_format *
+day_format(struct cal_context *ctx, struct cal_day *dp, bool day_first)
+{
+	struct calendar *cal = ctx->calendar;
+	struct day_format *fmt;
+	struct tm tm = { 0 };
+
+	fmt = dp->format;
+	if (fmt != NULL && dp->format_gen == ctx->dates.format_generation &&
+	    fmt->calendar == cal && fmt->day_first == day_first)
+		return fmt;
+
+	fmt = arena_alloc(&ctx->arena, sizeof(*fmt));
+	fmt->calendar = cal;
+	fmt->day_first = day_first;
+	tm.tm_year = dp->year - 1900;
+	tm.tm_mon = dp->month - 1;
+	tm.tm_mday = dp->day;
+	strftime_l(fmt->date, sizeof(fmt->date),
+		   (day_first ? "%e %b" : "%b %e"), &tm,
+		   nlocale_locale(&ctx->names));
+	if (cal->format_date != NULL) {
+		(cal->format_date)(fmt->date_user, sizeof(fmt->date_user),
+				   dp->rd);
+	}
+
+	dp->format = fmt;
+	dp->format_gen = ctx->dates.format_generation;
+	return fmt;
+}
+
+/*
+ * Expire the formatted dates of all days, which must be called when the
+ * locale changes or the arena is released.
+ */
 void
-event_print_all(FILE *fp)
+expire_date_formats(struct cal_context *ctx)
+{
+	ctx->dates.format_generation++;
+}
+
+/*
+ * Detach the events from all days, which must be called when the arena
+ * holding the events is released but the dates are kept.
+ */
+void
+event_clear_all(struct cal_context *ctx)
 {
-	struct event *e;
 	struct cal_day *dp = NULL;
+
+	while ((dp = loop_dates(ctx, dp)) != NULL)
+		dp->events = NULL;
+	expire_date_formats(ctx);
+}
+
+/*
+ * Format all the events into the buffer $sb, which is then written out
+ * at once.
+ */
+void
+event_format_all(struct cal_context *ctx, struct strbuf *sb)
+{
+	event_format_range(ctx, sb, ctx->options.day_begin,
+			   ctx->options.day_end);
+}
+
+/*
+ * Format the events of the days in [$rd_begin, $rd_end], which is clipped
+ * to the date range, into the buffer $sb.
+ */
+void
+event_format_range(struct cal_context *ctx, struct strbuf *sb, int rd_begin,
+		   int rd_end)
+{
+	struct event *e;
+	struct cal_day *dp;
 	struct cal_desc *desc;
 	struct cal_line *line;
 
-	while ((dp = loop_dates(dp)) != NULL) {
+	if (rd_begin < ctx->options.day_begin)
+		rd_begin = ctx->options.day_begin;
+	if (rd_end > ctx->options.day_end)
+		rd_end = ctx->options.day_end;
+
+	for (int rd = rd_begin; rd <= rd_end; rd++) {
+		dp = &ctx->dates.days[rd - ctx->options.day_begin];
 		for (e = dp->events; e != NULL; e = e->next) {
-			fprintf(fp, "%s%c\t", e->date, e->variable ? '*' : ' ');
-//			if (e->date_user[0] != '\0')
-//				fprintf(fp, "[%s] ", e->date_user);
+			strbuf_puts(sb, e->format->date);
+			strbuf_putc(sb, e->variable ? '*' : ' ');
+			strbuf_putc(sb, '\t');
+//			if (e->format->date_user[0] != '\0')
+//				strbuf_printf(sb, "[%s] ",
+//					      e->format->date_user);
 
 			desc = e->description;
 			for (line = desc->firstline; line; line = line->next) {
-				fprintf(fp, "%s%s%s",
-					(line == desc->firstline) ? "" : "\t\t",
-					line->str,
-					(line == desc->lastline) ? "" : "\n");
+				if (line != desc->firstline)
+					strbuf_puts(sb, "\t\t");
+				strbuf_puts(sb, line->str);
+				if (line != desc->lastline)
+					strbuf_putc(sb, '\n');
 			}
 //			if (e->extra)
-//				fprintf(fp, " (%s)", e->extra);
+//				strbuf_printf(sb, " (%s)", e->extra);
 
-			fputc('\n', fp);
-			fflush(fp);
+			strbuf_putc(sb, '\n');
 		}
 	}
 }
+
+/*
+ * Call $func with every event in the order of date, until it returns
+ * nonzero, which is then returned.
+ */
+int
+event_foreach(struct cal_context *ctx,
+	      int (*func)(const struct cal_event_info *, void *), void *arg)
+{
+	struct cal_event_info info;
+	struct strbuf desc = { 0 };
+	struct cal_line *line;
+	struct cal_day *dp = NULL;
+	struct event *e;
+	int ret = 0;
+
+	while (ret == 0 && (dp = loop_dates(ctx, dp)) != NULL) {
+		for (e = dp->events; ret == 0 && e != NULL; e = e->next) {
+			desc.len = 0;
+			if (desc.data != NULL)
+				desc.data[0] = '\0';
+			for (line = e->description->firstline; line != NULL;
+			     line = line->next) {
+				if (line != e->description->firstline)
+					strbuf_putc(&desc, '\n');
+				strbuf_puts(&desc, line->str);
+			}
+
+			info.rd = dp->rd;
+			info.year = dp->year;
+			info.month = dp->month;
+			info.day = dp->day;
+			info.date = e->format->date;
+			info.variable = e->variable;
+			info.description = (desc.data != NULL) ? desc.data : "";
+			info.extra = e->extra;
+			ret = (func)(&info, arg);
+		}
+	}
+
+	strbuf_free(&desc);
+	return ret;
+}
@@ -37,7 +37,11 @@
 #include <stdio.h>
 
 struct event;
+struct cal_context;
+struct cal_event_info;
+struct day_format;
 struct cal_desc;
+struct strbuf;
 
 struct cal_day {
 	int	rd;
@@ -47,16 +51,70 @@ struct cal_day {
 	int	dow[3];  /* [day-of-week, index-in-month, reverse-index] */
 	bool	last_dom;  /* true if the last day of month */
 	struct event *events;
+	struct day_format *format;  /* formatted dates shared by events */
+	unsigned int format_gen;  /* generation of 'format' */
 };
 
-void	generate_dates(void);
-void	free_dates(void);
-struct cal_day *loop_dates(struct cal_day *dp);
+/*
+ * Index of the months covered (fully or partially) by the date range,
+ * to directly locate the days of a given month instead of scanning
+ * all the dates.
+ */
+struct cal_month {
+	int	year;
+	int	month;
+	int	rd_first;  /* R.D. of the first day of month */
+	int	rd_last;  /* R.D. of the last day of month */
+	struct cal_month *next;  /* next month of the same month number */
+};
+
+/*
+ * Dates in the date range of a calendar context (see context.h).
+ */
+struct cal_dates {
+	struct cal_day	 *days;
+	struct cal_month *months;
+	int		  month_count;
+	/* first month of each month number (1-12) in the date range */
+	struct cal_month *month_heads[12];
+	/* generation of the valid day formats */
+	unsigned int	  format_generation;
+};
+
+void	generate_dates(struct cal_context *ctx);
+void	free_dates(struct cal_context *ctx);
+struct cal_day *loop_dates(struct cal_context *ctx, struct cal_day *dp);
+struct cal_month *loop_months(struct cal_context *ctx, int month,
+			      struct cal_month *mp);
+
+struct cal_day *find_rd(struct cal_context *ctx, int rd, int offset);
+
+/*
+ * Days (and the optional extra data) matched by a calendar entry.  The
+ * buffer grows on demand and is reset for every entry, so that its
+ * storage is reused instead of allocated per entry.
+ */
+struct cal_matches {
+	struct cal_day **days;
+	char	**extra;  /* owned by the buffer until taken over */
+	int	  count;
+	int	  cap;
+};
 
-struct cal_day *find_rd(int rd, int offset);
+void	matches_add(struct cal_matches *mt, struct cal_day *dp, char *extra);
+void	matches_reset(struct cal_matches *mt);
+void	matches_free(struct cal_matches *mt);
 
-struct event *event_add(struct cal_day *dp, bool day_first, bool variable,
-			struct cal_desc *desc, char *extra);
-void	event_print_all(FILE *fp);
+struct event *event_add(struct cal_context *ctx, struct cal_day *dp,
+			bool day_first, bool variable, struct cal_desc *desc,
+			const char *extra);
+void	event_format_all(struct cal_context *ctx, struct strbuf *sb);
+void	event_format_range(struct cal_context *ctx, struct strbuf *sb,
+			   int rd_begin, int rd_end);
+int	event_foreach(struct cal_context *ctx,
+		      int (*func)(const struct cal_event_info *, void *),
+		      void *arg);
+void	expire_date_formats(struct cal_context *ctx);
+void	event_clear_all(struct cal_context *ctx);
 
 #endif
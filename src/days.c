@@ -37,11 +37,15 @@
 #include <assert.h>
 #include <err.h>
 #include <math.h>
+#include <pthread.h>
 #include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "calendar.h"
 #include "basics.h"
 #include "chinese.h"
+#include "context.h"
 #include "dates.h"
 #include "days.h"
 #include "ecclesiastical.h"
@@ -52,29 +56,66 @@
 #include "sun.h"
 #include "utils.h"
 
-static int	find_days_yearly(int sday_id, int offset,
-				 struct cal_day **dayp, char **edp);
-static int	find_days_moon(int sday_id, int offset,
-			       struct cal_day **dayp, char **edp);
-
-static int	find_days_easter(int, struct cal_day **, char **);
-static int	find_days_paskha(int, struct cal_day **, char **);
-static int	find_days_advent(int, struct cal_day **, char **);
-static int	find_days_cny(int, struct cal_day **, char **);
-static int	find_days_cqingming(int, struct cal_day **, char **);
-static int	find_days_cjieqi(int, struct cal_day **, char **);
-static int	find_days_marequinox(int, struct cal_day **, char **);
-static int	find_days_sepequinox(int, struct cal_day **, char **);
-static int	find_days_junsolstice(int, struct cal_day **, char **);
-static int	find_days_decsolstice(int, struct cal_day **, char **);
-static int	find_days_newmoon(int, struct cal_day **, char **);
-static int	find_days_fullmoon(int, struct cal_day **, char **);
+struct yearly_day;
+
+static int	find_days_yearly(struct cal_context *ctx, int sday_id,
+				 int offset, struct cal_matches *matches);
+static void	yearly_day(struct cal_context *ctx, int sday_id, int year,
+			   struct yearly_day *yd);
+static int	find_days_moon(struct cal_context *ctx, int sday_id,
+			       int offset, struct cal_matches *matches);
+
+static int	find_days_easter(struct cal_context *, int,
+				  struct cal_matches *);
+static int	find_days_paskha(struct cal_context *, int,
+				  struct cal_matches *);
+static int	find_days_advent(struct cal_context *, int,
+				  struct cal_matches *);
+static int	find_days_cny(struct cal_context *, int,
+				  struct cal_matches *);
+static int	find_days_cqingming(struct cal_context *, int,
+				  struct cal_matches *);
+static int	find_days_cjieqi(struct cal_context *, int,
+				  struct cal_matches *);
+static int	find_days_marequinox(struct cal_context *, int,
+				  struct cal_matches *);
+static int	find_days_sepequinox(struct cal_context *, int,
+				  struct cal_matches *);
+static int	find_days_junsolstice(struct cal_context *, int,
+				  struct cal_matches *);
+static int	find_days_decsolstice(struct cal_context *, int,
+				  struct cal_matches *);
+static int	find_days_newmoon(struct cal_context *, int,
+				  struct cal_matches *);
+static int	find_days_fullmoon(struct cal_context *, int,
+				  struct cal_matches *);
+
+/*
+ * Memo of the yearly special days, so that each special day is computed
+ * only once per year, no matter how many entries refer to it (e.g., the
+ * dozens of 'Easter-N' entries).  The memo is direct mapped by the special
+ * day and year, and a colliding slot is simply overwritten.  The memo is
+ * shared by the threads resolving the entries (see '-j'), so a day is
+ * copied out under the lock, but calculated without it.
+ */
+struct yearly_day {
+	int	sday_id;	/* SD_NONE if the slot is unused */
+	int	year;
+	int	calendar;	/* calendar of Advent; 0 otherwise */
+	double	zone;		/* timezone of the time; 0 if no time */
+	int	rd;
+	char	time[16];	/* formatted time; empty if none */
+};
+
+#define YEARLY_MEMO_SIZE	64	/* power of 2 */
+static struct yearly_day yearly_memo[YEARLY_MEMO_SIZE];
+static pthread_mutex_t yearly_lock = PTHREAD_MUTEX_INITIALIZER;
 
 #define SPECIALDAY_INIT0 \
-	{ SD_NONE, NULL, 0, NULL, 0, NULL }
+	{ SD_NONE, NULL, 0, NULL }
 #define SPECIALDAY_INIT(id, name, func) \
-	{ (id), name, sizeof(name)-1, NULL, 0, func }
-struct specialday specialdays[] = {
+	{ (id), name, sizeof(name)-1, func }
+const struct specialday specialdays[NSPECIALDAYS+1] = {
 	SPECIALDAY_INIT(SD_EASTER, "Easter", &find_days_easter),
 	SPECIALDAY_INIT(SD_PASKHA, "Paskha", &find_days_paskha),
 	SPECIALDAY_INIT(SD_ADVENT, "Advent", &find_days_advent),
@@ -92,177 +133,207 @@ struct specialday specialdays[] = {
 
 
 static int
-find_days_easter(int offset, struct cal_day **dayp, char **edp)
+find_days_easter(struct cal_context *ctx, int offset,
+		 struct cal_matches *matches)
 {
-	return find_days_yearly(SD_EASTER, offset, dayp, edp);
+	return find_days_yearly(ctx, SD_EASTER, offset, matches);
 }
 
 static int
-find_days_paskha(int offset, struct cal_day **dayp, char **edp)
+find_days_paskha(struct cal_context *ctx, int offset,
+		 struct cal_matches *matches)
 {
-	return find_days_yearly(SD_PASKHA, offset, dayp, edp);
+	return find_days_yearly(ctx, SD_PASKHA, offset, matches);
 }
 
 static int
-find_days_advent(int offset, struct cal_day **dayp, char **edp)
+find_days_advent(struct cal_context *ctx, int offset,
+		 struct cal_matches *matches)
 {
-	return find_days_yearly(SD_ADVENT, offset, dayp, edp);
+	return find_days_yearly(ctx, SD_ADVENT, offset, matches);
 }
 
 static int
-find_days_cny(int offset, struct cal_day **dayp, char **edp)
+find_days_cny(struct cal_context *ctx, int offset,
+		 struct cal_matches *matches)
 {
-	return find_days_yearly(SD_CNY, offset, dayp, edp);
+	return find_days_yearly(ctx, SD_CNY, offset, matches);
 }
 
 static int
-find_days_cqingming(int offset, struct cal_day **dayp, char **edp)
+find_days_cqingming(struct cal_context *ctx, int offset,
+		 struct cal_matches *matches)
 {
-	return find_days_yearly(SD_CQINGMING, offset, dayp, edp);
+	return find_days_yearly(ctx, SD_CQINGMING, offset, matches);
 }
 
 static int
-find_days_marequinox(int offset, struct cal_day **dayp, char **edp)
+find_days_marequinox(struct cal_context *ctx, int offset,
+		 struct cal_matches *matches)
 {
-	return find_days_yearly(SD_MAREQUINOX, offset, dayp, edp);
+	return find_days_yearly(ctx, SD_MAREQUINOX, offset, matches);
 }
 
 static int
-find_days_sepequinox(int offset, struct cal_day **dayp, char **edp)
+find_days_sepequinox(struct cal_context *ctx, int offset,
+		 struct cal_matches *matches)
 {
-	return find_days_yearly(SD_SEPEQUINOX, offset, dayp, edp);
+	return find_days_yearly(ctx, SD_SEPEQUINOX, offset, matches);
 }
 
 static int
-find_days_junsolstice(int offset, struct cal_day **dayp, char **edp)
+find_days_junsolstice(struct cal_context *ctx, int offset,
+		 struct cal_matches *matches)
 {
-	return find_days_yearly(SD_JUNSOLSTICE, offset, dayp, edp);
+	return find_days_yearly(ctx, SD_JUNSOLSTICE, offset, matches);
 }
 
 static int
-find_days_decsolstice(int offset, struct cal_day **dayp, char **edp)
+find_days_decsolstice(struct cal_context *ctx, int offset,
+		 struct cal_matches *matches)
 {
-	return find_days_yearly(SD_DECSOLSTICE, offset, dayp, edp);
+	return find_days_yearly(ctx, SD_DECSOLSTICE, offset, matches);
 }
 
 /*
  * Find days of the yearly special day specified by $sday_id.
  */
 static int
-find_days_yearly(int sday_id, int offset, struct cal_day **dayp, char **edp)
+find_days_yearly(struct cal_context *ctx, int sday_id, int offset,
+		 struct cal_matches *matches)
 {
+	struct yearly_day yd;
 	struct cal_day *dp;
-	struct date date;
-	double t, longitude;
-	char buf[32];
-	int rd, approx, month;
 	int year1, year2;
 	int count = 0;
 
-	year1 = gregorian_year_from_fixed(Options.day_begin);
-	year2 = gregorian_year_from_fixed(Options.day_end);
+	/* the years of the days to shift by $offset into the date range */
+	year1 = gregorian_year_from_fixed(ctx->options.day_begin - offset);
+	year2 = gregorian_year_from_fixed(ctx->options.day_end - offset);
 	for (int y = year1; y <= year2; y++) {
-		t = NAN;
-
-		switch (sday_id) {
-		case SD_EASTER:
-			rd = easter(y);
-			break;
-		case SD_PASKHA:
-			rd = orthodox_easter(y);
-			break;
-		case SD_ADVENT:
-			rd = advent(y);
-			break;
-		case SD_CNY:
-			rd = chinese_new_year(y);
-			break;
-		case SD_CQINGMING:
-			rd = chinese_qingming(y);
-			break;
-		case SD_MAREQUINOX:
-		case SD_JUNSOLSTICE:
-		case SD_SEPEQUINOX:
-		case SD_DECSOLSTICE:
-			if (sday_id == SD_MAREQUINOX) {
-				month = 3;
-				longitude = 0.0;
-			} else if (sday_id == SD_JUNSOLSTICE) {
-				month = 6;
-				longitude = 90.0;
-			} else if (sday_id == SD_SEPEQUINOX) {
-				month = 9;
-				longitude = 180.0;
-			} else {
-				month = 12;
-				longitude = 270.0;
-			}
-			date_set(&date, y, month, 1);
-			approx = fixed_from_gregorian(&date);
-			t = solar_longitude_atafter(longitude, approx);
-			t += Options.location->zone;  /* to standard time */
-			rd = floor(t);
-			break;
-		default:
-			errx(1, "%s: unknown special day: %d",
-			     __func__, sday_id);
-		}
-
-		if ((dp = find_rd(rd, offset)) != NULL) {
-			if (count >= CAL_MAX_REPEAT) {
-				warnx("%s: too many repeats", __func__);
-				return count;
-			}
-			if (!isnan(t)) {
-				format_time(buf, sizeof(buf), t);
-				edp[count] = xstrdup(buf);
-			}
-			dayp[count++] = dp;
+		yearly_day(ctx, sday_id, y, &yd);
+		if ((dp = find_rd(ctx, yd.rd, offset)) != NULL) {
+			matches_add(matches, dp, (yd.time[0] != '\0') ?
+				    xstrdup(yd.time) : NULL);
+			count++;
 		}
 	}
 
 	return count;
 }
 
+/*
+ * Calculate the yearly special day $sday_id of year $year into $yd, or
+ * get it from the memo.
+ */
+static void
+yearly_day(struct cal_context *ctx, int sday_id, int year,
+	   struct yearly_day *yd)
+{
+	struct yearly_day *slot;
+	double t, zone;
+	int calendar, longitude;
+
+	zone = 0.0;
+	calendar = 0;
+	switch (sday_id) {
+	case SD_ADVENT:
+		calendar = ctx->calendar->id;
+		break;
+	case SD_MAREQUINOX:
+	case SD_JUNSOLSTICE:
+	case SD_SEPEQUINOX:
+	case SD_DECSOLSTICE:
+		zone = ctx->options.location->zone;
+		break;
+	}
+
+	slot = &yearly_memo[((unsigned int)year * 16u +
+			     (unsigned int)sday_id) & (YEARLY_MEMO_SIZE - 1)];
+	pthread_mutex_lock(&yearly_lock);
+	if (slot->sday_id == sday_id && slot->year == year &&
+	    slot->calendar == calendar && slot->zone == zone) {
+		*yd = *slot;
+		pthread_mutex_unlock(&yearly_lock);
+		return;
+	}
+	pthread_mutex_unlock(&yearly_lock);
+
+	yd->sday_id = sday_id;
+	yd->year = year;
+	yd->calendar = calendar;
+	yd->zone = zone;
+	yd->time[0] = '\0';
+
+	switch (sday_id) {
+	case SD_EASTER:
+		yd->rd = easter(year);
+		break;
+	case SD_PASKHA:
+		yd->rd = orthodox_easter(year);
+		break;
+	case SD_ADVENT:
+		yd->rd = advent(year, (calendar == CAL_JULIAN));
+		break;
+	case SD_CNY:
+		yd->rd = chinese_new_year(year);
+		break;
+	case SD_CQINGMING:
+		yd->rd = chinese_qingming(year);
+		break;
+	case SD_MAREQUINOX:
+	case SD_JUNSOLSTICE:
+	case SD_SEPEQUINOX:
+	case SD_DECSOLSTICE:
+		if (sday_id == SD_MAREQUINOX)
+			longitude = 0;
+		else if (sday_id == SD_JUNSOLSTICE)
+			longitude = 90;
+		else if (sday_id == SD_SEPEQUINOX)
+			longitude = 180;
+		else
+			longitude = 270;
+		t = solar_term(year, longitude);
+		t += zone;  /* to standard time */
+		yd->rd = floor(t);
+		format_time(yd->time, sizeof(yd->time), t);
+		break;
+	default:
+		fatal("%s: unknown special day: %d", __func__, sday_id);
+	}
+
+	pthread_mutex_lock(&yearly_lock);
+	*slot = *yd;
+	pthread_mutex_unlock(&yearly_lock);
+}
+
 /*
  * Find days of the 24 Chinese Jiéqì (节气)
  */
 static int
-find_days_cjieqi(int offset, struct cal_day **dayp, char **edp)
+find_days_cjieqi(struct cal_context *ctx, int offset,
+		 struct cal_matches *matches)
 {
 	const struct chinese_jieqi *jq;
 	struct cal_day *dp;
-	struct date date;
 	char buf[32];
 	int year1, year2;
-	int rd, rd_begin, rd_end;
+	int rd;
 	int count = 0;
 
-	year1 = gregorian_year_from_fixed(Options.day_begin);
-	year2 = gregorian_year_from_fixed(Options.day_end);
+	year1 = gregorian_year_from_fixed(ctx->options.day_begin - offset);
+	year2 = gregorian_year_from_fixed(ctx->options.day_end - offset);
 	for (int y = year1; y <= year2; y++) {
-		date_set(&date, y, 1, 1);
-		rd_begin = fixed_from_gregorian(&date);
-		date.year++;
-		rd_end = fixed_from_gregorian(&date);
-		if (rd_end > Options.day_end)
-			rd_end = Options.day_end;
-
-		for (rd = rd_begin; rd <= rd_end; rd += 14) {
-			rd = chinese_jieqi_onafter(rd, C_JIEQI_ALL, &jq);
-			if (rd > rd_end)
+		for (int i = 0; i < C_JIEQI_COUNT; i++) {
+			rd = chinese_jieqi_nth(y, i, &jq);
+			if (rd + offset > ctx->options.day_end)
 				break;
 
-			if ((dp = find_rd(rd, offset)) != NULL) {
-				if (count >= CAL_MAX_REPEAT) {
-					warnx("%s: too many repeats",
-					      __func__);
-					return count;
-				}
+			if ((dp = find_rd(ctx, rd, offset)) != NULL) {
 				snprintf(buf, sizeof(buf), "%s, %s",
 					 jq->name, jq->zhname);
-				edp[count] = xstrdup(buf);
-				dayp[count++] = dp;
+				matches_add(matches, dp, xstrdup(buf));
+				count++;
 			}
 		}
 	}
@@ -271,71 +342,70 @@ find_days_cjieqi(int offset, struct cal_day **dayp, char **edp)
 }
 
 static int
-find_days_newmoon(int offset, struct cal_day **dayp, char **edp)
+find_days_newmoon(struct cal_context *ctx, int offset,
+		 struct cal_matches *matches)
 {
-	return find_days_moon(SD_NEWMOON, offset, dayp, edp);
+	return find_days_moon(ctx, SD_NEWMOON, offset, matches);
 }
 
 static int
-find_days_fullmoon(int offset, struct cal_day **dayp, char **edp)
+find_days_fullmoon(struct cal_context *ctx, int offset,
+		 struct cal_matches *matches)
 {
-	return find_days_moon(SD_FULLMOON, offset, dayp, edp);
+	return find_days_moon(ctx, SD_FULLMOON, offset, matches);
 }
 
 /*
  * Find days of the moon events specified by $sday_id.
  */
 static int
-find_days_moon(int sday_id, int offset, struct cal_day **dayp, char **edp)
+find_days_moon(struct cal_context *ctx, int sday_id, int offset,
+	       struct cal_matches *matches)
 {
+	const struct location *loc = ctx->options.location;
+	struct lunar_event *events;
 	struct cal_day *dp;
 	struct date date;
-	double t, t_begin, t_end;
+	double t_std, t_begin, t_end;
 	char buf[32];
-	int year1, year2;
+	size_t nevents;
+	int phase;
 	int count = 0;
 
-	year1 = gregorian_year_from_fixed(Options.day_begin);
-	year2 = gregorian_year_from_fixed(Options.day_end);
-	for (int y = year1; y <= year2; y++) {
-		date_set(&date, y, 1, 1);
-		t_begin = fixed_from_gregorian(&date) - Options.location->zone;
-		date.year++;
-		t_end = fixed_from_gregorian(&date) - Options.location->zone;
-		if (t_end > Options.day_end + 1 - Options.location->zone)
-			t_end = Options.day_end + 1 - Options.location->zone;
-				/* NOTE: '+1' to include the ending day */
-
-		for (t = t_begin; t <= t_end; ) {
-			switch (sday_id) {
-			case SD_NEWMOON:
-				t = new_moon_atafter(t);
-				break;
-			case SD_FULLMOON:
-				t = lunar_phase_atafter(180, t);
-				break;
-			default:
-				errx(1, "%s: unknown moon event: %d",
-				     __func__, sday_id);
-			}
+	switch (sday_id) {
+	case SD_NEWMOON:
+		phase = LUNAR_NEW_MOON;
+		break;
+	case SD_FULLMOON:
+		phase = LUNAR_FULL_MOON;
+		break;
+	default:
+		fatal("%s: unknown moon event: %d", __func__, sday_id);
+	}
 
-			if (t > t_end)
-				break;
+	date_set(&date,
+		 gregorian_year_from_fixed(ctx->options.day_begin - offset),
+		 1, 1);
+	t_begin = fixed_from_gregorian(&date) - loc->zone;
+	t_end = ctx->options.day_end - offset + 1 - loc->zone;
+		/* NOTE: '+1' to include the ending day */
+
+	nevents = lunar_events(t_begin, t_end, LUNAR_PHASE_BIT(phase),
+			       &events);
+	for (size_t i = 0; i < nevents; i++) {
+		if (events[i].phase != phase)
+			continue;
 
-			t += Options.location->zone;  /* to standard time */
-			if ((dp = find_rd(floor(t), offset)) != NULL) {
-				if (count >= CAL_MAX_REPEAT) {
-					warnx("%s: too many repeats",
-					      __func__);
-					return count;
-				}
-				format_time(buf, sizeof(buf), t);
-				edp[count] = xstrdup(buf);
-				dayp[count++] = dp;
-			}
+		/* to standard time */
+		t_std = events[i].t + loc->zone;
+		if ((dp = find_rd(ctx, floor(t_std), offset)) != NULL) {
+			format_time(buf, sizeof(buf), t_std);
+			matches_add(matches, dp, xstrdup(buf));
+			count++;
 		}
 	}
 
+	free(events);
 	return count;
 }
 
@@ -346,23 +416,28 @@ find_days_moon(int sday_id, int offset, struct cal_day **dayp, char **edp)
  * If year $year < 0, then year is ignored.
  */
 int
-find_days_ymd(int year, int month, int day,
-	      struct cal_day **dayp, char **edp __unused)
+find_days_ymd(struct cal_context *ctx, int year, int month, int day,
+	      struct cal_matches *matches)
 {
-	struct cal_day *dp = NULL;
-	int count = 0;
+	struct cal_month *mp = NULL;
+	struct cal_day *dp;
+	int rd, count = 0;
 
-	while ((dp = loop_dates(dp)) != NULL) {
-		if (year >= 0 && year != dp->year)
+	if (month < 1 || month > 12)
+		return 0;
+	/* day of zero means the last day of previous month */
+	if (day == 0)
+		month = mod1(month - 1, 12);
+
+	while ((mp = loop_months(ctx, month, mp)) != NULL) {
+		if (year >= 0 && year != mp->year)
 			continue;
-		if ((dp->month == month && dp->day == day) ||
-		    /* day of zero means the last day of previous month */
-		    (day == 0 && dp->last_dom && month == dp->month % 12 + 1)) {
-			if (count >= CAL_MAX_REPEAT) {
-				warnx("%s: too many repeats", __func__);
-				return count;
-			}
-			dayp[count++] = dp;
+		rd = (day == 0) ? mp->rd_last : mp->rd_first + day - 1;
+		if (rd > mp->rd_last)
+			continue;
+		if ((dp = find_rd(ctx, rd, 0)) != NULL) {
+			matches_add(matches, dp, NULL);
+			count++;
 		}
 	}
 
@@ -373,20 +448,20 @@ find_days_ymd(int year, int month, int day,
  * Find days of the specified day of month ($dom) of all months.
  */
 int
-find_days_dom(int dom, struct cal_day **dayp, char **edp __unused)
+find_days_dom(struct cal_context *ctx, int dom, struct cal_matches *matches)
 {
-	struct cal_day *dp = NULL;
-	int count = 0;
+	struct cal_month *mp = NULL;
+	struct cal_day *dp;
+	int rd, count = 0;
 
-	while ((dp = loop_dates(dp)) != NULL) {
-		if (dp->day == dom ||
-		    /* day of zero means the last day of previous month */
-		    (dom == 0 && dp->last_dom)) {
-			if (count >= CAL_MAX_REPEAT) {
-				warnx("%s: too many repeats", __func__);
-				return count;
-			}
-			dayp[count++] = dp;
+	while ((mp = loop_months(ctx, -1, mp)) != NULL) {
+		/* day of zero means the last day of previous month */
+		rd = (dom == 0) ? mp->rd_last : mp->rd_first + dom - 1;
+		if (rd > mp->rd_last)
+			continue;
+		if ((dp = find_rd(ctx, rd, 0)) != NULL) {
+			matches_add(matches, dp, NULL);
+			count++;
 		}
 	}
 
@@ -397,18 +472,19 @@ find_days_dom(int dom, struct cal_day **dayp, char **edp __unused)
  * Find days of all days of the specified month ($month).
  */
 int
-find_days_month(int month, struct cal_day **dayp, char **edp __unused)
+find_days_month(struct cal_context *ctx, int month,
+		struct cal_matches *matches)
 {
-	struct cal_day *dp = NULL;
+	struct cal_month *mp = NULL;
+	struct cal_day *dp;
 	int count = 0;
 
-	while ((dp = loop_dates(dp)) != NULL) {
-		if (dp->month == month) {
-			if (count >= CAL_MAX_REPEAT) {
-				warnx("%s: too many repeats", __func__);
-				return count;
-			}
-			dayp[count++] = dp;
+	while ((mp = loop_months(ctx, month, mp)) != NULL) {
+		for (int rd = mp->rd_first; rd <= mp->rd_last; rd++) {
+			if ((dp = find_rd(ctx, rd, 0)) == NULL)
+				continue;
+			matches_add(matches, dp, NULL);
+			count++;
 		}
 	}
 
@@ -421,26 +497,25 @@ find_days_month(int month, struct cal_day **dayp, char **edp __unused)
  * If month $month < 0, then find days in every month.
  */
 int
-find_days_mdow(int month, int dow, int index,
-	       struct cal_day **dayp, char **edp __unused)
+find_days_mdow(struct cal_context *ctx, int month, int dow, int index,
+	       struct cal_matches *matches)
 {
-	struct cal_day *dp = NULL;
-	int count = 0;
+	struct cal_month *mp = NULL;
+	struct cal_day *dp;
+	int rd, count = 0;
 
-	while ((dp = loop_dates(dp)) != NULL) {
-		if (month >= 0 && month != dp->month)
-			continue;
-		if (dp->dow[0] == dow) {
+	while ((mp = loop_months(ctx, month, mp)) != NULL) {
+		rd = kday_onbefore(dow, mp->rd_first + 6);
+		for ( ; rd <= mp->rd_last; rd += 7) {
+			if ((dp = find_rd(ctx, rd, 0)) == NULL)
+				continue;
 			if (index != 0 &&
 			    (index != dp->dow[1] && index != dp->dow[2])) {
 				/* Not the indexed day-of-week of month */
 				continue;
 			}
-			if (count >= CAL_MAX_REPEAT) {
-				warnx("%s: too many repeats", __func__);
-				return count;
-			}
-			dayp[count++] = dp;
+			matches_add(matches, dp, NULL);
+			count++;
 		}
 	}
 
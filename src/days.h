@@ -54,26 +54,34 @@ enum {
 	SD_FULLMOON,
 };
 
-struct cal_day;
+#define NSPECIALDAYS	12
 
+struct cal_context;
+struct cal_matches;
+
+/*
+ * NOTE: The national names of the special days are defined by the
+ * calendar files, and are kept in the calendar context (see context.h).
+ */
 struct specialday {
 	int		 id;		/* enum ID of the special day */
 	const char	*name;		/* name of the special day */
 	size_t		 len;		/* length of the name */
-	char		*n_name;	/* national name of the special day */
-	size_t		 n_len;		/* length of the national name */
 
-	/* function to find days of the special day in [rd1, rd2] */
-	int	(*find_days)(int offset, struct cal_day **dayp, char **edp);
+	/* function to find days of the special day in the date range */
+	int	(*find_days)(struct cal_context *ctx, int offset,
+			     struct cal_matches *matches);
 };
 
-extern struct specialday specialdays[];
+extern const struct specialday specialdays[];
 
-int	find_days_ymd(int year, int month, int day,
-		      struct cal_day **dayp, char **edp);
-int	find_days_dom(int dom, struct cal_day **dayp, char **edp);
-int	find_days_month(int month, struct cal_day **dayp, char **edp);
-int	find_days_mdow(int month, int dow, int index,
-		       struct cal_day **dayp, char **edp);
+int	find_days_ymd(struct cal_context *ctx, int year, int month, int day,
+		      struct cal_matches *matches);
+int	find_days_dom(struct cal_context *ctx, int dom,
+		      struct cal_matches *matches);
+int	find_days_month(struct cal_context *ctx, int month,
+			struct cal_matches *matches);
+int	find_days_mdow(struct cal_context *ctx, int month, int dow, int index,
+		       struct cal_matches *matches);
 
 #endif
@@ -92,16 +92,16 @@ easter(int g_year)
 /*
  * Calculate the fixed date (RD) of Advent Sunday (the 4th Sunday
  * before Christmas, equivalent to the Sunday closest to November 30)
- * in Gregorian year $g_year.
+ * in Gregorian year $g_year, or in the Julian calendar if $julian is true.
  * Ref: Sec.(2.5), Eq.(2.42)
  */
 int
-advent(int g_year)
+advent(int g_year, bool julian)
 {
 	struct date date = { g_year, 11, 30 };
 	int rd;
 
-	if (Calendar->id == CAL_JULIAN)
+	if (julian)
 		rd = fixed_from_julian(&date);
 	else
 		rd = fixed_from_gregorian(&date);
@@ -37,7 +37,9 @@
 #ifndef ECCLESIASTICAL_H_
 #define ECCLESIASTICAL_H_
 
-int	advent(int g_year);
+#include <stdbool.h>
+
+int	advent(int g_year, bool julian);
 int	easter(int g_year);
 int	orthodox_easter(int g_year);
 
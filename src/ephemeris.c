@@ -0,0 +1,272 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2020 The DragonFly Project.  All rights reserved.
+ *
+ * This code is derived from software contributed to The DragonFly Project
+ * by Aaron LI <aly@aaronly.me>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of The DragonFly Project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific, prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Tabulated ephemeris based on Chebyshev polynomials.
+ *
+ * Within the span of years set by ephemeris_set_span(), a function $f(t)
+ * is approximated on each segment [a, b) by
+ *
+ *     f(t) ~= c[0] + c[1] * T_1(x) + ... + c[n-1] * T_{n-1}(x),
+ *     x = (2*t - a - b) / (b - a),
+ *
+ * where T_j(x) are the Chebyshev polynomials of the first kind, and the
+ * coefficients are obtained by interpolating $f(t) at the n Chebyshev
+ * nodes.  So that evaluating the approximation only takes n multiply-adds
+ * (Clenshaw's recurrence), instead of summing up the series of dozens
+ * periodic terms.  An angular function is unwrapped within a segment
+ * before interpolation.
+ *
+ * NOTE: A segment must not cross the start of a Gregorian year, where the
+ * ephemeris correction jumps (see 'ephemeris_correction()'), so that the
+ * approximated function is smooth within every segment.
+ *
+ * Reference:
+ * Numerical Recipes, The Art of Scientific Computing (3rd Edition),
+ * Sec.(5.8), Chebyshev Approximation
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "calendar.h"
+#include "ephemeris.h"
+#include "gregorian.h"
+#include "utils.h"
+
+#define EPHEMERIS_MAX_COEFS	32
+#define EPHEMERIS_MAX_COUNT	8
+#define EPHEMERIS_MAX_YEARS	10000
+/* limit of the years, so that the new years do not overflow the R.D. */
+#define EPHEMERIS_YEAR_LIMIT	1000000
+
+static bool	span_enabled = false;
+static int	span_generation = 0;
+static int	span_nyears = 0;
+static double	*span_years = NULL;  /* start of each year, plus the end */
+static double	span_begin;
+static double	span_end;
+
+/* ephemerides that have been used, for showing the statistics */
+static struct ephemeris *ephemerides[EPHEMERIS_MAX_COUNT];
+static size_t	ephemeris_count = 0;
+
+/* lock of the segments and statistics (see '-j') */
+static pthread_mutex_t ephemeris_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool	ephemeris_reset(struct ephemeris *eph);
+static double	*ephemeris_build(struct ephemeris *eph, double a, double b);
+
+
+/*
+ * Enable the ephemerides to cover the years from $first_year to
+ * $last_year (inclusive), or disable them if $first_year > $last_year.
+ * Return false if the span is too long or out of range, otherwise true.
+ */
+bool
+ephemeris_set_span(int first_year, int last_year)
+{
+	if (first_year > last_year) {
+		span_enabled = false;
+		return true;
+	}
+	/* also keeps the subtraction below from overflowing */
+	if (first_year < -EPHEMERIS_YEAR_LIMIT ||
+	    last_year > EPHEMERIS_YEAR_LIMIT)
+		return false;
+	if (last_year - first_year >= EPHEMERIS_MAX_YEARS)
+		return false;
+
+	span_nyears = last_year - first_year + 1;
+	free(span_years);
+	span_years = xcalloc((size_t)span_nyears + 1, sizeof(*span_years));
+	for (int i = 0; i <= span_nyears; i++)
+		span_years[i] = (double)gregorian_new_year(first_year + i);
+
+	span_begin = span_years[0];
+	span_end = span_years[span_nyears];
+	span_generation++;
+	span_enabled = true;
+
+	DPRINTF("%s: span [%d, %d] -> [%.1f, %.1f)\n", __func__,
+		first_year, last_year, span_begin, span_end);
+	return true;
+}
+
+/*
+ * Reset the segments of $eph for the current span.  Return false if out
+ * of memory, which is left to the caller to fail after releasing the
+ * lock.
+ */
+static bool
+ephemeris_reset(struct ephemeris *eph)
+{
+	if (eph->generation == 0 && ephemeris_count < EPHEMERIS_MAX_COUNT)
+		ephemerides[ephemeris_count++] = eph;
+
+	for (size_t i = 0; i < eph->nsegs; i++)
+		free(eph->segs[i]);
+	free(eph->segs);
+
+	eph->generation = span_generation;
+	eph->nsegs_year = (int)ceil(366.0 / eph->seglen);
+	eph->nsegs = (size_t)span_nyears * (size_t)eph->nsegs_year;
+	eph->segs = calloc(eph->nsegs, sizeof(*eph->segs));
+	if (eph->segs == NULL) {
+		eph->generation = -1;  /* to reset again */
+		eph->nsegs = 0;
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Build the coefficients of the segment [$a, $b).
+ */
+static double *
+ephemeris_build(struct ephemeris *eph, double a, double b)
+{
+	double f[EPHEMERIS_MAX_COEFS];
+	double t, sum;
+	double *coefs;
+	int n = eph->ncoefs;
+
+	for (int k = 0; k < n; k++) {
+		t = (a + b + (b - a) * cos(M_PI * (k + 0.5) / n)) / 2.0;
+		f[k] = (eph->func)(t);
+		if (eph->angular && k > 0)
+			f[k] = f[k-1] + mod3_f(f[k] - f[k-1], -180, 180);
+	}
+
+	coefs = xcalloc((size_t)n, sizeof(*coefs));
+	for (int j = 0; j < n; j++) {
+		sum = 0.0;
+		for (int k = 0; k < n; k++)
+			sum += f[k] * cos(M_PI * j * (k + 0.5) / n);
+		coefs[j] = 2.0 * sum / n;
+	}
+	coefs[0] /= 2.0;
+
+	return coefs;
+}
+
+/*
+ * Evaluate the ephemeris $eph at moment $t and save the value in $result.
+ * Return false if the ephemerides are disabled or $t is out of span.
+ * A missing segment is built outside of the lock, and if another thread
+ * has saved the same segment in the meantime, that one is used.
+ */
+bool
+ephemeris_eval(struct ephemeris *eph, double t, double *result)
+{
+	double a, b, len, x, b0, b1, b2;
+	double *c;
+	size_t idx;
+	int y, i;
+
+	if (!span_enabled || t < span_begin || t >= span_end)
+		return false;
+
+	pthread_mutex_lock(&ephemeris_lock);
+	if (eph->generation != span_generation && !ephemeris_reset(eph)) {
+		pthread_mutex_unlock(&ephemeris_lock);
+		fatal("%s: out of memory", __func__);
+	}
+
+	/* locate the year, starting from the guess of mean year length */
+	y = (int)((t - span_begin) / 365.2425);
+	if (y >= span_nyears)
+		y = span_nyears - 1;
+	while (t < span_years[y])
+		y--;
+	while (t >= span_years[y+1])
+		y++;
+
+	len = (span_years[y+1] - span_years[y]) / eph->nsegs_year;
+	i = (int)((t - span_years[y]) / len);
+	if (i >= eph->nsegs_year)
+		i = eph->nsegs_year - 1;
+	a = span_years[y] + i * len;
+	b = (i == eph->nsegs_year - 1) ? span_years[y+1] : a + len;
+
+	idx = (size_t)y * (size_t)eph->nsegs_year + (size_t)i;
+	c = eph->segs[idx];
+	eph->nevals++;
+	pthread_mutex_unlock(&ephemeris_lock);
+
+	if (c == NULL) {
+		c = ephemeris_build(eph, a, b);
+		pthread_mutex_lock(&ephemeris_lock);
+		if (eph->segs[idx] == NULL) {
+			eph->segs[idx] = c;
+			eph->nbuilt++;
+		} else {
+			free(c);
+			c = eph->segs[idx];
+		}
+		pthread_mutex_unlock(&ephemeris_lock);
+	}
+
+	x = (2.0 * t - a - b) / (b - a);
+	b1 = b2 = 0.0;
+	for (int j = eph->ncoefs - 1; j >= 1; j--) {
+		b0 = 2.0 * x * b1 - b2 + c[j];
+		b2 = b1;
+		b1 = b0;
+	}
+	*result = x * b1 - b2 + c[0];
+	if (eph->angular)
+		*result = mod_f(*result, 360);
+
+	return true;
+}
+
+void
+ephemeris_show_stats(void)
+{
+	struct ephemeris *eph;
+
+	for (size_t i = 0; i < ephemeris_count; i++) {
+		eph = ephemerides[i];
+		fprintf(stderr, "ephemeris %s: %lu evaluations, "
+			"%lu of %zu segments built\n", eph->name,
+			eph->nevals, eph->nbuilt, eph->nsegs);
+	}
+}
@@ -0,0 +1,75 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2020 The DragonFly Project.  All rights reserved.
+ *
+ * This code is derived from software contributed to The DragonFly Project
+ * by Aaron LI <aly@aaronly.me>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of The DragonFly Project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific, prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef EPHEMERIS_H_
+#define EPHEMERIS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Tabulated ephemeris of a function, which is approximated by Chebyshev
+ * polynomials over consecutive segments.  Each Gregorian year is divided
+ * into segments of (about) equal length, because the ephemeris correction
+ * (i.e., the difference between dynamical and universal time) changes
+ * stepwise at the start of a year.  The segments are lazily built on the
+ * first use.
+ */
+struct ephemeris {
+	const char *name;
+	double	(*func)(double t);	/* function to approximate */
+	bool	 angular;		/* function is an angle in degrees */
+	double	 seglen;		/* maximum length (days) of segments */
+	int	 ncoefs;		/* number of coefficients per segment */
+
+	/* private states */
+	int	 generation;		/* generation of the span */
+	int	 nsegs_year;		/* number of segments per year */
+	size_t	 nsegs;			/* number of segments */
+	double	**segs;			/* coefficients of each segment */
+	unsigned long nbuilt;		/* number of segments built */
+	unsigned long nevals;		/* number of evaluations */
+};
+
+#define EPHEMERIS_INIT(name, func, angular, seglen, ncoefs) \
+	{ (name), (func), (angular), (seglen), (ncoefs), \
+	  0, 0, 0, NULL, 0, 0 }
+
+bool	ephemeris_set_span(int first_year, int last_year);
+bool	ephemeris_eval(struct ephemeris *eph, double t, double *result);
+void	ephemeris_show_stats(void);
+
+#endif
@@ -37,15 +37,13 @@
  */
 
 #include <sys/param.h>
-#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <assert.h>
 #include <ctype.h>
 #include <err.h>
-#include <langinfo.h>
-#include <locale.h>
-#include <paths.h>
-#include <pwd.h>
+#include <fcntl.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -54,12 +52,14 @@
 
 #include "calendar.h"
 #include "basics.h"
+#include "cache.h"
+#include "context.h"
 #include "dates.h"
 #include "days.h"
-#include "gregorian.h"
 #include "io.h"
 #include "nnames.h"
 #include "parsedata.h"
+#include "pool.h"
 #include "utils.h"
 
 
@@ -73,37 +73,169 @@ struct cal_entry {
 	char *value;		/* variable value (T_VARIABLE) */
 	char *date;		/* event date (T_DATE) */
 	struct cal_desc *description;  /* event description (T_DATE) */
+	uint64_t sig;		/* signature of cached 'di' (T_DATE) */
+	struct dateinfo di;	/* cached classified date (T_DATE) */
+	size_t index;		/* sequence number in the file (T_DATE) */
+};
+
+/*
+ * Contents of a calendar file, either privately mapped or read into
+ * memory.  The lines are split in place, so that the parsed entries and
+ * the event descriptions can directly reference the buffer instead of
+ * being copied.  The buffers are kept until the events are printed.
+ */
+struct cal_buffer {
+	struct cal_buffer *next;
+	char	*data;		/* NUL-terminated file contents */
+	size_t	 maplen;	/* length of the mapping; 0 if allocated */
 };
 
 struct cal_file {
-	FILE	*fp;
+	char	*pos;		/* beginning of the next line to read */
+	char	*end;		/* end of the file contents */
 	char	*line;		/* line string read from file */
-	size_t	 line_cap;	/* capacity of the 'line' buffer */
-	char	*nextline;	/* to store the rewinded line */
-	size_t	 nextline_cap;	/* capacity of the 'nextline' buffer */
-	bool	 rewinded;	/* if 'nextline' has the rewinded line */
+	bool	 rewinded;	/* if 'line' should be read again */
 };
 
-static struct cal_desc *descriptions = NULL;
-static struct node *definitions = NULL;
+/*
+ * Calendar file compiled and resolved in advance by cal_preload() (e.g.,
+ * by the parent process in '-a' mode), so that the child processes can
+ * inherit and replay it instead of parsing and resolving it again.
+ */
+struct cal_preload {
+	struct cal_preload *next;
+	struct cache_key key;
+	struct cache_stamp stamp;	/* stamp of the calendar file */
+	struct cache_buf records;	/* compiled records */
+	struct cal_resolved *resolved;	/* indexed by the date records */
+	size_t	 nresolved;
+	size_t	 capresolved;
+};
 
-static FILE	*cal_fopen(const char *file);
-static bool	 cal_parse(FILE *in);
-static bool	 process_token(char *line, bool *skip);
-static void	 send_mail(FILE *fp);
+/* Resolved days of a date record */
+struct cal_resolved {
+	struct calendar *calendar;	/* calendar used to resolve */
+	int	 count;			/* -1 if not resolved */
+	struct cal_day **days;
+	char	**extra;
+};
+
+/*
+ * Date entry queued by queue_date() and then resolved in a batch by
+ * resolve_jobs(), on several threads with '-j'.  A batch is resolved
+ * before the locale or calendar changes (and at the end of loading), and
+ * its events are added in the order of the entries, so that they are the
+ * same as when each entry is resolved right away.
+ */
+struct cal_job {
+	int	 state;			/* J_* */
+	const char *date;
+	struct cal_desc *desc;
+	struct dateinfo di;
+	bool	 d_first;
+	int	 count;			/* number of days; -1 if failed */
+	struct cal_matches matches;
+	struct cal_preload *pre;	/* to keep the days when preloading */
+	size_t	 index;			/* index of the date record */
+};
+
+enum {
+	J_RESOLVE,	/* to be resolved by find_cal_days() */
+	J_REPLAYED,	/* days replayed from the preloaded file */
+	J_FAILED,	/* failed to classify */
+	J_UNSUPPORTED,	/* resolved when merged, to warn in order */
+};
+
+/*
+ * State of cal_parse() on one calendar file, whose entries are read from
+ * the text, the compiled records of the cache file, or the records of
+ * the preloaded file.
+ */
+struct cal_parser {
+	struct cal_file cfile;
+	struct cache_key ckey;
+	struct cache_reader crd;
+	struct cache_buf compiled;	/* records to save or preload */
+	struct cal_preload *pre;	/* preloaded file to replay */
+	struct cal_preload *newpre;	/* file being preloaded */
+	struct stat sb;
+	bool	 cached;		/* reading the compiled records */
+	bool	 compiling;		/* compiling the records */
+	bool	 saving;		/* saving the records to the cache */
+	size_t	 ndates;		/* number of date entries read */
+	uint64_t sig;			/* signature of names; 0 if changed */
+	bool	 locale_changed;
+	bool	 calendar_changed;
+	int	 gstate;		/* G_* */
+	char	*gsym;			/* guard symbol if G_OPEN/G_CLOSED */
+};
+
+/* states of tracking whether the whole file is an include guard block */
+enum { G_BEGIN, G_OPEN, G_CLOSED, G_NONE };
+
+static FILE	*cal_fopen(struct cal_context *ctx, const char *file,
+			   char *fpath, size_t size);
+static bool	 is_relative_path(const char *path);
+static bool	 cal_parse(struct cal_context *ctx, FILE *in, const char *path,
+			   char **guard);
+static bool	 parser_open(struct cal_context *ctx, struct cal_parser *ps,
+			     FILE *in, const char *path);
+static bool	 parser_next(struct cal_context *ctx, struct cal_parser *ps,
+			     struct cal_entry *entry, bool skip);
+static void	 parser_put(struct cal_parser *ps,
+			    const struct cal_entry *entry);
+static uint64_t	 parser_signature(struct cal_context *ctx,
+				  struct cal_parser *ps);
+static void	 parser_close(struct cal_context *ctx, struct cal_parser *ps,
+			      bool ok);
+static bool	 process_token(struct cal_context *ctx, char *line,
+			       bool *skip);
+static void	 process_variable(struct cal_context *ctx,
+				  struct cal_parser *ps,
+				  const struct cal_entry *entry);
+static char	*token_ifndef(char *line);
 static char	*skip_comment(char *line, int *comment);
-static void	 write_mailheader(FILE *fp);
 
-static bool	 cal_readentry(struct cal_file *cfile,
+static bool	 cal_fload(struct cal_context *ctx, FILE *fp,
+			   struct cal_file *cfile);
+static void	 cal_buffer_add(struct cal_context *ctx, char *data,
+				size_t maplen);
+static void	 cal_buffer_freeall(struct cal_buffer *head);
+static bool	 cal_readentry(struct cal_context *ctx, struct cal_file *cfile,
 			       struct cal_entry *entry, bool skip);
+static bool	 cache_readentry(struct cal_context *ctx,
+				 struct cache_reader *rd,
+				 struct cal_entry *entry, bool skip,
+				 size_t *ndates);
+static void	 cache_putentry(struct cache_buf *cb,
+				const struct cal_entry *entry);
 static char	*cal_readline(struct cal_file *cfile);
 static void	 cal_rewindline(struct cal_file *cfile);
 static bool	 is_date_entry(char *line, char **content);
 static bool	 is_variable_entry(char *line, char **value);
 
-static struct cal_desc *cal_desc_new(struct cal_desc **head);
-static void	 cal_desc_freeall(struct cal_desc *head);
-static void	 cal_desc_addline(struct cal_desc *desc, const char *line);
+static struct cal_preload *preload_find(struct cal_context *ctx,
+					const struct cache_key *key,
+					const struct stat *sb);
+static void	 preload_resolved(struct cal_context *ctx,
+				  struct cal_preload *pre, size_t index,
+				  int count, struct cal_day **days,
+				  char **extra);
+
+static struct cal_job *job_new(struct cal_context *ctx);
+static void	 queue_date(struct cal_context *ctx, struct cal_parser *ps,
+			    struct cal_entry *entry);
+static bool	 job_replay(struct cal_context *ctx, struct cal_job *job,
+			    const struct cal_preload *pre,
+			    const struct cal_entry *entry, uint64_t sig);
+static void	 resolve_job(size_t index, void *arg);
+static void	 merge_job(struct cal_context *ctx, struct cal_job *job);
+static void	 resolve_jobs(struct cal_context *ctx);
+static void	 jobs_free(struct cal_context *ctx);
+
+static struct cal_desc *cal_desc_new(struct cal_context *ctx);
+static void	 cal_desc_addline(struct cal_context *ctx,
+				  struct cal_desc *desc, char *line);
 
 /*
  * XXX: Quoted or escaped comment marks are not supported yet.
@@ -146,15 +278,40 @@ skip_comment(char *line, int *comment)
 }
 
 
+/*
+ * Open the calendar file $file in the calendar directories, and save
+ * its path into $fpath of size $size, which is empty if the file is
+ * opened in the include directory (see cal_context_set_include_dir()).
+ */
 static FILE *
-cal_fopen(const char *file)
+cal_fopen(struct cal_context *ctx, const char *file, char *fpath,
+	  size_t size)
 {
+	int dir_fd = ctx->options.include_fd;
 	FILE *fp = NULL;
-	char fpath[MAXPATHLEN];
+	int fd, n;
+
+	if (dir_fd != -1 && !is_relative_path(file)) {
+		warnx("Rejected path of calendar file: '%s'", file);
+		return (NULL);
+	}
 
 	for (size_t i = 0; calendarDirs[i] != NULL; i++) {
-		snprintf(fpath, sizeof(fpath), "%s/%s",
-			 calendarDirs[i], file);
+		/* The first is the current directory */
+		if (i == 0 && dir_fd != -1) {
+			if ((fd = openat(dir_fd, file, O_RDONLY)) == -1)
+				continue;
+			if ((fp = fdopen(fd, "r")) == NULL) {
+				close(fd);
+				continue;
+			}
+			fpath[0] = '\0';
+			return (fp);
+		}
+
+		n = snprintf(fpath, size, "%s/%s", calendarDirs[i], file);
+		if (n < 0 || (size_t)n >= size)
+			continue;
 		if ((fp = fopen(fpath, "r")) != NULL)
 			return (fp);
 	}
@@ -163,12 +320,36 @@ cal_fopen(const char *file)
 	return (NULL);
 }
 
+/*
+ * Check whether $path is a relative path without any '..' component.
+ */
+static bool
+is_relative_path(const char *path)
+{
+	const char *p = path;
+
+	if (*p == '/' || *p == '\0')
+		return false;
+
+	while (*p != '\0') {
+		if (p[0] == '.' && p[1] == '.' && (p[2] == '/' || p[2] == '\0'))
+			return false;
+		while (*p != '\0' && *p != '/')
+			p++;
+		while (*p == '/')
+			p++;
+	}
+
+	return true;
+}
+
 /*
  * NOTE: input 'line' should have trailing comment and whitespace trimmed.
  */
 static bool
-process_token(char *line, bool *skip)
+process_token(struct cal_context *ctx, char *line, bool *skip)
 {
+	struct io_state *io = &ctx->io;
 	char *walk;
 
 	if (strcmp(line, "#endif") == 0) {
@@ -213,17 +394,34 @@ process_token(char *line, bool *skip)
 			return false;
 		}
 
-		walk++;
-		walk[strlen(walk) - 1] = '\0';
+		/*
+		 * Copy the file name instead of terminating it in place,
+		 * because the token may be replayed again.
+		 */
+		char file[MAXPATHLEN], fpath[MAXPATHLEN];
+		snprintf(file, sizeof(file), "%.*s",
+			 (int)(strlen(walk) - 2), walk + 1);
+
+		void *data;
+		if (strtab_lookup(&io->guards, file, &data) &&
+		    strtab_lookup(&io->definitions, data, NULL)) {
+			DPRINTF2("%s: skip included '%s' guarded by |%s|\n",
+				 __func__, file, (char *)data);
+			return true;
+		}
 
-		FILE *fpin = cal_fopen(walk);
+		char *guard;
+		FILE *fpin = cal_fopen(ctx, file, fpath, sizeof(fpath));
 		if (fpin == NULL)
 			return false;
-		if (!cal_parse(fpin)) {
+		if (!cal_parse(ctx, fpin, (fpath[0] != '\0') ? fpath : NULL,
+			       &guard)) {
 			warnx("Failed to parse calendar files");
 			fclose(fpin);
 			return false;
 		}
+		if (guard != NULL && !strtab_add(&io->guards, file, guard))
+			free(guard);
 
 		fclose(fpin);
 		return true;
@@ -236,20 +434,16 @@ process_token(char *line, bool *skip)
 			return false;
 		}
 
-		struct node *new = list_newnode(xstrdup(walk), NULL);
-		definitions = list_addfront(definitions, new);
-
+		strtab_add(&io->definitions, walk, NULL);
 		return true;
 
-	} else if (string_startswith(line, "#ifndef ") ||
-	           string_startswith(line, "#ifndef\t")) {
-		walk = triml(line + sizeof("#ifndef"));
+	} else if ((walk = token_ifndef(line)) != NULL) {
 		if (*walk == '\0') {
 			warnx("Expecting arguments after #ifndef");
 			return false;
 		}
 
-		if (list_lookup(definitions, walk, strcmp, NULL))
+		if (strtab_lookup(&io->definitions, walk, NULL))
 			*skip = true;
 
 		return true;
@@ -259,189 +453,306 @@ process_token(char *line, bool *skip)
 	return false;
 }
 
-static bool
-locale_day_first(void)
+/*
+ * Return the symbol of the '#ifndef' token $line, or NULL if $line is
+ * not such a token.
+ */
+static char *
+token_ifndef(char *line)
 {
-	char *d_fmt = nl_langinfo(D_FMT);
-	char *p_year;
-	char *p_mon;
-	char *p_day;
-
-	DPRINTF("%s: d_fmt=|%s|\n", __func__, d_fmt);
-
-	/*
-	 * BSDs often use '%e' while Linux often uses '%d'. Some locales
-	 * (like modern en_CA on macOS Tahoe) use ISO-style %Y-%m-%d.
-	 *
-	 * ISO-style locales (%Y-%m-%d) should map to textual day-month
-	 * rather than month-day, otherwise en_CA produces "Mar 15".
-	 *
-	 * If the year appears first, prefer day-month textual output
-	 * instead of collapsing into month-day.
-	 */
-
-	p_year = strchr(d_fmt, 'Y');
-	p_mon  = strchr(d_fmt, 'm');
-	p_day  = strpbrk(d_fmt, "ed");
-
-	if (p_mon == NULL || p_day == NULL)
-		return true;
-
-	if (p_year != NULL && p_year < p_mon && p_year < p_day)
-		return true;
-
-	return (p_day < p_mon);
+	if (string_startswith(line, "#ifndef ") ||
+	    string_startswith(line, "#ifndef\t"))
+		return triml(line + sizeof("#ifndef"));
+	else
+		return NULL;
 }
 
+/*
+ * Parse the calendar file $in.  If $path is given and the file has been
+ * preloaded, the preloaded records and resolved days are replayed.
+ * Otherwise if the cache is enabled, the compiled records are loaded
+ * from the cache file to skip the text parsing, or saved into the cache
+ * file for the later runs.
+ *
+ * If $guard is given, it is set to the (allocated) guard symbol if the
+ * whole file is guarded by '#ifndef <symbol>' (i.e., the file begins
+ * with the '#ifndef' and nothing follows the first '#endif'), so that
+ * the file can be skipped instead of included again once the symbol is
+ * defined; otherwise to NULL.
+ */
 static bool
-cal_parse(FILE *in)
+cal_parse(struct cal_context *ctx, FILE *in, const char *path, char **guard)
 {
-	struct cal_file cfile = { 0 };
+	struct cal_parser ps = { 0 };
 	struct cal_entry entry = { 0 };
-	struct cal_desc *desc;
-	struct cal_line *line;
-	struct cal_day *cdays[CAL_MAX_REPEAT] = { NULL };
-	struct specialday *sday;
-	char *extradata[CAL_MAX_REPEAT] = { NULL };
-	bool d_first, skip, var_handled;
-	bool locale_changed, calendar_changed;
-	int flags, count;
+	bool skip = false;
 
 	assert(in != NULL);
-	cfile.fp = in;
-	d_first = locale_day_first();
-	skip = false;
-	locale_changed = false;
-	calendar_changed = false;
-
-	while (cal_readentry(&cfile, &entry, skip)) {
-		if (entry.type == T_TOKEN) {
-			DPRINTF2("%s: T_TOKEN: |%s|\n",
-				 __func__, entry.token);
-			if (!process_token(entry.token, &skip)) {
-				free(entry.token);
-				return false;
-			}
+	if (guard != NULL)
+		*guard = NULL;
+	if (!parser_open(ctx, &ps, in, path))
+		goto fail;
 
-			free(entry.token);
+	/*
+	 * When compiling, also read the entries in the skipped blocks,
+	 * because whether to skip them depends on the '#define's of the
+	 * other calendar files.
+	 */
+	while (parser_next(ctx, &ps, &entry, skip)) {
+		if (skip && entry.type != T_TOKEN) {
+			parser_put(&ps, &entry);
 			continue;
 		}
 
-		if (entry.type == T_VARIABLE) {
+		switch (entry.type) {
+		case T_TOKEN:
+			DPRINTF2("%s: T_TOKEN: |%s|\n",
+				 __func__, entry.token);
+			parser_put(&ps, &entry);
+			if (!process_token(ctx, entry.token, &skip))
+				goto fail;
+			/* The included file may have changed the names */
+			if (string_startswith(entry.token, "#include"))
+				ps.sig = 0;
+			break;
+
+		case T_VARIABLE:
 			DPRINTF2("%s: T_VARIABLE: |%s|=|%s|\n",
 				 __func__, entry.variable, entry.value);
-			var_handled = false;
-
-			if (strcasecmp(entry.variable, "LANG") == 0) {
-				if (setlocale(LC_ALL, entry.value) == NULL) {
-					warnx("Failed to set LC_ALL='%s'",
-					      entry.value);
-				}
-				d_first = locale_day_first();
-				set_nnames();
-				locale_changed = true;
-				DPRINTF("%s: set LC_ALL='%s' (day_first=%s)\n",
-					__func__, entry.value,
-					d_first ? "true" : "false");
-				var_handled = true;
-			}
-
-			if (strcasecmp(entry.variable, "CALENDAR") == 0) {
-				if (!set_calendar(entry.value)) {
-					warnx("Failed to set CALENDAR='%s'",
-					      entry.value);
-				}
-				calendar_changed = true;
-				DPRINTF("%s: set CALENDAR='%s'\n",
-					__func__, entry.value);
-				var_handled = true;
-			}
-
-			if (strcasecmp(entry.variable, "SEQUENCE") == 0) {
-				set_nsequences(entry.value);
-				var_handled = true;
-			}
-
-			for (size_t i = 0; specialdays[i].name; i++) {
-				sday = &specialdays[i];
-				if (strcasecmp(entry.variable, sday->name) == 0) {
-					free(sday->n_name);
-					sday->n_name = xstrdup(entry.value);
-					sday->n_len = strlen(sday->n_name);
-					var_handled = true;
-					break;
-				}
-			}
+			parser_put(&ps, &entry);
+			process_variable(ctx, &ps, &entry);
+			break;
 
-			if (!var_handled) {
-				warnx("Unknown variable: |%s|=|%s|",
-				      entry.variable, entry.value);
-			}
+		case T_DATE:
+			queue_date(ctx, &ps, &entry);
+			/* Resolve right away without the threads */
+			if (ctx->options.nthreads <= 1)
+				resolve_jobs(ctx);
+			break;
 
-			free(entry.variable);
-			free(entry.value);
-			continue;
+		default:
+			fatal("Invalid calendar entry type: %d", entry.type);
 		}
+	}
 
-		if (entry.type == T_DATE) {
-			desc = entry.description;
-			DPRINTF2("----------------\n%s: T_DATE: |%s|\n",
-				 __func__, entry.date);
-			for (line = desc->firstline; line; line = line->next)
-				DPRINTF3("\t|%s|\n", line->str);
-
-			count = parse_cal_date(entry.date, &flags, cdays,
-					       extradata);
-			if (count < 0) {
-				warnx("Cannot parse date |%s| with content |%s|",
-				      entry.date, desc->firstline->str);
-				continue;
-			} else if (count == 0) {
-				DPRINTF2("Ignore out-of-range date |%s| "
-					 "with content |%s|\n",
-					 entry.date, desc->firstline->str);
-				continue;
-			}
-
-			for (int i = 0; i < count; i++) {
-				event_add(cdays[i], d_first,
-				          ((flags & F_VARIABLE) != 0),
-				          desc, extradata[i]);
-				cdays[i] = NULL;
-				extradata[i] = NULL;
-			}
+	if (guard != NULL &&
+	    (ps.gstate == G_OPEN || ps.gstate == G_CLOSED))
+		*guard = xstrdup(ps.gsym);
+	parser_close(ctx, &ps, true);
 
-			free(entry.date);
-			continue;
-		}
-
-		errx(1, "Invalid calendar entry type: %d", entry.type);
-	}
+	/* The events must be added before resetting the locale or calendar */
+	if (ps.locale_changed || ps.calendar_changed)
+		resolve_jobs(ctx);
 
 	/*
 	 * Reset to the default locale, so that one calendar file that changed
 	 * the locale (by defining the "LANG" variable) does not interfere the
 	 * following calendar files without the "LANG" definition.
 	 */
-	if (locale_changed) {
-		setlocale(LC_ALL, "");
-		set_nnames();
+	if (ps.locale_changed) {
+		set_nlocale(&ctx->names, NULL);
+		expire_date_formats(ctx);
 		DPRINTF("%s: reset LC_ALL\n", __func__);
 	}
 
-	if (calendar_changed) {
-		set_calendar(NULL);
+	if (ps.calendar_changed) {
+		set_calendar(ctx, NULL);
 		DPRINTF("%s: reset CALENDAR\n", __func__);
 	}
 
-	free(cfile.line);
-	free(cfile.nextline);
+	return true;
+
+fail:
+	resolve_jobs(ctx);  /* may keep the days in the preloading file */
+	parser_close(ctx, &ps, false);
+	return false;
+}
+
+/*
+ * Set up parser $ps to read the calendar file $in.  If $path is given and
+ * the file has been preloaded, its records are to be replayed; otherwise
+ * if the cache is enabled, the compiled records are loaded from the cache
+ * file, or to be compiled and saved.  When preloading, the records are
+ * also compiled to be kept.
+ */
+static bool
+parser_open(struct cal_context *ctx, struct cal_parser *ps, FILE *in,
+	    const char *path)
+{
+	struct io_state *io = &ctx->io;
+	struct stat *sb = &ps->sb;
+	size_t maplen;
+	char *data;
+
+	ps->gstate = G_BEGIN;
+	if (path != NULL &&
+	    (ctx->options.cache_dir != NULL || io->preloads != NULL ||
+	     io->preloading) &&
+	    fstat(fileno(in), sb) == 0 && S_ISREG(sb->st_mode)) {
+		cache_key_init(&ps->ckey, ctx, path);
+		if ((ps->pre = preload_find(ctx, &ps->ckey, sb)) != NULL) {
+			DPRINTF("%s: replay preloaded %s\n", __func__, path);
+			ps->crd.pos = ps->pre->records.data;
+			ps->crd.end = ps->pre->records.data +
+				ps->pre->records.len;
+			ps->cached = true;
+		} else if (ctx->options.cache_dir != NULL) {
+			data = cache_load(&ps->ckey, sb, &ps->crd, &maplen);
+			if (data != NULL) {
+				cal_buffer_add(ctx, data, maplen);
+				ps->cached = true;
+			} else {
+				ps->compiling = ps->saving = true;
+			}
+		}
+		if (io->preloading && ps->pre == NULL) {
+			ps->newpre = xcalloc(1, sizeof(*ps->newpre));
+			cache_stamp_init(&ps->newpre->stamp, sb);
+			ps->compiling = true;
+		}
+	}
+
+	return (ps->cached || cal_fload(ctx, in, &ps->cfile));
+}
+
+/*
+ * Read the next entry of parser $ps into $entry, and track whether the
+ * whole file is an include guard block.  Return false at the end.
+ */
+static bool
+parser_next(struct cal_context *ctx, struct cal_parser *ps,
+	    struct cal_entry *entry, bool skip)
+{
+	if (ps->cached) {
+		if (!cache_readentry(ctx, &ps->crd, entry, skip, &ps->ndates))
+			return false;
+	} else {
+		if (!cal_readentry(ctx, &ps->cfile, entry,
+				   skip && !ps->compiling))
+			return false;
+		if (entry->type == T_DATE)
+			entry->index = ps->ndates++;
+	}
+
+	switch (ps->gstate) {
+	case G_BEGIN:
+		ps->gsym = (entry->type == T_TOKEN) ?
+			token_ifndef(entry->token) : NULL;
+		ps->gstate = (ps->gsym != NULL && *ps->gsym != '\0') ?
+			G_OPEN : G_NONE;
+		break;
+	case G_OPEN:
+		if (entry->type == T_TOKEN &&
+		    strcmp(entry->token, "#endif") == 0)
+			ps->gstate = G_CLOSED;
+		break;
+	case G_CLOSED:
+		ps->gstate = G_NONE;
+		break;
+	}
 
 	return true;
 }
 
+/*
+ * Add $entry to the compiled records of parser $ps if compiling.
+ */
+static void
+parser_put(struct cal_parser *ps, const struct cal_entry *entry)
+{
+	if (ps->compiling)
+		cache_putentry(&ps->compiled, entry);
+}
+
+/*
+ * Signature of the current names to check the classified dates of the
+ * records against, which is only computed again after the names may have
+ * changed.
+ */
+static uint64_t
+parser_signature(struct cal_context *ctx, struct cal_parser *ps)
+{
+	if (ps->sig == 0)
+		ps->sig = dateinfo_signature(ctx);
+	return ps->sig;
+}
+
+/*
+ * Finish parser $ps: if $ok, save the compiled records into the cache
+ * file or keep them in the preloaded file; otherwise discard them.
+ */
+static void
+parser_close(struct cal_context *ctx, struct cal_parser *ps, bool ok)
+{
+	if (ok && ps->saving)
+		cache_save(&ps->ckey, &ps->sb, &ps->compiled);
+	if (ok && ps->newpre != NULL) {
+		ps->newpre->key = ps->ckey;
+		ps->newpre->records = ps->compiled;
+		ps->newpre->next = ctx->io.preloads;
+		ctx->io.preloads = ps->newpre;
+	} else {
+		free(ps->compiled.data);
+		free(ps->newpre);
+		cache_key_free(&ps->ckey);
+	}
+}
+
+/*
+ * Handle the variable $entry, which changes the locale, calendar, or the
+ * national names of the following entries.
+ */
+static void
+process_variable(struct cal_context *ctx, struct cal_parser *ps,
+		 const struct cal_entry *entry)
+{
+	const char *name = entry->variable;
+	const char *value = entry->value;
+
+	/* The names may change */
+	ps->sig = 0;
+
+	if (strcasecmp(name, "LANG") == 0) {
+		resolve_jobs(ctx);
+		if (!set_nlocale(&ctx->names, value))
+			warnx("Failed to set LC_ALL='%s'", value);
+		expire_date_formats(ctx);
+		ps->locale_changed = true;
+		DPRINTF("%s: set LC_ALL='%s' (day_first=%s)\n", __func__,
+			value, nlocale_day_first(&ctx->names) ?
+			"true" : "false");
+		return;
+	}
+
+	if (strcasecmp(name, "CALENDAR") == 0) {
+		resolve_jobs(ctx);
+		if (!set_calendar(ctx, value))
+			warnx("Failed to set CALENDAR='%s'", value);
+		ps->calendar_changed = true;
+		DPRINTF("%s: set CALENDAR='%s'\n", __func__, value);
+		return;
+	}
+
+	if (strcasecmp(name, "SEQUENCE") == 0) {
+		set_nsequences(&ctx->names, value);
+		return;
+	}
+
+	for (size_t i = 0; specialdays[i].name; i++) {
+		if (strcasecmp(name, specialdays[i].name) == 0) {
+			free(ctx->sday_names[i]);
+			ctx->sday_names[i] = xstrdup(value);
+			ctx->sday_lens[i] = strlen(value);
+			return;
+		}
+	}
+
+	warnx("Unknown variable: |%s|=|%s|", name, value);
+}
+
 static bool
-cal_readentry(struct cal_file *cfile, struct cal_entry *entry, bool skip)
+cal_readentry(struct cal_context *ctx, struct cal_file *cfile,
+	      struct cal_entry *entry, bool skip)
 {
 	char *p, *value, *content;
 	int comment;
@@ -458,7 +769,7 @@ cal_readentry(struct cal_file *cfile, struct cal_entry *entry, bool skip)
 
 		if (*p == '#') {
 			entry->type = T_TOKEN;
-			entry->token = xstrdup(p);
+			entry->token = p;
 			return true;
 		}
 
@@ -477,8 +788,8 @@ cal_readentry(struct cal_file *cfile, struct cal_entry *entry, bool skip)
 			}
 
 			entry->type = T_VARIABLE;
-			entry->variable = xstrdup(p);
-			entry->value = xstrdup(value);
+			entry->variable = p;
+			entry->value = value;
 			return true;
 		}
 
@@ -491,9 +802,9 @@ cal_readentry(struct cal_file *cfile, struct cal_entry *entry, bool skip)
 			}
 
 			entry->type = T_DATE;
-			entry->date = xstrdup(p);
-			entry->description = cal_desc_new(&descriptions);
-			cal_desc_addline(entry->description, content);
+			entry->date = p;
+			entry->description = cal_desc_new(ctx);
+			cal_desc_addline(ctx, entry->description, content);
 
 			/* Continuous description of the event */
 			while ((p = cal_readline(cfile)) != NULL) {
@@ -503,7 +814,8 @@ cal_readentry(struct cal_file *cfile, struct cal_entry *entry, bool skip)
 
 				if (*p == '\t') {
 					content = triml(p);
-					cal_desc_addline(entry->description,
+					cal_desc_addline(ctx,
+							 entry->description,
 							 content);
 				} else {
 					cal_rewindline(cfile);
@@ -520,33 +832,245 @@ cal_readentry(struct cal_file *cfile, struct cal_entry *entry, bool skip)
 	return false;
 }
 
+/*
+ * Load the contents of the calendar file $fp into a buffer, which is
+ * mapped if $fp is a regular file, or read otherwise (e.g., stdin).
+ */
+static bool
+cal_fload(struct cal_context *ctx, FILE *fp, struct cal_file *cfile)
+{
+	struct stat sb;
+	size_t len, cap, n;
+	char *data;
+	long pagesize;
+
+	if (fstat(fileno(fp), &sb) == 0 && S_ISREG(sb.st_mode) &&
+	    sb.st_size > 0) {
+		/*
+		 * The lines are NUL-terminated in place, so the mapping
+		 * is private and writable.  The remainder of the last page
+		 * is zero-filled, which terminates the last line if it
+		 * has no trailing newline; unless the file size is a
+		 * multiple of the page size.
+		 */
+		len = (size_t)sb.st_size;
+		pagesize = sysconf(_SC_PAGESIZE);
+		data = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+			    fileno(fp), 0);
+		if (data != MAP_FAILED) {
+			if (data[len-1] == '\n' ||
+			    (pagesize > 0 && len % (size_t)pagesize != 0)) {
+				cal_buffer_add(ctx, data, len);
+				goto done;
+			}
+			munmap(data, len);
+		}
+		DPRINTF("%s: cannot map file; fallback to read\n", __func__);
+	}
+
+	len = 0;
+	cap = BUFSIZ;
+	data = xmalloc(cap);
+	while ((n = fread(data + len, 1, cap - len - 1, fp)) > 0) {
+		len += n;
+		if (cap - len <= 1) {
+			cap *= 2;
+			data = xrealloc(data, cap);
+		}
+	}
+	if (ferror(fp)) {
+		warn("%s: fread", __func__);
+		free(data);
+		return false;
+	}
+	data[len] = '\0';
+	cal_buffer_add(ctx, data, 0);
+
+done:
+	memset(cfile, 0, sizeof(*cfile));
+	cfile->pos = data;
+	cfile->end = data + len;
+	return true;
+}
+
+/*
+ * Keep the buffer $data until the events are printed, which is mapped
+ * with length $maplen, or allocated if $maplen is 0.
+ */
+static void
+cal_buffer_add(struct cal_context *ctx, char *data, size_t maplen)
+{
+	struct cal_buffer *cbuf;
+
+	cbuf = xcalloc(1, sizeof(*cbuf));
+	cbuf->data = data;
+	cbuf->maplen = maplen;
+	cbuf->next = ctx->io.buffers;
+	ctx->io.buffers = cbuf;
+}
+
+static void
+cal_buffer_freeall(struct cal_buffer *head)
+{
+	struct cal_buffer *cbuf;
+
+	while ((cbuf = head) != NULL) {
+		head = head->next;
+		if (cbuf->maplen > 0)
+			munmap(cbuf->data, cbuf->maplen);
+		else
+			free(cbuf->data);
+		free(cbuf);
+	}
+}
+
 static char *
 cal_readline(struct cal_file *cfile)
 {
+	char *p, *eol;
+
 	if (cfile->rewinded) {
 		cfile->rewinded = false;
-		return cfile->nextline;
+		return cfile->line;
 	}
 
-	if (getline(&cfile->line, &cfile->line_cap, cfile->fp) <= 0)
+	if (cfile->pos >= cfile->end)
 		return NULL;
 
-	return cfile->line;
+	p = cfile->pos;
+	eol = memchr(p, '\n', (size_t)(cfile->end - p));
+	if (eol == NULL)
+		eol = cfile->end;  /* last line without a newline */
+	*eol = '\0';
+	cfile->pos = eol + 1;
+	cfile->line = p;
+
+	return p;
 }
 
+/*
+ * Rewind the last read line, which is stable in the file buffer, so
+ * that the next cal_readline() returns it again.
+ */
 static void
 cal_rewindline(struct cal_file *cfile)
 {
-	if (cfile->nextline_cap == 0)
-		cfile->nextline = xmalloc(cfile->line_cap);
-	else if (cfile->nextline_cap < cfile->line_cap)
-		cfile->nextline = xrealloc(cfile->nextline, cfile->line_cap);
-
-	memcpy(cfile->nextline, cfile->line, cfile->line_cap);
-	cfile->nextline_cap = cfile->line_cap;
 	cfile->rewinded = true;
 }
 
+/*
+ * Compile the entry $entry into a record of the cache buffer $cb:
+ *   type, [token] | [variable, value] | [sig, di, date, nlines, lines...]
+ */
+static void
+cache_putentry(struct cache_buf *cb, const struct cal_entry *entry)
+{
+	struct cal_line *line;
+	uint32_t nlines;
+
+	cache_put_u32(cb, (uint32_t)entry->type);
+
+	switch (entry->type) {
+	case T_TOKEN:
+		cache_put_str(cb, entry->token);
+		break;
+	case T_VARIABLE:
+		cache_put_str(cb, entry->variable);
+		cache_put_str(cb, entry->value);
+		break;
+	case T_DATE:
+		cache_put(cb, &entry->sig, sizeof(entry->sig));
+		cache_put(cb, &entry->di, sizeof(entry->di));
+		cache_put_str(cb, entry->date);
+		nlines = 0;
+		for (line = entry->description->firstline; line;
+		     line = line->next)
+			nlines++;
+		cache_put_u32(cb, nlines);
+		for (line = entry->description->firstline; line;
+		     line = line->next)
+			cache_put_str(cb, line->str);
+		break;
+	default:
+		fatal("Invalid calendar entry type: %d", entry->type);
+	}
+}
+
+/*
+ * Read the next entry from the compiled records, similar to
+ * cal_readentry() but skip entries (except tokens) if $skip is true.
+ * The strings directly reference the compiled records.  The date
+ * records (including the skipped ones) are counted by $ndates.
+ */
+static bool
+cache_readentry(struct cal_context *ctx, struct cache_reader *rd,
+		struct cal_entry *entry, bool skip, size_t *ndates)
+{
+	uint32_t type, nlines;
+	char *str;
+
+	memset(entry, 0, sizeof(*entry));
+	entry->type = T_NONE;
+
+	while (rd->pos < rd->end) {
+		if (!cache_get_u32(rd, &type))
+			goto corrupted;
+
+		switch (type) {
+		case T_TOKEN:
+			if ((entry->token = cache_get_str(rd)) == NULL)
+				goto corrupted;
+			break;
+		case T_VARIABLE:
+			if ((entry->variable = cache_get_str(rd)) == NULL ||
+			    (entry->value = cache_get_str(rd)) == NULL)
+				goto corrupted;
+			break;
+		case T_DATE:
+			if (!cache_get(rd, &entry->sig, sizeof(entry->sig)) ||
+			    !cache_get(rd, &entry->di, sizeof(entry->di)) ||
+			    (entry->date = cache_get_str(rd)) == NULL ||
+			    !cache_get_u32(rd, &nlines) || nlines == 0)
+				goto corrupted;
+			entry->index = (*ndates)++;
+			/* Classify the date again if not trusted */
+			if (entry->sig != 0 && !dateinfo_valid(&entry->di)) {
+				DPRINTF("%s: invalid date info of |%s|\n",
+					__func__, entry->date);
+				entry->sig = 0;
+			}
+			if (!skip)
+				entry->description = cal_desc_new(ctx);
+			for (uint32_t i = 0; i < nlines; i++) {
+				if ((str = cache_get_str(rd)) == NULL)
+					goto corrupted;
+				if (!skip)
+					cal_desc_addline(ctx,
+							 entry->description,
+							 str);
+			}
+			break;
+		default:
+			goto corrupted;
+		}
+
+		if (skip && type != T_TOKEN) {
+			DPRINTF2("%s: skip entry: |%s|\n", __func__,
+				 (type == T_DATE) ? entry->date : entry->variable);
+			continue;
+		}
+
+		entry->type = (int)type;
+		return true;
+	}
+
+	return false;
+
+corrupted:
+	warnx("%s: corrupted cache file", __func__);
+	return false;
+}
+
 static bool
 is_variable_entry(char *line, char **value)
 {
@@ -588,45 +1112,291 @@ is_date_entry(char *line, char **content)
 }
 
 
-static struct cal_desc *
-cal_desc_new(struct cal_desc **head)
+static struct cal_preload *
+preload_find(struct cal_context *ctx, const struct cache_key *key,
+	     const struct stat *sb)
 {
-	struct cal_desc *desc = xcalloc(1, sizeof(*desc));
+	struct cal_preload *pre;
+	struct cache_stamp stamp;
+
+	cache_stamp_init(&stamp, sb);
+	for (pre = ctx->io.preloads; pre != NULL; pre = pre->next) {
+		if (cache_stamp_equal(&pre->stamp, &stamp) &&
+		    strcmp(pre->key.path, key->path) == 0 &&
+		    strcmp(pre->key.locale, key->locale) == 0 &&
+		    strcmp(pre->key.calendar, key->calendar) == 0)
+			return pre;
+	}
 
-	if (*head == NULL) {
-		*head = desc;
-	} else {
-		desc->next = *head;
-		*head = desc;
+	return NULL;
+}
+
+/*
+ * Keep the $count resolved days $days and their extra data $extra of
+ * the $index-th date record of the preloaded file $pre.  The extra
+ * data are taken over and the arrays are cleared.
+ */
+static void
+preload_resolved(struct cal_context *ctx, struct cal_preload *pre,
+		 size_t index, int count, struct cal_day **days, char **extra)
+{
+	struct cal_resolved *res;
+	size_t n;
+
+	if (index >= pre->capresolved) {
+		n = pre->capresolved;
+		pre->capresolved = (n > 0) ? n * 2 : 256;
+		if (pre->capresolved <= index)
+			pre->capresolved = index + 1;
+		pre->resolved = xrealloc(pre->resolved,
+					 pre->capresolved * sizeof(*res));
+	}
+	while (pre->nresolved <= index) {
+		res = &pre->resolved[pre->nresolved++];
+		memset(res, 0, sizeof(*res));
+		res->count = -1;
 	}
 
-	return desc;
+	res = &pre->resolved[index];
+	res->calendar = ctx->calendar;
+	res->count = count;
+	if (count <= 0)
+		return;
+
+	n = (size_t)count;
+	res->days = xmalloc(n * sizeof(*res->days));
+	res->extra = xmalloc(n * sizeof(*res->extra));
+	memcpy(res->days, days, n * sizeof(*res->days));
+	memcpy(res->extra, extra, n * sizeof(*res->extra));
+	memset(days, 0, n * sizeof(*days));
+	memset(extra, 0, n * sizeof(*extra));
 }
 
-static void	
-cal_desc_freeall(struct cal_desc *head)
+static struct cal_job *
+job_new(struct cal_context *ctx)
 {
-	struct cal_desc *desc;
+	struct io_state *io = &ctx->io;
+	struct cal_job *job;
+	size_t n;
+
+	if (io->njobs == io->capjobs) {
+		n = io->capjobs;
+		io->capjobs = (n > 0) ? n * 2 : 256;
+		io->jobs = xrealloc(io->jobs, io->capjobs * sizeof(*job));
+		memset(io->jobs + n, 0, (io->capjobs - n) * sizeof(*job));
+	}
+
+	/* Keep the storage of the matches to reuse */
+	job = &io->jobs[io->njobs++];
+	job->count = 0;
+	return job;
+}
+
+/*
+ * Queue the date $entry read by parser $ps to be resolved by
+ * resolve_jobs().  The days are replayed from the preloaded file, or the
+ * date is classified here (or reused from the compiled record) so that
+ * only find_cal_days() is left to the threads.
+ */
+static void
+queue_date(struct cal_context *ctx, struct cal_parser *ps,
+	   struct cal_entry *entry)
+{
+	struct cal_job *job;
 	struct cal_line *line;
+	struct dateinfo di;
+	uint64_t sig = 0;
+	bool ok;
+
+	DPRINTF2("----------------\n%s: T_DATE: |%s|\n",
+		 __func__, entry->date);
+	for (line = entry->description->firstline; line; line = line->next)
+		DPRINTF3("\t|%s|\n", line->str);
+
+	job = job_new(ctx);
+	job->date = entry->date;
+	job->desc = entry->description;
+	job->d_first = nlocale_day_first(&ctx->names);
+	job->pre = ps->newpre;
+	job->index = entry->index;
+
+	if (ps->cached || ps->compiling)
+		sig = parser_signature(ctx, ps);
+	if (job_replay(ctx, job, ps->pre, entry, sig))
+		return;
 
-	while ((desc = head) != NULL) {
-		head = head->next;
-		while ((line = desc->firstline) != NULL) {
-			desc->firstline = desc->firstline->next;
-			free(line->str);
-			free(line);
+	/*
+	 * Reuse the cached classification if the names are the same as
+	 * when it was compiled.
+	 */
+	if (ps->cached && entry->sig == sig) {
+		di = entry->di;
+		ok = true;
+	} else {
+		ok = parse_cal_dateinfo(ctx, entry->date, &di);
+	}
+	if (ps->compiling) {
+		entry->sig = ok ? sig : 0;
+		entry->di = di;
+		cache_putentry(&ps->compiled, entry);
+	}
+
+	job->di = di;
+	if (!ok) {
+		job->state = J_FAILED;
+		job->count = -1;
+	} else if (!cal_dateinfo_supported(ctx, &di)) {
+		job->state = J_UNSUPPORTED;
+	} else {
+		job->state = J_RESOLVE;
+	}
+}
+
+/*
+ * Fill $job with the days of the date $entry from the preloaded file
+ * $pre, if the names (of signature $sig) and calendar are the same as
+ * when they were resolved.  Return false if not replayed.
+ */
+static bool
+job_replay(struct cal_context *ctx, struct cal_job *job,
+	   const struct cal_preload *pre, const struct cal_entry *entry,
+	   uint64_t sig)
+{
+	const struct cal_resolved *res;
+
+	if (ctx->io.preloading || pre == NULL ||
+	    entry->index >= pre->nresolved || entry->sig != sig)
+		return false;
+
+	res = &pre->resolved[entry->index];
+	if (res->count < 0 || res->calendar != ctx->calendar)
+		return false;
+
+	job->state = J_REPLAYED;
+	job->di = entry->di;
+	job->count = res->count;
+	for (int i = 0; i < res->count; i++) {
+		matches_add(&job->matches, res->days[i],
+			    (res->extra[i] != NULL) ?
+			    xstrdup(res->extra[i]) : NULL);
+	}
+	return true;
+}
+
+static void
+resolve_job(size_t index, void *arg)
+{
+	struct cal_context *ctx = arg;
+	struct cal_job *job = &ctx->io.jobs[index];
+
+	if (job->state == J_RESOLVE) {
+		job->count = find_cal_days(ctx, job->date, &job->di,
+					   &job->matches);
+	}
+}
+
+/*
+ * Add the events of the resolved entry $job, or keep its days in the
+ * preloaded file when preloading.
+ */
+static void
+merge_job(struct cal_context *ctx, struct cal_job *job)
+{
+	if (job->state == J_UNSUPPORTED) {
+		/* just warns and fails */
+		job->count = find_cal_days(ctx, job->date, &job->di,
+					   &job->matches);
+	}
+
+	if (ctx->io.preloading) {
+		/* Keep the days instead of adding events */
+		if (job->pre != NULL) {
+			preload_resolved(ctx, job->pre, job->index,
+					 job->count, job->matches.days,
+					 job->matches.extra);
 		}
-		free(desc);
+		return;
+	}
+	if (job->count < 0) {
+		warnx("Cannot parse date |%s| with content |%s|",
+		      job->date, job->desc->firstline->str);
+		return;
+	} else if (job->count == 0 && job->state != J_REPLAYED) {
+		DPRINTF2("Ignore out-of-range date |%s| with content |%s|\n",
+			 job->date, job->desc->firstline->str);
+		return;
+	}
+
+	for (int i = 0; i < job->count; i++) {
+		event_add(ctx, job->matches.days[i], job->d_first,
+			  ((job->di.flags & F_VARIABLE) != 0),
+			  job->desc, job->matches.extra[i]);
 	}
 }
 
+/*
+ * Resolve the collected entries on the thread pool, and then merge them
+ * in order.
+ */
+static void
+resolve_jobs(struct cal_context *ctx)
+{
+	struct io_state *io = &ctx->io;
+
+	if (io->njobs == 0)
+		return;
+
+	pool_run(io->njobs, ctx->options.nthreads, resolve_job, ctx);
+	for (size_t i = 0; i < io->njobs; i++) {
+		merge_job(ctx, &io->jobs[i]);
+		matches_reset(&io->jobs[i].matches);
+	}
+	io->njobs = 0;
+}
+
+/*
+ * Release the collected entries, including the ones left unresolved by
+ * a failed call (see cal_reset()).
+ */
+static void
+jobs_free(struct cal_context *ctx)
+{
+	struct io_state *io = &ctx->io;
+
+	for (size_t i = 0; i < io->capjobs; i++)
+		matches_free(&io->jobs[i].matches);
+	free(io->jobs);
+	io->jobs = NULL;
+	io->njobs = io->capjobs = 0;
+}
+
+/*
+ * The descriptions and their lines are allocated from the arena, and are
+ * released together with the events by arena_freeall().
+ */
+static struct cal_desc *
+cal_desc_new(struct cal_context *ctx)
+{
+	struct cal_desc **head = &ctx->io.descriptions;
+	struct cal_desc *desc = arena_alloc(&ctx->arena, sizeof(*desc));
+
+	if (*head == NULL) {
+		*head = desc;
+	} else {
+		desc->next = *head;
+		*head = desc;
+	}
+
+	return desc;
+}
+
 static void	
-cal_desc_addline(struct cal_desc *desc, const char *line)
+cal_desc_addline(struct cal_context *ctx, struct cal_desc *desc, char *line)
 {
 	struct cal_line *cline;
 
-	cline = xcalloc(1, sizeof(*cline));
-	cline->str = xstrdup(line);
+	cline = arena_alloc(&ctx->arena, sizeof(*cline));
+	cline->str = line;
 	if (desc->lastline != NULL) {
 		desc->lastline->next = cline;
 		desc->lastline = cline;
@@ -636,116 +1406,130 @@ cal_desc_addline(struct cal_desc *desc, const char *line)
 }
 
 
-int
-cal(FILE *fpin)
+/*
+ * Parse and resolve the calendar file $file and its included files in
+ * advance, without adding any events.  Later parsing of the same files
+ * (e.g., in the child processes forked in '-a' mode) then replays them,
+ * as long as the files are not modified and are included with the same
+ * locale and calendar.
+ */
+bool
+cal_preload(struct cal_context *ctx, const char *file)
 {
-	if (!cal_parse(fpin)) {
-		warnx("Failed to parse calendar files");
-		return 1;
+	struct io_state *io = &ctx->io;
+	struct cal_preload *pre;
+	size_t nfiles, ndates;
+	FILE *fp;
+	bool ok;
+
+	if ((fp = fopen(file, "r")) == NULL) {
+		DPRINTF("%s: cannot open '%s'\n", __func__, file);
+		return false;
 	}
 
-	if (Options.allmode) {
-		FILE *fpout;
-
-		/*
-		 * Use a temporary output file, so we can skip sending mail
-		 * if there is no output.
-		 */
-		if ((fpout = tmpfile()) == NULL) {
-			warn("tmpfile");
-			return 1;
-		}
-		event_print_all(fpout);
-		send_mail(fpout);
-	} else {
-		event_print_all(stdout);
-	}
+	io->preloading = true;
+	ok = cal_parse(ctx, fp, file, NULL);
+	resolve_jobs(ctx);
+	jobs_free(ctx);
+	if (!ok)
+		warnx("Failed to preload calendar file: '%s'", file);
+	io->preloading = false;
+	fclose(fp);
 
-	list_freeall(definitions, free, NULL);
-	definitions = NULL;
-	cal_desc_freeall(descriptions);
-	descriptions = NULL;
+	/* Reset the states changed by the preloaded files */
+	cal_clear(ctx);
 
-	return 0;
+	nfiles = ndates = 0;
+	for (pre = io->preloads; pre != NULL; pre = pre->next) {
+		nfiles++;
+		ndates += pre->nresolved;
+	}
+	DPRINTF("%s: preloaded %zu files with %zu dates\n",
+		__func__, nfiles, ndates);
+	return ok;
 }
 
-
-static void
-send_mail(FILE *fp)
+/*
+ * Parse and resolve the calendar file $fp and its included files, adding
+ * the events to the dates.
+ */
+bool
+cal_load(struct cal_context *ctx, FILE *fp)
 {
-	int ch, pdes[2];
-	FILE *fpipe;
-
-	assert(Options.allmode == true);
+	bool ok;
 
-	if (fseek(fp, 0L, SEEK_END) == -1 || ftell(fp) == 0) {
-		DPRINTF("%s: no events; skip sending mail\n", __func__);
-		return;
-	}
-	if (pipe(pdes) < 0) {
-		warnx("pipe");
-		return;
+	ok = cal_parse(ctx, fp, NULL, NULL);
+	resolve_jobs(ctx);
+	jobs_free(ctx);
+	if (!ok) {
+		warnx("Failed to parse calendar files");
+		return false;
 	}
 
-	switch (fork()) {
-	case -1:
-		close(pdes[0]);
-		close(pdes[1]);
-		goto done;
-	case 0:
-		/* child -- set stdin to pipe output */
-		if (pdes[0] != STDIN_FILENO) {
-			dup2(pdes[0], STDIN_FILENO);
-			close(pdes[0]);
-		}
-		close(pdes[1]);
-		execl(_PATH_SENDMAIL, "sendmail", "-i", "-t", "-F",
-		      "\"Reminder Service\"", (char *)NULL);
-		warn(_PATH_SENDMAIL);
-		_exit(1);
-	}
-	/* parent -- write to pipe input */
-	close(pdes[0]);
+	return true;
+}
 
-	fpipe = fdopen(pdes[1], "w");
-	if (fpipe == NULL) {
-		close(pdes[1]);
-		goto done;
+/*
+ * Release the loaded events and the states changed by the calendar files,
+ * but keep the preloaded files.
+ */
+void
+cal_clear(struct cal_context *ctx)
+{
+	struct io_state *io = &ctx->io;
+
+	strtab_freeall(&io->definitions, NULL);
+	strtab_freeall(&io->guards, free);
+	for (size_t i = 0; i < NSPECIALDAYS; i++) {
+		free(ctx->sday_names[i]);
+		ctx->sday_names[i] = NULL;
+		ctx->sday_lens[i] = 0;
 	}
+	reset_nsequences(&ctx->names);
+	arena_freeall(&ctx->arena);  /* descriptions and events */
+	event_clear_all(ctx);
+	io->descriptions = NULL;
+	cal_buffer_freeall(io->buffers);
+	io->buffers = NULL;
+}
 
-	write_mailheader(fpipe);
-	rewind(fp);
-	while ((ch = fgetc(fp)) != EOF)
-		fputc(ch, fpipe);
-	fclose(fpipe);  /* will also close the underlying fd */
-
-done:
-	fclose(fp);
-	while (wait(NULL) >= 0)
-		;
+/*
+ * Reset the parsing states interrupted by a fatal error (see context.c),
+ * i.e., the entries in progress, the locale and calendar in use, and the
+ * loaded events.  The files being parsed may be leaked.
+ */
+void
+cal_reset(struct cal_context *ctx)
+{
+	ctx->io.preloading = false;
+	jobs_free(ctx);
+	cal_clear(ctx);
+	set_nlocale(&ctx->names, NULL);
+	set_calendar(ctx, NULL);
 }
 
-static void
-write_mailheader(FILE *fp)
-{
-	uid_t uid = getuid();
-	struct passwd *pw = getpwuid(uid);
-	struct date date;
-	char dayname[32] = { 0 };
-	int dow;
-
-	gregorian_from_fixed(Options.today, &date);
-	dow = dayofweek_from_fixed(Options.today);
-	sprintf(dayname, "%s, %d %s %d",
-		dow_names[dow].f_name, date.day,
-		month_names[date.month-1].f_name, date.year);
-
-	fprintf(fp,
-		"From: %s (Reminder Service)\n"
-		"To: %s\n"
-		"Subject: %s's Calendar\n"
-		"Precedence: bulk\n"
-		"Auto-Submitted: auto-generated\n\n",
-		pw->pw_name, pw->pw_name, dayname);
-	fflush(fp);
+/*
+ * Release the preloaded files, which must be done before the dates they
+ * were resolved to are released.
+ */
+void
+cal_preload_freeall(struct cal_context *ctx)
+{
+	struct cal_preload *pre;
+	struct cal_resolved *res;
+
+	while ((pre = ctx->io.preloads) != NULL) {
+		ctx->io.preloads = pre->next;
+		for (size_t i = 0; i < pre->nresolved; i++) {
+			res = &pre->resolved[i];
+			for (int j = 0; j < res->count; j++)
+				free(res->extra[j]);
+			free(res->days);
+			free(res->extra);
+		}
+		free(pre->resolved);
+		free(pre->records.data);
+		cache_key_free(&pre->key);
+		free(pre);
+	}
 }
@@ -36,6 +36,11 @@
 #ifndef IO_H_
 #define IO_H_
 
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "utils.h"
+
 struct cal_line {
 	struct cal_line *next;
 	char		*str;
@@ -47,6 +52,32 @@ struct cal_desc {
 	struct cal_line *lastline;
 };
 
-int	cal(FILE *fp);
+/*
+ * Parsing states of a calendar context (see context.h).
+ */
+struct io_state {
+	struct cal_buffer  *buffers;
+	struct cal_preload *preloads;
+	bool		    preloading;
+	struct cal_desc	   *descriptions;
+	struct strtab	    definitions;
+	/*
+	 * Include guards of the included files (by the names in
+	 * '#include'), so that a guarded file is not opened and parsed
+	 * again if its guard symbol has been defined.
+	 */
+	struct strtab	    guards;
+	struct cal_job	   *jobs;	/* date entries to resolve */
+	size_t		    njobs;
+	size_t		    capjobs;
+};
+
+struct cal_context;
+
+bool	cal_load(struct cal_context *ctx, FILE *fp);
+void	cal_clear(struct cal_context *ctx);
+void	cal_reset(struct cal_context *ctx);
+bool	cal_preload(struct cal_context *ctx, const char *file);
+void	cal_preload_freeall(struct cal_context *ctx);
 
 #endif
@@ -44,6 +44,7 @@
 
 #include "calendar.h"
 #include "basics.h"
+#include "context.h"
 #include "dates.h"
 #include "gregorian.h"
 #include "julian.h"
@@ -126,7 +127,7 @@ julian_from_fixed(int rd, struct date *date)
 int
 julian_format_date(char *buf, size_t size, int rd)
 {
-	static const char *month_names[] = {
+	static const char *mon_names[] = {
 		"Jan", "Feb", "Mar", "Apr", "May", "Jun",
 		"Jul", "Aug", "Sep", "Oct", "Nov", "Dec",
 	};
@@ -134,7 +135,7 @@ julian_format_date(char *buf, size_t size, int rd)
 
 	julian_from_fixed(rd, &jdate);
 	return snprintf(buf, size, "%s/%02d",
-			month_names[jdate.month - 1], jdate.day);
+			mon_names[jdate.month - 1], jdate.day);
 }
 
 /*
@@ -154,27 +155,24 @@ julian_year_from_fixed(int rd)
  * If year $year < 0, then year is ignored.
  */
 int
-julian_find_days_ymd(int year, int month, int day, struct cal_day **dayp,
-		     char **edp __unused)
+julian_find_days_ymd(struct cal_context *ctx, int year, int month, int day,
+		     struct cal_matches *matches)
 {
 	struct cal_day *dp;
 	struct date date;
 	int rd, year1, year2;
 	int count = 0;
 
-	year1 = julian_year_from_fixed(Options.day_begin);
-	year2 = julian_year_from_fixed(Options.day_end);
+	year1 = julian_year_from_fixed(ctx->options.day_begin);
+	year2 = julian_year_from_fixed(ctx->options.day_end);
 	for (int y = year1; y <= year2; y++) {
 		if (year >= 0 && year != y)
 			continue;
 		date_set(&date, y, month, day);
 		rd = fixed_from_julian(&date);
-		if ((dp = find_rd(rd, 0)) != NULL) {
-			if (count >= CAL_MAX_REPEAT) {
-				warnx("%s: too many repeats", __func__);
-				return count;
-			}
-			dayp[count++] = dp;
+		if ((dp = find_rd(ctx, rd, 0)) != NULL) {
+			matches_add(matches, dp, NULL);
+			count++;
 		}
 	}
 
@@ -185,34 +183,26 @@ julian_find_days_ymd(int year, int month, int day, struct cal_day **dayp,
  * Find days of the specified Julian day of month ($dom) of all months.
  */
 int
-julian_find_days_dom(int dom, struct cal_day **dayp, char **edp __unused)
+julian_find_days_dom(struct cal_context *ctx, int dom,
+		     struct cal_matches *matches)
 {
 	struct cal_day *dp;
 	struct date date;
 	int year1, year2;
-	int rd_begin, rd_end;
+	int rd;
 	int count = 0;
 
-	year1 = julian_year_from_fixed(Options.day_begin);
-	year2 = julian_year_from_fixed(Options.day_end);
+	year1 = julian_year_from_fixed(ctx->options.day_begin);
+	year2 = julian_year_from_fixed(ctx->options.day_end);
 	for (int y = year1; y <= year2; y++) {
-		date_set(&date, y, 1, 1);
-		rd_begin = fixed_from_julian(&date);
-		date.year++;
-		rd_end = fixed_from_julian(&date);
-		if (rd_end > Options.day_end)
-			rd_end = Options.day_end;
-
-		for (int m = 1, rd = rd_begin; rd <= rd_end; m++) {
+		for (int m = 1; m <= 12; m++) {
 			date_set(&date, y, m, dom);
 			rd = fixed_from_julian(&date);
-			if ((dp = find_rd(rd, 0)) != NULL) {
-				if (count >= CAL_MAX_REPEAT) {
-					warnx("%s: too many repeats",
-					      __func__);
-					return count;
-				}
-				dayp[count++] = dp;
+			if (rd > ctx->options.day_end)
+				break;
+			if ((dp = find_rd(ctx, rd, 0)) != NULL) {
+				matches_add(matches, dp, NULL);
+				count++;
 			}
 		}
 	}
@@ -224,7 +214,8 @@ julian_find_days_dom(int dom, struct cal_day **dayp, char **edp __unused)
  * Find days of all days of the specified Julian month ($month).
  */
 int
-julian_find_days_month(int month, struct cal_day **dayp, char **edp __unused)
+julian_find_days_month(struct cal_context *ctx, int month,
+		       struct cal_matches *matches)
 {
 	struct cal_day *dp;
 	struct date date;
@@ -232,8 +223,8 @@ julian_find_days_month(int month, struct cal_day **dayp, char **edp __unused)
 	int rd_begin, rd_end;
 	int count = 0;
 
-	year1 = julian_year_from_fixed(Options.day_begin);
-	year2 = julian_year_from_fixed(Options.day_end);
+	year1 = julian_year_from_fixed(ctx->options.day_begin);
+	year2 = julian_year_from_fixed(ctx->options.day_end);
 	for (int y = year1; y <= year2; y++) {
 		date_set(&date, y, month, 1);
 		rd_begin = fixed_from_julian(&date);
@@ -241,17 +232,13 @@ julian_find_days_month(int month, struct cal_day **dayp, char **edp __unused)
 		if (date.month > 12)
 			date_set(&date, y+1, 1, 1);
 		rd_end = fixed_from_julian(&date);
-		if (rd_end > Options.day_end)
-			rd_end = Options.day_end;
+		if (rd_end > ctx->options.day_end)
+			rd_end = ctx->options.day_end;
 
 		for (int rd = rd_begin; rd <= rd_end; rd++) {
-			if ((dp = find_rd(rd, 0)) != NULL) {
-				if (count >= CAL_MAX_REPEAT) {
-					warnx("%s: too many repeats",
-					      __func__);
-					return count;
-				}
-				dayp[count++] = dp;
+			if ((dp = find_rd(ctx, rd, 0)) != NULL) {
+				matches_add(matches, dp, NULL);
+				count++;
 			}
 		}
 	}
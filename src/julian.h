@@ -39,17 +39,20 @@
 
 #include <stdbool.h>
 
-struct cal_day;
+struct cal_context;
+struct cal_matches;
 
 int	fixed_from_julian(const struct date *date);
 void	julian_from_fixed(int rd, struct date *date);
 bool	julian_leap_year(int year);
 
 int	julian_format_date(char *buf, size_t size, int rd);
-int	julian_find_days_ymd(int year, int month, int day,
-			     struct cal_day **dayp, char **edp);
-int	julian_find_days_dom(int dom, struct cal_day **dayp, char **edp);
-int	julian_find_days_month(int month, struct cal_day **dayp, char **edp);
+int	julian_find_days_ymd(struct cal_context *ctx, int year, int month,
+			     int day, struct cal_matches *matches);
+int	julian_find_days_dom(struct cal_context *ctx, int dom,
+			     struct cal_matches *matches);
+int	julian_find_days_month(struct cal_context *ctx, int month,
+			       struct cal_matches *matches);
 void	show_julian_calendar(int rd);
 
 #endif
@@ -0,0 +1,108 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2020 The DragonFly Project.  All rights reserved.
+ *
+ * This code is derived from software contributed to The DragonFly Project
+ * by Aaron LI <aly@aaronly.me>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of The DragonFly Project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific, prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * libcalendar: the engine of calendar(1), to parse the calendar files and
+ * find their events in a date range.
+ *
+ * All the states of a run (the options, date range, parsed files, events,
+ * and names defined by the files) are kept in a calendar context, so that
+ * several contexts can be used independently, and at the same time on
+ * different threads.  The calls on the same context are serialized.  A
+ * load can also resolve the entries on several threads (see
+ * cal_context_set_threads()).
+ *
+ * A fatal error (e.g., out of memory) fails the call instead of exiting
+ * the process, and the events of the context are then released (see
+ * context.c).
+ */
+
+#ifndef LIBCALENDAR_H_
+#define LIBCALENDAR_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+struct cal_context;
+
+/* Event passed to the cal_context_foreach_event() callback */
+struct cal_event_info {
+	int		 rd;		/* R.D. of the day */
+	int		 year;
+	int		 month;
+	int		 day;
+	const char	*date;		/* formatted date (e.g., 'Jan  5') */
+	bool		 variable;	/* whether the date varies by year */
+	const char	*description;	/* lines separated by '\n' */
+	const char	*extra;		/* extra data (e.g., time); or NULL */
+};
+
+/*
+ * Limits of today (the R.D. of the years 0 to 9999, as accepted by '-t')
+ * and of the number of days before and after it (see '-A' and '-B').
+ */
+#define CAL_DATE_MIN	(-365)
+#define CAL_DATE_MAX	3652059
+#define CAL_DAYS_MAX	36525
+
+void	cal_set_debug(int level);
+
+struct cal_context *cal_context_new(void);
+void	cal_context_free(struct cal_context *ctx);
+
+void	cal_context_set_threads(struct cal_context *ctx, int n);
+void	cal_context_set_cache_dir(struct cal_context *ctx, const char *dir);
+void	cal_context_set_include_dir(struct cal_context *ctx, int dir_fd);
+void	cal_context_set_location(struct cal_context *ctx, double latitude,
+				 double longitude, double elevation,
+				 double zone);
+void	cal_context_set_time(struct cal_context *ctx, double time);
+bool	cal_context_set_range(struct cal_context *ctx, int today,
+			      int day_begin, int day_end);
+
+bool	cal_context_preload(struct cal_context *ctx, const char *path);
+bool	cal_context_load(struct cal_context *ctx, FILE *fp);
+void	cal_context_clear(struct cal_context *ctx);
+
+int	cal_context_foreach_event(struct cal_context *ctx,
+		int (*func)(const struct cal_event_info *ev, void *arg),
+		void *arg);
+char	*cal_context_format(struct cal_context *ctx, size_t *len);
+char	*cal_context_format_range(struct cal_context *ctx, int day_begin,
+				  int day_end, size_t *len);
+
+#endif
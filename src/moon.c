@@ -40,12 +40,15 @@
  */
 
 #include <math.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "basics.h"
+#include "ephemeris.h"
 #include "gregorian.h"
 #include "moon.h"
 #include "sun.h"
@@ -58,6 +61,51 @@
  */
 const double mean_synodic_month = 29.530588861;
 
+/* Periodic terms of the lunar series, in the structure-of-arrays form */
+struct lunar_terms {
+	size_t		 n;
+	const int	*v;
+	const int	*w;
+	const int	*x;
+	const int	*y;
+	const int	*z;
+};
+
+#define LUNAR_MAX_TERMS		64
+
+static double	lunar_terms_sum(const struct lunar_terms *terms, double D,
+				double M, double M_prime, double F, double E,
+				double phase);
+static double	nth_new_moon_series(int n);
+static double	lunar_longitude_series(double t);
+static double	lunar_latitude_series(double t);
+static double	lunar_distance_series(double t);
+static void	lunar_phase_interval(double phi, double t, double *a,
+				     double *b);
+
+static struct ephemeris lunar_longitude_eph =
+	EPHEMERIS_INIT("lunar_longitude", lunar_longitude_series, true, 8, 16);
+static struct ephemeris lunar_latitude_eph =
+	EPHEMERIS_INIT("lunar_latitude", lunar_latitude_series, false, 8, 16);
+static struct ephemeris lunar_distance_eph =
+	EPHEMERIS_INIT("lunar_distance", lunar_distance_series, false, 8, 16);
+
+/*
+ * Direct-mapped cache of the moments of new moons, keyed by the lunation
+ * number, which covers about 80 years of consecutive lunations.
+ */
+#define NEW_MOON_CACHE_SIZE	1024  /* must be power of 2 */
+
+static struct new_moon_cache_entry {
+	bool	valid;
+	int	n;
+	double	t;
+} new_moon_cache[NEW_MOON_CACHE_SIZE];
+
+static unsigned long new_moon_cache_hits = 0;
+static unsigned long new_moon_cache_misses = 0;
+static pthread_mutex_t new_moon_lock = PTHREAD_MUTEX_INITIALIZER;
+
 
 /*
  * Argument data 1 used by 'nth_new_moon()'.
@@ -126,8 +174,8 @@ static const struct nth_new_moon_arg2 {
  * This function is centered upon January, 2000.
  * Ref: Sec.(14.6), Eq.(14.45)
  */
-double
-nth_new_moon(int n)
+static double
+nth_new_moon_series(int n)
 {
 	int n0 = 24724;  /* Months from RD 0 until j2000 */
 	int k = n - n0;  /* Months since j2000 */
@@ -243,83 +291,119 @@ moon_node(double c)
 }
 
 /*
- * Argument data used by 'lunar_longitude()'.
+ * Same as above, but memoize the results in the cache.
+ */
+double
+nth_new_moon(int n)
+{
+	struct new_moon_cache_entry *e;
+	double t;
+
+	e = &new_moon_cache[(unsigned int)n & (NEW_MOON_CACHE_SIZE - 1)];
+	pthread_mutex_lock(&new_moon_lock);
+	if (e->valid && e->n == n) {
+		new_moon_cache_hits++;
+		t = e->t;
+		pthread_mutex_unlock(&new_moon_lock);
+		return t;
+	}
+	new_moon_cache_misses++;
+	pthread_mutex_unlock(&new_moon_lock);
+
+	/* Computing a lunation twice is cheaper than holding the lock */
+	t = nth_new_moon_series(n);
+
+	pthread_mutex_lock(&new_moon_lock);
+	e->valid = true;
+	e->n = n;
+	e->t = t;
+	pthread_mutex_unlock(&new_moon_lock);
+	return t;
+}
+
+void
+nth_new_moon_show_stats(void)
+{
+	fprintf(stderr, "nth_new_moon: %lu cache hits, %lu misses\n",
+		new_moon_cache_hits, new_moon_cache_misses);
+}
+
+/*
+ * Sum up the periodic terms of the lunar series:
+ *   v * E^|x| * sin(w*D + x*M + y*M' + z*F + phase)
+ * The arguments are evaluated in a batch for 'sin_deg_array()'.
+ */
+static double
+lunar_terms_sum(const struct lunar_terms *terms, double D, double M,
+		double M_prime, double F, double E, double phase)
+{
+	const double epow[3] = { 1.0, E, E * E };
+	double arg[LUNAR_MAX_TERMS] = { 0.0 }, sine[LUNAR_MAX_TERMS];
+	double sum = 0.0;
+	size_t n = terms->n;
+
+	for (size_t i = 0; i < n; i++) {
+		arg[i] = (terms->w[i] * D + terms->x[i] * M +
+			  terms->y[i] * M_prime + terms->z[i] * F + phase);
+	}
+	sin_deg_array(arg, sine, n);
+
+	for (size_t i = 0; i < n; i++)
+		sum += terms->v[i] * epow[abs(terms->x[i])] * sine[i];
+
+	return sum;
+}
+
+/*
+ * Argument data used by 'lunar_longitude()', in the structure-of-arrays form.
  * Ref: Sec.(14.6), Table(14.5)
  */
-static const struct lunar_longitude_arg {
-	int	v;
-	int	w;
-	int	x;
-	int	y;
-	int	z;
-} lunar_longitude_data[] = {
-	{ 6288774, 0,  0,  1,  0 },
-	{ 1274027, 2,  0, -1,  0 },
-	{  658314, 2,  0,  0,  0 },
-	{  213618, 0,  0,  2,  0 },
-	{ -185116, 0,  1,  0,  0 },
-	{ -114332, 0,  0,  0,  2 },
-	{   58793, 2,  0, -2,  0 },
-	{   57066, 2, -1, -1,  0 },
-	{   53322, 2,  0,  1,  0 },
-	{   45758, 2, -1,  0,  0 },
-	{  -40923, 0,  1, -1,  0 },
-	{  -34720, 1,  0,  0,  0 },
-	{  -30383, 0,  1,  1,  0 },
-	{   15327, 2,  0,  0, -2 },
-	{  -12528, 0,  0,  1,  2 },
-	{   10980, 0,  0,  1, -2 },
-	{   10675, 4,  0, -1,  0 },
-	{   10034, 0,  0,  3,  0 },
-	{    8548, 4,  0, -2,  0 },
-	{   -7888, 2,  1, -1,  0 },
-	{   -6766, 2,  1,  0,  0 },
-	{   -5163, 1,  0, -1,  0 },
-	{    4987, 1,  1,  0,  0 },
-	{    4036, 2, -1,  1,  0 },
-	{    3994, 2,  0,  2,  0 },
-	{    3861, 4,  0,  0,  0 },
-	{    3665, 2,  0, -3,  0 },
-	{   -2689, 0,  1, -2,  0 },
-	{   -2602, 2,  0, -1,  2 },
-	{    2390, 2, -1, -2,  0 },
-	{   -2348, 1,  0,  1,  0 },
-	{    2236, 2, -2,  0,  0 },
-	{   -2120, 0,  1,  2,  0 },
-	{   -2069, 0,  2,  0,  0 },
-	{    2048, 2, -2, -1,  0 },
-	{   -1773, 2,  0,  1, -2 },
-	{   -1595, 2,  0,  0,  2 },
-	{    1215, 4, -1, -1,  0 },
-	{   -1110, 0,  0,  2,  2 },
-	{    -892, 3,  0, -1,  0 },
-	{    -810, 2,  1,  1,  0 },
-	{     759, 4, -1, -2,  0 },
-	{    -713, 0,  2, -1,  0 },
-	{    -700, 2,  2, -1,  0 },
-	{     691, 2,  1, -2,  0 },
-	{     596, 2, -1,  0, -2 },
-	{     549, 4,  0,  1,  0 },
-	{     537, 0,  0,  4,  0 },
-	{     520, 4, -1,  0,  0 },
-	{    -487, 1,  0, -2,  0 },
-	{    -399, 2,  1,  0, -2 },
-	{    -381, 0,  0,  2, -2 },
-	{     351, 1,  1,  1,  0 },
-	{    -340, 3,  0, -2,  0 },
-	{     330, 4,  0, -3,  0 },
-	{     327, 2, -1,  2,  0 },
-	{    -323, 0,  2,  1,  0 },
-	{     299, 1,  1, -1,  0 },
-	{     294, 2,  0,  3,  0 },
+static const int lunar_longitude_v[] = {
+	6288774, 1274027,  658314,  213618, -185116, -114332,   58793,   57066,
+	  53322,   45758,  -40923,  -34720,  -30383,   15327,  -12528,   10980,
+	  10675,   10034,    8548,   -7888,   -6766,   -5163,    4987,    4036,
+	   3994,    3861,    3665,   -2689,   -2602,    2390,   -2348,    2236,
+	  -2120,   -2069,    2048,   -1773,   -1595,    1215,   -1110,    -892,
+	   -810,     759,    -713,    -700,     691,     596,     549,     537,
+	    520,    -487,    -399,    -381,     351,    -340,     330,     327,
+	   -323,     299,     294,
+};
+static const int lunar_longitude_w[] = {
+	0, 2, 2, 0, 0, 0, 2, 2, 2, 2, 0, 1, 0, 2, 0,
+	0, 4, 0, 4, 2, 2, 1, 1, 2, 2, 4, 2, 0, 2, 2,
+	1, 2, 0, 0, 2, 2, 2, 4, 0, 3, 2, 4, 0, 2, 2,
+	2, 4, 0, 4, 1, 2, 0, 1, 3, 4, 2, 0, 1, 2,
+};
+static const int lunar_longitude_x[] = {
+	 0,  0,  0,  0,  1,  0,  0, -1,  0, -1,  1,  0,  1,  0,  0,
+	 0,  0,  0,  0,  1,  1,  0,  1, -1,  0,  0,  0,  1,  0, -1,
+	 0, -2,  1,  2, -2,  0,  0, -1,  0,  0,  1, -1,  2,  2,  1,
+	-1,  0,  0, -1,  0,  1,  0,  1,  0,  0, -1,  2,  1,  0,
+};
+static const int lunar_longitude_y[] = {
+	 1, -1,  0,  2,  0,  0, -2, -1,  1,  0, -1,  0,  1,  0,  1,
+	 1, -1,  3, -2, -1,  0, -1,  0,  1,  2,  0, -3, -2, -1, -2,
+	 1,  0,  2,  0, -1,  1,  0, -1,  2, -1,  1, -2, -1, -1, -2,
+	 0,  1,  4,  0, -2,  0,  2,  1, -2, -3,  2,  1, -1,  3,
+};
+static const int lunar_longitude_z[] = {
+	 0,  0,  0,  0,  0,  2,  0,  0,  0,  0,  0,  0,  0, -2,  2,
+	-2,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  2,  0,
+	 0,  0,  0,  0,  0, -2,  2,  0,  2,  0,  0,  0,  0,  0,  0,
+	-2,  0,  0,  0,  0, -2, -2,  0,  0,  0,  0,  0,  0,  0,
+};
+static const struct lunar_terms lunar_longitude_terms = {
+	nitems(lunar_longitude_v), lunar_longitude_v,
+	lunar_longitude_w, lunar_longitude_x,
+	lunar_longitude_y, lunar_longitude_z,
 };
 
 /*
  * Calculate the geocentric longitude of moon (in degrees) at moment $t.
  * Ref: Sec.(14.6), Eq.(14.48)
  */
-double
-lunar_longitude(double t)
+static double
+lunar_longitude_series(double t)
 {
 	double c = julian_centuries(t);
 	double nu = nutation(t);
@@ -331,16 +415,8 @@ lunar_longitude(double t)
 	double F = moon_node(c);
 	double E = 1.0 - 0.002516 * c - 0.0000074 * c*c;
 
-	double sum = 0.0;
-	const struct lunar_longitude_arg *arg;
-	for (size_t i = 0; i < nitems(lunar_longitude_data); i++) {
-		arg = &lunar_longitude_data[i];
-		sum += arg->v * pow(E, abs(arg->x)) * sin_deg(
-				arg->w * D +
-				arg->x * M +
-				arg->y * M_prime +
-				arg->z * F);
-	}
+	double sum = lunar_terms_sum(&lunar_longitude_terms,
+				     D, M, M_prime, F, E, 0.0);
 	double correction = sum / 1e6;
 
 	double venus = sin_deg(119.75 + 131.849 * c) * 3958 / 1e6;
@@ -352,76 +428,60 @@ lunar_longitude(double t)
 }
 
 /*
- * Argument data used by 'lunar_latitude()'.
+ * Same as above, but use the tabulated ephemeris if it covers $t.
+ */
+double
+lunar_longitude(double t)
+{
+	double lambda;
+
+	if (ephemeris_eval(&lunar_longitude_eph, t, &lambda))
+		return lambda;
+	return lunar_longitude_series(t);
+}
+
+/*
+ * Argument data used by 'lunar_latitude()', in the structure-of-arrays form.
  * Ref: Sec.(14.6), Table(14.6)
  */
-static const struct lunar_latitude_arg {
-	int	v;
-	int	w;
-	int	x;
-	int	y;
-	int	z;
-} lunar_latitude_data[] = {
-	{ 5128122, 0,  0,  0,  1 },
-	{  280602, 0,  0,  1,  1 },
-	{  277693, 0,  0,  1, -1 },
-	{  173237, 2,  0,  0, -1 },
-	{   55413, 2,  0, -1,  1 },
-	{   46271, 2,  0, -1, -1 },
-	{   32573, 2,  0,  0,  1 },
-	{   17198, 0,  0,  2,  1 },
-	{    9266, 2,  0,  1, -1 },
-	{    8822, 0,  0,  2, -1 },
-	{    8216, 2, -1,  0, -1 },
-	{    4324, 2,  0, -2, -1 },
-	{    4200, 2,  0,  1,  1 },
-	{   -3359, 2,  1,  0, -1 },
-	{    2463, 2, -1, -1,  1 },
-	{    2211, 2, -1,  0,  1 },
-	{    2065, 2, -1, -1, -1 },
-	{   -1870, 0,  1, -1, -1 },
-	{    1828, 4,  0, -1, -1 },
-	{   -1794, 0,  1,  0,  1 },
-	{   -1749, 0,  0,  0,  3 },
-	{   -1565, 0,  1, -1,  1 },
-	{   -1491, 1,  0,  0,  1 },
-	{   -1475, 0,  1,  1,  1 },
-	{   -1410, 0,  1,  1, -1 },
-	{   -1344, 0,  1,  0, -1 },
-	{   -1335, 1,  0,  0, -1 },
-	{    1107, 0,  0,  3,  1 },
-	{    1021, 4,  0,  0, -1 },
-	{     833, 4,  0, -1,  1 },
-	{     777, 0,  0,  1, -3 },
-	{     671, 4,  0, -2,  1 },
-	{     607, 2,  0,  0, -3 },
-	{     596, 2,  0,  2, -1 },
-	{     491, 2, -1,  1, -1 },
-	{    -451, 2,  0, -2,  1 },
-	{     439, 0,  0,  3, -1 },
-	{     422, 2,  0,  2,  1 },
-	{     421, 2,  0, -3, -1 },
-	{    -366, 2,  1, -1,  1 },
-	{    -351, 2,  1,  0,  1 },
-	{     331, 4,  0,  0,  1 },
-	{     315, 2, -1,  1,  1 },
-	{     302, 2, -2,  0, -1 },
-	{    -283, 0,  0,  1,  3 },
-	{    -229, 2,  1,  1, -1 },
-	{     223, 1,  1,  0, -1 },
-	{     223, 1,  1,  0,  1 },
-	{    -220, 0,  1, -2, -1 },
-	{    -220, 2,  1, -1, -1 },
-	{    -185, 1,  0,  1,  1 },
-	{     181, 2, -1, -2, -1 },
-	{    -177, 0,  1,  2,  1 },
-	{     176, 4,  0, -2, -1 },
-	{     166, 4, -1, -1, -1 },
-	{    -164, 1,  0,  1, -1 },
-	{     132, 4,  0,  1, -1 },
-	{    -119, 1,  0, -1, -1 },
-	{     115, 4, -1,  0, -1 },
-	{     107, 2, -2,  0,  1 },
+static const int lunar_latitude_v[] = {
+	5128122,  280602,  277693,  173237,   55413,   46271,   32573,   17198,
+	   9266,    8822,    8216,    4324,    4200,   -3359,    2463,    2211,
+	   2065,   -1870,    1828,   -1794,   -1749,   -1565,   -1491,   -1475,
+	  -1410,   -1344,   -1335,    1107,    1021,     833,     777,     671,
+	    607,     596,     491,    -451,     439,     422,     421,    -366,
+	   -351,     331,     315,     302,    -283,    -229,     223,     223,
+	   -220,    -220,    -185,     181,    -177,     176,     166,    -164,
+	    132,    -119,     115,     107,
+};
+static const int lunar_latitude_w[] = {
+	0, 0, 0, 2, 2, 2, 2, 0, 2, 0, 2, 2, 2, 2, 2,
+	2, 2, 0, 4, 0, 0, 0, 1, 0, 0, 0, 1, 0, 4, 4,
+	0, 4, 2, 2, 2, 2, 0, 2, 2, 2, 2, 4, 2, 2, 0,
+	2, 1, 1, 0, 2, 1, 2, 0, 4, 4, 1, 4, 1, 4, 2,
+};
+static const int lunar_latitude_x[] = {
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0, -1,  0,  0,  1, -1,
+	-1, -1,  1,  0,  1,  0,  1,  0,  1,  1,  1,  0,  0,  0,  0,
+	 0,  0,  0,  0, -1,  0,  0,  0,  0,  1,  1,  0, -1, -2,  0,
+	 1,  1,  1,  1,  1,  0, -1,  1,  0, -1,  0,  0,  0, -1, -2,
+};
+static const int lunar_latitude_y[] = {
+	 0,  1,  1,  0, -1, -1,  0,  2,  1,  2,  0, -2,  1,  0, -1,
+	 0, -1, -1, -1,  0,  0, -1,  0,  1,  1,  0,  0,  3,  0, -1,
+	 1, -2,  0,  2,  1, -2,  3,  2, -3, -1,  0,  0,  1,  0,  1,
+	 1,  0,  0, -2, -1,  1, -2,  2, -2, -1,  1,  1, -1,  0,  0,
+};
+static const int lunar_latitude_z[] = {
+	 1,  1, -1, -1,  1, -1,  1,  1, -1, -1, -1, -1,  1, -1,  1,
+	 1, -1, -1, -1,  1,  3,  1,  1,  1, -1, -1, -1,  1, -1,  1,
+	-3,  1, -3, -1, -1,  1, -1,  1, -1,  1,  1,  1,  1, -1,  3,
+	-1, -1,  1, -1, -1,  1, -1,  1, -1, -1, -1, -1, -1, -1,  1,
+};
+static const struct lunar_terms lunar_latitude_terms = {
+	nitems(lunar_latitude_v), lunar_latitude_v,
+	lunar_latitude_w, lunar_latitude_x,
+	lunar_latitude_y, lunar_latitude_z,
 };
 
 /*
@@ -429,8 +489,8 @@ static const struct lunar_latitude_arg {
  * Lunar latitude ranges from about -6 to 6 degress.
  * Ref: Sec.(14.6), Eq.(14.63)
  */
-double
-lunar_latitude(double t)
+static double
+lunar_latitude_series(double t)
 {
 	double c = julian_centuries(t);
 
@@ -441,16 +501,8 @@ lunar_latitude(double t)
 	double F = moon_node(c);
 	double E = 1.0 - 0.002516 * c - 0.0000074 * c*c;
 
-	double sum = 0.0;
-	const struct lunar_latitude_arg *arg;
-	for (size_t i = 0; i < nitems(lunar_latitude_data); i++) {
-		arg = &lunar_latitude_data[i];
-		sum += arg->v * pow(E, abs(arg->x)) * sin_deg(
-				arg->w * D +
-				arg->x * M +
-				arg->y * M_prime +
-				arg->z * F);
-	}
+	double sum = lunar_terms_sum(&lunar_latitude_terms,
+				     D, M, M_prime, F, E, 0.0);
 	double beta = sum / 1e6;
 
 	double venus = (sin_deg(119.75 + 131.849 * c + F) +
@@ -464,84 +516,70 @@ lunar_latitude(double t)
 }
 
 /*
- * Argument data used by 'lunar_distance()'.
+ * Same as above, but use the tabulated ephemeris if it covers $t.
+ */
+double
+lunar_latitude(double t)
+{
+	double beta;
+
+	if (ephemeris_eval(&lunar_latitude_eph, t, &beta))
+		return beta;
+	return lunar_latitude_series(t);
+}
+
+/*
+ * Argument data used by 'lunar_distance()', in the structure-of-arrays form.
  * Ref: Sec.(14.6), Table(14.7)
  */
-static const struct lunar_distance_arg {
-	int	v;
-	int	w;
-	int	x;
-	int	y;
-	int	z;
-} lunar_distance_data[] = {
-	{ -20905355, 0,  0,  1,  0 },
-	{  -3699111, 2,  0, -1,  0 },
-	{  -2955968, 2,  0,  0,  0 },
-	{   -569925, 0,  0,  2,  0 },
-	{     48888, 0,  1,  0,  0 },
-	{     -3149, 0,  0,  0,  2 },
-	{    246158, 2,  0, -2,  0 },
-	{   -152138, 2, -1, -1,  0 },
-	{   -170733, 2,  0,  1,  0 },
-	{   -204586, 2, -1,  0,  0 },
-	{   -129620, 0,  1, -1,  0 },
-	{    108743, 1,  0,  0,  0 },
-	{    104755, 0,  1,  1,  0 },
-	{     10321, 2,  0,  0, -2 },
-	{         0, 0,  0,  1,  2 },
-	{     79661, 0,  0,  1, -2 },
-	{    -34782, 4,  0, -1,  0 },
-	{    -23210, 0,  0,  3,  0 },
-	{    -21636, 4,  0, -2,  0 },
-	{     24208, 2,  1, -1,  0 },
-	{     30824, 2,  1,  0,  0 },
-	{     -8379, 1,  0, -1,  0 },
-	{    -16675, 1,  1,  0,  0 },
-	{    -12831, 2, -1,  1,  0 },
-	{    -10445, 2,  0,  2,  0 },
-	{    -11650, 4,  0,  0,  0 },
-	{     14403, 2,  0, -3,  0 },
-	{     -7003, 0,  1, -2,  0 },
-	{         0, 2,  0, -1,  2 },
-	{     10056, 2, -1, -2,  0 },
-	{      6322, 1,  0,  1,  0 },
-	{     -9884, 2, -2,  0,  0 },
-	{      5751, 0,  1,  2,  0 },
-	{         0, 0,  2,  0,  0 },
-	{     -4950, 2, -2, -1,  0 },
-	{      4130, 2,  0,  1, -2 },
-	{         0, 2,  0,  0,  2 },
-	{     -3958, 4, -1, -1,  0 },
-	{         0, 0,  0,  2,  2 },
-	{      3258, 3,  0, -1,  0 },
-	{      2616, 2,  1,  1,  0 },
-	{     -1897, 4, -1, -2,  0 },
-	{     -2117, 0,  2, -1,  0 },
-	{      2354, 2,  2, -1,  0 },
-	{         0, 2,  1, -2,  0 },
-	{         0, 2, -1,  0, -2 },
-	{     -1423, 4,  0,  1,  0 },
-	{     -1117, 0,  0,  4,  0 },
-	{     -1571, 4, -1,  0,  0 },
-	{     -1739, 1,  0, -2,  0 },
-	{         0, 2,  1,  0, -2 },
-	{     -4421, 0,  0,  2, -2 },
-	{         0, 1,  1,  1,  0 },
-	{         0, 3,  0, -2,  0 },
-	{         0, 4,  0, -3,  0 },
-	{         0, 2, -1,  2,  0 },
-	{      1165, 0,  2,  1,  0 },
-	{         0, 1,  1, -1,  0 },
-	{         0, 2,  0,  3,  0 },
-	{      8752, 2,  0, -1, -2 },
+static const int lunar_distance_v[] = {
+	-20905355,  -3699111,  -2955968,   -569925,     48888,     -3149,
+	   246158,   -152138,   -170733,   -204586,   -129620,    108743,
+	   104755,     10321,         0,     79661,    -34782,    -23210,
+	   -21636,     24208,     30824,     -8379,    -16675,    -12831,
+	   -10445,    -11650,     14403,     -7003,         0,     10056,
+	     6322,     -9884,      5751,         0,     -4950,      4130,
+	        0,     -3958,         0,      3258,      2616,     -1897,
+	    -2117,      2354,         0,         0,     -1423,     -1117,
+	    -1571,     -1739,         0,     -4421,         0,         0,
+	        0,         0,      1165,         0,         0,      8752,
+};
+static const int lunar_distance_w[] = {
+	0, 2, 2, 0, 0, 0, 2, 2, 2, 2, 0, 1, 0, 2, 0,
+	0, 4, 0, 4, 2, 2, 1, 1, 2, 2, 4, 2, 0, 2, 2,
+	1, 2, 0, 0, 2, 2, 2, 4, 0, 3, 2, 4, 0, 2, 2,
+	2, 4, 0, 4, 1, 2, 0, 1, 3, 4, 2, 0, 1, 2, 2,
+};
+static const int lunar_distance_x[] = {
+	 0,  0,  0,  0,  1,  0,  0, -1,  0, -1,  1,  0,  1,  0,  0,
+	 0,  0,  0,  0,  1,  1,  0,  1, -1,  0,  0,  0,  1,  0, -1,
+	 0, -2,  1,  2, -2,  0,  0, -1,  0,  0,  1, -1,  2,  2,  1,
+	-1,  0,  0, -1,  0,  1,  0,  1,  0,  0, -1,  2,  1,  0,  0,
+};
+static const int lunar_distance_y[] = {
+	 1, -1,  0,  2,  0,  0, -2, -1,  1,  0, -1,  0,  1,  0,  1,
+	 1, -1,  3, -2, -1,  0, -1,  0,  1,  2,  0, -3, -2, -1, -2,
+	 1,  0,  2,  0, -1,  1,  0, -1,  2, -1,  1, -2, -1, -1, -2,
+	 0,  1,  4,  0, -2,  0,  2,  1, -2, -3,  2,  1, -1,  3, -1,
+};
+static const int lunar_distance_z[] = {
+	 0,  0,  0,  0,  0,  2,  0,  0,  0,  0,  0,  0,  0, -2,  2,
+	-2,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  2,  0,
+	 0,  0,  0,  0,  0, -2,  2,  0,  2,  0,  0,  0,  0,  0,  0,
+	-2,  0,  0,  0,  0, -2, -2,  0,  0,  0,  0,  0,  0,  0, -2,
+};
+static const struct lunar_terms lunar_distance_terms = {
+	nitems(lunar_distance_v), lunar_distance_v,
+	lunar_distance_w, lunar_distance_x,
+	lunar_distance_y, lunar_distance_z,
 };
 
 /*
  * Calculate the distance to moon (in meters) at moment $t.
  * Ref: Sec.(14.6), Eq.(14.65)
  */
-double
-lunar_distance(double t)
+static double
+lunar_distance_series(double t)
 {
 	double c = julian_centuries(t);
 
@@ -551,20 +589,25 @@ lunar_distance(double t)
 	double F = moon_node(c);
 	double E = 1.0 - 0.002516 * c - 0.0000074 * c*c;
 
-	double correction = 0.0;
-	const struct lunar_distance_arg *arg;
-	for (size_t i = 0; i < nitems(lunar_distance_data); i++) {
-		arg = &lunar_distance_data[i];
-		correction += arg->v * pow(E, abs(arg->x)) * cos_deg(
-				arg->w * D +
-				arg->x * M +
-				arg->y * M_prime +
-				arg->z * F);
-	}
+	double correction = lunar_terms_sum(&lunar_distance_terms,
+					    D, M, M_prime, F, E, 90.0);
 
 	return 385000560.0 + correction;
 }
 
+/*
+ * Same as above, but use the tabulated ephemeris if it covers $t.
+ */
+double
+lunar_distance(double t)
+{
+	double distance;
+
+	if (ephemeris_eval(&lunar_distance_eph, t, &distance))
+		return distance;
+	return lunar_distance_series(t);
+}
+
 /*
  * Calculate the altitude of moon (in degrees) above the horizon at
  * location ($latitude, $longitude) and moment $t, ignoring parallax
@@ -650,6 +693,22 @@ lunar_phase(double t)
 	return (fabs(phi - phi2) > 180) ? phi2 : phi;
 }
 
+/*
+ * Estimate the interval [$a, $b] to search for the next time at or after
+ * the given moment $t when the phase of the moon is $phi degree.
+ */
+static void
+lunar_phase_interval(double phi, double t, double *a, double *b)
+{
+	double rate = mean_synodic_month / 360.0;
+	double phase = lunar_phase(t);
+	double tau = t + rate * mod_f(phi - phase, 360);
+
+	/* estimate range (within 2 days) */
+	*a = (t > tau - 2) ? t : tau - 2;
+	*b = tau + 2;
+}
+
 /*
  * Calculate the moment of the next time at or after the given moment $t
  * when the phase of the moon is $phi degree.
@@ -659,14 +718,10 @@ double
 lunar_phase_atafter(double phi, double t)
 {
 	double rate = mean_synodic_month / 360.0;
-	double phase = lunar_phase(t);
-	double tau = t + rate * mod_f(phi - phase, 360);
-
-	/* estimate range (within 2 days) */
-	double a = (t > tau - 2) ? t : tau - 2;
-	double b = tau + 2;
+	double a, b;
 
-	return invert_angular(lunar_phase, phi, a, b);
+	lunar_phase_interval(phi, t, &a, &b);
+	return invert_angular_secant(lunar_phase, phi, a, b, rate);
 }
 
 /*
@@ -710,6 +765,156 @@ new_moon_atafter(double t)
 	return t1;
 }
 
+/*
+ * List of the principal lunar phases in time order, which is enumerated
+ * lunation by lunation and then shared by all the lookups within the
+ * covered range and phases (e.g., all the 'NewMoon' and 'FullMoon'
+ * entries, and the '-s moon' information).
+ */
+static struct {
+	struct lunar_event *events;
+	size_t	count;
+	double	t_begin;
+	double	t_end;
+	unsigned int phases;	/* LUNAR_PHASE_BIT() of the listed phases */
+} lunar_list;
+static pthread_mutex_t lunar_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Get the principal lunar phases of $phases (a mask of LUNAR_PHASE_BIT())
+ * in range [$t_begin, $t_end) in time order, and return their number.
+ * The events are copied into the allocated $events, which the caller
+ * should free.  The list may also contain the other phases, so the caller
+ * should check the phase of each event.  The list is built for the first
+ * request, and only rebuilt when a later request goes beyond its range or
+ * phases, because the quarters cost a search each while the new moons
+ * are cheap.  Other threads may keep looking up the old list while the
+ * new one is being built, which is only swapped in at the end.
+ */
+size_t
+lunar_events(double t_begin, double t_end, unsigned int phases,
+	     struct lunar_event **events)
+{
+	struct lunar_event *list;
+	double rate = mean_synodic_month / 360.0;
+	double t_min, t_max, t, phi, a, b, t_lo, t_hi;
+	size_t count, cap, lo, hi, mid;
+	int n;
+
+	pthread_mutex_lock(&lunar_lock);
+	if (lunar_list.events == NULL ||
+	    t_begin < lunar_list.t_begin || t_end > lunar_list.t_end ||
+	    (phases & ~lunar_list.phases) != 0) {
+		t_min = t_begin;
+		t_max = t_end;
+		if (lunar_list.events != NULL) {
+			t_min = fmin(t_min, lunar_list.t_begin);
+			t_max = fmax(t_max, lunar_list.t_end);
+			phases |= lunar_list.phases;
+		}
+		pthread_mutex_unlock(&lunar_lock);
+
+		list = NULL;
+		count = cap = 0;
+		n = (int)floor((t_min - nth_new_moon(0)) /
+			       mean_synodic_month) - 1;
+		for (t = nth_new_moon(n); t < t_max; t = nth_new_moon(++n)) {
+			for (int phase = LUNAR_NEW_MOON;
+			     phase <= LUNAR_LAST_QUARTER;
+			     phase++) {
+				if ((phases & LUNAR_PHASE_BIT(phase)) == 0)
+					continue;
+				t_lo = t_hi = t;
+				if (phase != LUNAR_NEW_MOON) {
+					phi = 90.0 * phase;
+					lunar_phase_interval(phi, t, &a, &b);
+					t_lo = a;
+					t_hi = b;
+					invert_angular_bracket(lunar_phase,
+							       phi, rate,
+							       &t_lo, &t_hi);
+					t = invert_angular_replay(lunar_phase,
+								  phi, a, b,
+								  t_lo, t_hi);
+				}
+				if (t < t_min || t >= t_max)
+					continue;
+
+				if (count == cap) {
+					cap = (cap > 0) ? cap * 2 : 64;
+					list = xrealloc(list,
+							cap * sizeof(*list));
+				}
+				list[count].t = t;
+				list[count].lo = t_lo;
+				list[count].hi = t_hi;
+				list[count].phase = phase;
+				count++;
+			}
+		}
+
+		pthread_mutex_lock(&lunar_lock);
+		free(lunar_list.events);
+		lunar_list.events = list;
+		lunar_list.count = count;
+		lunar_list.t_begin = t_min;
+		lunar_list.t_end = t_max;
+		lunar_list.phases = phases;
+	}
+
+	/* Find the first event at or after $t_begin */
+	lo = 0;
+	hi = lunar_list.count;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (lunar_list.events[mid].t < t_begin)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (hi = lo; hi < lunar_list.count; hi++) {
+		if (lunar_list.events[hi].t >= t_end)
+			break;
+	}
+
+	count = hi - lo;
+	*events = NULL;
+	if (count > 0) {
+		/* fail after releasing the lock */
+		*events = malloc(count * sizeof(**events));
+		if (*events != NULL) {
+			memcpy(*events, lunar_list.events + lo,
+			       count * sizeof(**events));
+		}
+	}
+	pthread_mutex_unlock(&lunar_lock);
+	if (count > 0 && *events == NULL)
+		fatal("%s: out of memory", __func__);
+
+	return count;
+}
+
+/*
+ * Same as 'lunar_phase_atafter()' for the phase of the given $event from
+ * 'lunar_events()', but the search is replayed against the bracket of the
+ * event, so that it only costs the estimate of the search interval.  The
+ * result therefore depends on $t exactly as that of 'lunar_phase_atafter()'
+ * does.  A new moon is not searched, so its moment is just returned.
+ */
+double
+lunar_event_atafter(const struct lunar_event *event, double t)
+{
+	double phi, a, b;
+
+	if (event->phase == LUNAR_NEW_MOON)
+		return event->t;
+
+	phi = 90.0 * event->phase;
+	lunar_phase_interval(phi, t, &a, &b);
+	return invert_angular_replay(lunar_phase, phi, a, b,
+				     event->lo, event->hi);
+}
+
 /*
  * Calculate the moment of moonrise in standard time on fixed date $rd
  * at location $loc.
@@ -893,30 +1098,30 @@ show_moon_info(double t, const struct location *loc)
 	printf("%19s   %19s   %19s   %19s\n",
 	       "New Moon", "First Quarter", "Full Moon", "Last Quarter");
 
-	double t_newmoon = t_begin;
-	while ((t_newmoon = new_moon_atafter(t_newmoon)) < t_end) {
-		t_newmoon += loc->zone;  /* to standard time */
-		gregorian_from_fixed((int)floor(t_newmoon), &date);
-		format_time(buf, sizeof(buf), t_newmoon);
-		printf("%d-%02d-%02d %s",
-		       date.year, date.month, date.day, buf);
+	/* Include the quarters following the last new moon of the year */
+	struct lunar_event *events;
+	size_t count = lunar_events(t_begin, t_end + mean_synodic_month,
+				    LUNAR_PHASES_ALL, &events);
+	for (size_t i = 0; i < count; i++) {
+		if (events[i].phase != LUNAR_NEW_MOON)
+			continue;
+		if (events[i].t >= t_end)
+			break;
 
 		/*
-		 * first quarter, full moon, last quarter
+		 * new moon, first quarter, full moon, last quarter; each
+		 * quarter is searched from the previous event
 		 */
-		double t_event = t_newmoon;
-		int phi_events[] = { 90, 180, 270 };
-		for (size_t i = 0; i < nitems(phi_events); i++) {
-			t_event = lunar_phase_atafter(phi_events[i], t_event);
-			t_event += loc->zone;
+		double t_event = events[i].t;
+		for (size_t j = i; j < count && j < i + 4; j++) {
+			t_event = lunar_event_atafter(&events[j], t_event);
+			t_event += loc->zone;  /* to standard time */
 			gregorian_from_fixed((int)floor(t_event), &date);
 			format_time(buf, sizeof(buf), t_event);
-			printf("   %d-%02d-%02d %s",
+			printf("%s%d-%02d-%02d %s", (j == i) ? "" : "   ",
 			       date.year, date.month, date.day, buf);
 		}
 		printf("\n");
-
-		/* go to the next new moon */
-		t_newmoon += 28;
 	}
+	free(events);
 }
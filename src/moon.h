@@ -37,10 +37,32 @@
 #ifndef MOON_H_
 #define MOON_H_
 
+#include <stddef.h>
+
 #include "basics.h"
 
 extern const double mean_synodic_month;
 
+/*
+ * Principal phases of the moon, in the order of a lunation
+ */
+enum {
+	LUNAR_NEW_MOON,
+	LUNAR_FIRST_QUARTER,
+	LUNAR_FULL_MOON,
+	LUNAR_LAST_QUARTER,
+};
+
+#define LUNAR_PHASE_BIT(phase)	(1U << (phase))
+#define LUNAR_PHASES_ALL	0xFU
+
+struct lunar_event {
+	double	t;	/* moment in universal time */
+	double	lo;	/* bracket of the moment of a quarter */
+	double	hi;	/* (see 'invert_angular_bracket()') */
+	int	phase;	/* LUNAR_* */
+};
+
 double	lunar_distance(double t);
 double	lunar_latitude(double t);
 double	lunar_longitude(double t);
@@ -53,6 +75,10 @@ double	lunar_phase_atafter(double phi, double t);
 double	new_moon_atafter(double t);
 double	new_moon_before(double t);
 double	nth_new_moon(int n);
+size_t	lunar_events(double t_begin, double t_end, unsigned int phases,
+		     struct lunar_event **events);
+double	lunar_event_atafter(const struct lunar_event *event, double t);
+void	nth_new_moon_show_stats(void);
 
 double	moonrise(int rd, const struct location *loc);
 double	moonset(int rd, const struct location *loc);
@@ -33,12 +33,16 @@
  * SUCH DAMAGE.
  */
 
-#include <ctype.h>
 #include <err.h>
+#include <langinfo.h>
+#include <locale.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <wchar.h>
+#include <wctype.h>
 
 #include "calendar.h"
 #include "nnames.h"
@@ -54,7 +58,7 @@
 	  NULL, 0, NULL, 0 }
 
 /* names of every day of week */
-struct nname dow_names[NDOWS+1] = {
+const struct nname dow_names[NDOWS+1] = {
 	NNAME_INIT2(0, "Sun", "Sunday"),
 	NNAME_INIT2(1, "Mon", "Monday"),
 	NNAME_INIT2(2, "Tue", "Tuesday"),
@@ -66,7 +70,7 @@ struct nname dow_names[NDOWS+1] = {
 };
 
 /* names of every month */
-struct nname month_names[NMONTHS+1] = {
+const struct nname month_names[NMONTHS+1] = {
 	NNAME_INIT2(1, "Jan", "January"),
 	NNAME_INIT2(2, "Feb", "February"),
 	NNAME_INIT2(3, "Mar", "March"),
@@ -83,7 +87,7 @@ struct nname month_names[NMONTHS+1] = {
 };
 
 /* names of every sequence */
-struct nname sequence_names[NSEQUENCES+1] = {
+const struct nname sequence_names[NSEQUENCES+1] = {
 	NNAME_INIT1(1, "First"),
 	NNAME_INIT1(2, "Second"),
 	NNAME_INIT1(3, "Third"),
@@ -93,60 +97,290 @@ struct nname sequence_names[NSEQUENCES+1] = {
 	NNAME_INIT0,
 };
 
+/*
+ * Trie of the case-folded names of a table, to match a string against
+ * all the names in a single pass.  The names are matched character by
+ * character, each case-folded with towlower(3) in the locale, so that the
+ * national names in a multibyte (e.g., UTF-8) locale are matched
+ * case-insensitively as well (e.g., "ПЕРВЫЙ" and "Первый").  Every node
+ * ending a name keeps the rank of the name in the order they were checked
+ * one by one (i.e., for each entry in the table: full national name,
+ * short national name, full name and short name), so that the same name
+ * wins when several names match.
+ */
+struct trie_node {
+	int	child;		/* index of the first child; 0 if none */
+	int	sibling;	/* index of the next sibling; 0 if none */
+	int	rank;		/* rank of the name ending here; -1 if none */
+	int	value;		/* value of the name ending here */
+	wint_t	ch;		/* case-folded character */
+};
 
-void
-set_nnames(void)
+/*
+ * National names and date order of a locale, which are set up only once
+ * when the locale is first used, so that switching back and forth among
+ * the locales (e.g., by the 'LANG' variable in the calendar files) just
+ * switches the locale object.  A locale is never changed once set up, so
+ * it's shared by all the calendar contexts.
+ */
+struct nlocale {
+	struct nlocale	*next;
+	char		*name;		/* locale name */
+	bool		 is_default;	/* locale of the environment */
+	locale_t	 loc;		/* (locale_t)0 if unavailable */
+	bool		 day_first;	/* day before month in the dates */
+	struct nname	 dows[NDOWS+1];	/* names with the national ones */
+	struct nname	 months[NMONTHS+1];
+	struct nname_trie dow_trie;
+	struct nname_trie month_trie;
+};
+
+static struct nlocale *nlocales;	/* cached locales */
+static pthread_mutex_t nlocale_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const struct nlocale *nlocale_get(const char *name);
+static const struct nlocale *names_nlocale(struct cal_names *names);
+static struct nlocale *nlocale_new(const char *name);
+static void	nlocale_free(struct nlocale *nl);
+static bool	locale_day_first(locale_t loc);
+static void	nname_set_national(struct nname *dst, const struct nname *src,
+				   const char *n_name, const char *fn_name);
+
+static const struct nname_trie *names_trie(struct cal_names *names,
+					   int table);
+static void	trie_build(struct nname_trie *trie, int table,
+			   const struct nname *names, locale_t loc);
+static void	trie_insert(struct nname_trie *trie, const char *name,
+			    int rank, int value, locale_t loc);
+static int	trie_new_node(struct nname_trie *trie, wint_t ch);
+static size_t	trie_fold(const char *s, mbstate_t *state, locale_t loc,
+			  wint_t *ch);
+static const struct trie_node *trie_walk(const struct nname_trie *trie,
+					 const char *s, size_t *len,
+					 locale_t loc);
+
+
+/*
+ * Switch the names $names to locale $name, or the default locale (i.e.,
+ * as set by the environment) if $name is NULL, for the national names of
+ * the days of week and months.  Return false if the locale is unavailable,
+ * and then the current locale is kept.
+ */
+bool
+set_nlocale(struct cal_names *names, const char *name)
 {
-	char buf[64];
+	const struct nlocale *nl;
+
+	nl = nlocale_get(name);
+	if (nl->loc == (locale_t)0)
+		return false;
+	if (nl == names->nlocale)
+		return true;
+
+	names->nlocale = nl;
+	/* The sequence names are case-folded in the locale */
+	names->seq_trie.dirty = true;
+	DPRINTF("%s: switched to locale '%s' (day_first=%s)\n", __func__,
+		nl->name, nl->day_first ? "true" : "false");
+	return true;
+}
+
+/*
+ * Get the cached locale $name (or the default one if NULL), which is set
+ * up without holding the lock, and the first one cached wins.
+ */
+static const struct nlocale *
+nlocale_get(const char *name)
+{
+	struct nlocale *nl, *newnl;
+
+	newnl = NULL;
+	for (;;) {
+		pthread_mutex_lock(&nlocale_lock);
+		for (nl = nlocales; nl != NULL; nl = nl->next) {
+			if (name == NULL ? nl->is_default :
+			    (!nl->is_default && strcmp(nl->name, name) == 0))
+				break;
+		}
+		if (nl == NULL && newnl != NULL) {
+			newnl->next = nlocales;
+			nlocales = nl = newnl;
+			newnl = NULL;
+		}
+		pthread_mutex_unlock(&nlocale_lock);
+
+		if (nl != NULL)
+			break;
+		newnl = nlocale_new(name);
+	}
+
+	if (newnl != NULL)
+		nlocale_free(newnl);
+	return nl;
+}
+
+static const struct nlocale *
+names_nlocale(struct cal_names *names)
+{
+	if (names->nlocale == NULL)
+		set_nlocale(names, NULL);
+	return names->nlocale;
+}
+
+/*
+ * Name of the current locale.
+ */
+const char *
+nlocale_name(struct cal_names *names)
+{
+	return names_nlocale(names)->name;
+}
+
+/*
+ * Whether the current locale puts the day before the month in dates.
+ */
+bool
+nlocale_day_first(struct cal_names *names)
+{
+	return names_nlocale(names)->day_first;
+}
+
+/*
+ * Locale object of the current locale, e.g., for strftime_l(3).
+ */
+locale_t
+nlocale_locale(struct cal_names *names)
+{
+	return names_nlocale(names)->loc;
+}
+
+static struct nlocale *
+nlocale_new(const char *name)
+{
+	char buf[64], buf2[64];
 	struct tm tm;
+	struct nlocale *nl;
 	struct nname *nname;
 
+	nl = xcalloc(1, sizeof(*nl));
+	if (name == NULL) {
+		nl->name = xstrdup(setlocale(LC_ALL, NULL));
+		nl->is_default = true;
+		if ((nl->loc = duplocale(LC_GLOBAL_LOCALE)) == (locale_t)0)
+			fatal("%s: duplocale: %s", __func__, strerror(errno));
+	} else {
+		nl->name = xstrdup(name);
+		nl->loc = newlocale(LC_ALL_MASK, name, (locale_t)0);
+		if (nl->loc == (locale_t)0) {
+			DPRINTF("%s: locale '%s' unavailable\n",
+				__func__, name);
+			return nl;
+		}
+	}
+
+	nl->day_first = locale_day_first(nl->loc);
+
 	memset(&tm, 0, sizeof(tm));
 	for (int i = 0; i < NDOWS; i++) {
-		nname = &dow_names[i];
+		nname = &nl->dows[i];
 		tm.tm_wday = i;
-
-		strftime(buf, sizeof(buf), "%a", &tm);
-		free(nname->n_name);
-		nname->n_name = xstrdup(buf);
-		nname->n_len = strlen(nname->n_name);
-
-		strftime(buf, sizeof(buf), "%A", &tm);
-		free(nname->fn_name);
-		nname->fn_name = xstrdup(buf);
-		nname->fn_len = strlen(nname->fn_name);
-
-		DPRINTF2("%s: dow[%d]: %s, %s, %s, %s\n", __func__,
-			 nname->value, nname->name, nname->f_name,
-			 nname->n_name, nname->fn_name);
+		strftime_l(buf, sizeof(buf), "%a", &tm, nl->loc);
+		strftime_l(buf2, sizeof(buf2), "%A", &tm, nl->loc);
+		nname_set_national(nname, &dow_names[i], buf, buf2);
+		DPRINTF2("%s: %s: dow[%d]: %s, %s\n", __func__, nl->name,
+			 nname->value, nname->n_name, nname->fn_name);
 	}
 
 	memset(&tm, 0, sizeof(tm));
 	for (int i = 0; i < NMONTHS; i++) {
-		nname = &month_names[i];
+		nname = &nl->months[i];
 		tm.tm_mon = i;
-
-		strftime(buf, sizeof(buf), "%b", &tm);
-		free(nname->n_name);
+		strftime_l(buf, sizeof(buf), "%b", &tm, nl->loc);
+		strftime_l(buf2, sizeof(buf2), "%B", &tm, nl->loc);
 		/* The month may have a leading blank (e.g., on *BSD) */
-		nname->n_name = xstrdup(triml(buf));
-		nname->n_len = strlen(nname->n_name);
+		nname_set_national(nname, &month_names[i], triml(buf),
+				   triml(buf2));
+		DPRINTF2("%s: %s: month[%02d]: %s, %s\n", __func__, nl->name,
+			 nname->value, nname->n_name, nname->fn_name);
+	}
 
-		strftime(buf, sizeof(buf), "%B", &tm);
-		free(nname->fn_name);
-		nname->fn_name = xstrdup(triml(buf));
-		nname->fn_len = strlen(nname->fn_name);
+	trie_build(&nl->dow_trie, NN_DOW, nl->dows, nl->loc);
+	trie_build(&nl->month_trie, NN_MONTH, nl->months, nl->loc);
+	return nl;
+}
 
-		DPRINTF2("%s: month[%02d]: %s, %s, %s, %s\n", __func__,
-			 nname->value, nname->name, nname->f_name,
-			 nname->n_name, nname->fn_name);
+static void
+nlocale_free(struct nlocale *nl)
+{
+	struct nname *tables[] = { nl->dows, nl->months };
+
+	for (size_t t = 0; t < nitems(tables); t++) {
+		for (struct nname *nname = tables[t]; nname->name != NULL;
+		     nname++) {
+			free(nname->n_name);
+			free(nname->fn_name);
+		}
 	}
+	free(nl->dow_trie.nodes);
+	free(nl->month_trie.nodes);
+	if (nl->loc != (locale_t)0)
+		freelocale(nl->loc);
+	free(nl->name);
+	free(nl);
+}
+
+static bool
+locale_day_first(locale_t loc)
+{
+	const char *d_fmt = nl_langinfo_l(D_FMT, loc);
+	const char *p_year;
+	const char *p_mon;
+	const char *p_day;
+
+	DPRINTF("%s: d_fmt=|%s|\n", __func__, d_fmt);
+
+	/*
+	 * BSDs often use '%e' while Linux often uses '%d'. Some locales
+	 * (like modern en_CA on macOS Tahoe) use ISO-style %Y-%m-%d.
+	 *
+	 * ISO-style locales (%Y-%m-%d) should map to textual day-month
+	 * rather than month-day, otherwise en_CA produces "Mar 15".
+	 *
+	 * If the year appears first, prefer day-month textual output
+	 * instead of collapsing into month-day.
+	 */
+
+	p_year = strchr(d_fmt, 'Y');
+	p_mon  = strchr(d_fmt, 'm');
+	p_day  = strpbrk(d_fmt, "ed");
+
+	if (p_mon == NULL || p_day == NULL)
+		return true;
+
+	if (p_year != NULL && p_year < p_mon && p_year < p_day)
+		return true;
+
+	return (p_day < p_mon);
+}
+
+/*
+ * Set $dst to the names of $src with the national names $n_name and
+ * $fn_name.
+ */
+static void
+nname_set_national(struct nname *dst, const struct nname *src,
+		   const char *n_name, const char *fn_name)
+{
+	*dst = *src;
+	dst->n_name = xstrdup(n_name);
+	dst->n_len = strlen(dst->n_name);
+	dst->fn_name = xstrdup(fn_name);
+	dst->fn_len = strlen(dst->fn_name);
 }
 
 void
-set_nsequences(const char *seq)
+set_nsequences(struct cal_names *names, const char *seq)
 {
-	struct nname *nname;
 	const char *p = seq;
 	size_t len;
 
@@ -160,15 +394,339 @@ set_nsequences(const char *seq)
 			p++;
 
 		len = (size_t)(p - seq);
-		nname = &sequence_names[i];
-		free(nname->n_name);
-		nname->n_name = xcalloc(1, len + 1);
-		strncpy(nname->n_name, seq, len);
-		nname->n_len = strlen(nname->n_name);
-		DPRINTF2("%s: sequence[%d]: %s, %s, %s, %s\n", __func__,
-			 nname->value, nname->name, nname->f_name,
-			 nname->n_name, nname->fn_name);
+		free(names->sequences[i]);
+		names->sequences[i] = xcalloc(1, len + 1);
+		strncpy(names->sequences[i], seq, len);
+		DPRINTF2("%s: sequence[%d]: %s, %s\n", __func__,
+			 sequence_names[i].value, sequence_names[i].name,
+			 names->sequences[i]);
 
 		seq = ++p;
 	}
+
+	names->seq_trie.dirty = true;
+}
+
+/*
+ * Reset the national sequence names set by set_nsequences().
+ */
+void
+reset_nsequences(struct cal_names *names)
+{
+	for (size_t i = 0; i < NSEQUENCES; i++) {
+		free(names->sequences[i]);
+		names->sequences[i] = NULL;
+	}
+
+	names->seq_trie.dirty = true;
+}
+
+/*
+ * Release the names $names, and reset them to the default locale.
+ */
+void
+nnames_free(struct cal_names *names)
+{
+	reset_nsequences(names);
+	free(names->seq_trie.nodes);
+	memset(names, 0, sizeof(*names));
+}
+
+/*
+ * Copy the names of $table with the current national names into $buf,
+ * which ends with an entry of NULL name (i.e., up to NMONTHS+1 entries).
+ */
+void
+nnames_get(struct cal_names *names, int table, struct nname *buf)
+{
+	const struct nlocale *nl = names_nlocale(names);
+	const struct nname *src;
+	size_t n;
+
+	switch (table) {
+	case NN_DOW:
+		src = nl->dows;
+		n = NDOWS + 1;
+		break;
+	case NN_MONTH:
+		src = nl->months;
+		n = NMONTHS + 1;
+		break;
+	case NN_SEQUENCE:
+		src = sequence_names;
+		n = NSEQUENCES + 1;
+		break;
+	default:
+		fatal("%s: unknown table: %d", __func__, table);
+	}
+
+	memcpy(buf, src, n * sizeof(*buf));
+	if (table == NN_SEQUENCE) {
+		for (size_t i = 0; i < NSEQUENCES; i++) {
+			buf[i].n_name = names->sequences[i];
+			buf[i].n_len = (buf[i].n_name != NULL) ?
+				strlen(buf[i].n_name) : 0;
+		}
+	}
+}
+
+/*
+ * Match the names of $table against the beginning of string $s.
+ * Return true if any name is a (case-insensitive) prefix of $s, and store
+ * its length in $len and its value in $value.
+ */
+bool
+nname_match_prefix(struct cal_names *names, int table, const char *s,
+		   size_t *len, int *value)
+{
+	const struct nname_trie *trie = names_trie(names, table);
+	const struct trie_node *node;
+
+	node = trie_walk(trie, s, len, names->nlocale->loc);
+	if (node == NULL)
+		return false;
+
+	*value = node->value;
+	return true;
+}
+
+/*
+ * Match the names of $table against the whole string $s.
+ * Return true if any name (case-insensitively) equals to $s, and store
+ * its value in $value.
+ */
+bool
+nname_match(struct cal_names *names, int table, const char *s, int *value)
+{
+	const struct nname_trie *trie = names_trie(names, table);
+	const struct trie_node *node;
+	locale_t loc = names->nlocale->loc;
+	locale_t oldloc = uselocale(loc);
+	mbstate_t state;
+	wint_t ch;
+	size_t n;
+	int i;
+
+	memset(&state, 0, sizeof(state));
+	node = &trie->nodes[0];
+	for ( ; (n = trie_fold(s, &state, loc, &ch)) > 0; s += n) {
+		for (i = node->child; i != 0; i = trie->nodes[i].sibling) {
+			if (trie->nodes[i].ch == ch)
+				break;
+		}
+		if (i == 0) {
+			node = NULL;
+			break;
+		}
+		node = &trie->nodes[i];
+	}
+	uselocale(oldloc);
+	if (node == NULL || node->rank < 0)
+		return false;
+
+	*value = node->value;
+	return true;
+}
+
+/*
+ * Get the trie of $table of the current names, which is built for the
+ * sequence names on demand.
+ */
+static const struct nname_trie *
+names_trie(struct cal_names *names, int table)
+{
+	const struct nlocale *nl = names_nlocale(names);
+	struct nname buf[NSEQUENCES+1];
+
+	switch (table) {
+	case NN_DOW:
+		return &nl->dow_trie;
+	case NN_MONTH:
+		return &nl->month_trie;
+	case NN_SEQUENCE:
+		if (names->seq_trie.dirty || names->seq_trie.count == 0) {
+			nnames_get(names, NN_SEQUENCE, buf);
+			trie_build(&names->seq_trie, NN_SEQUENCE, buf,
+				   nl->loc);
+		}
+		return &names->seq_trie;
+	default:
+		fatal("%s: unknown table: %d", __func__, table);
+	}
+}
+
+/*
+ * Walk the trie $trie along string $s, and return the node of the best
+ * ranked name that is a prefix of $s, with its length (in bytes) in $len.
+ */
+static const struct trie_node *
+trie_walk(const struct nname_trie *trie, const char *s, size_t *len,
+	  locale_t loc)
+{
+	const struct trie_node *node, *best;
+	locale_t oldloc = uselocale(loc);
+	mbstate_t state;
+	wint_t ch;
+	size_t depth, n;
+	int i;
+
+	memset(&state, 0, sizeof(state));
+	best = NULL;
+	node = &trie->nodes[0];
+	for (depth = 0; ; depth += n) {
+		if (node->rank >= 0 &&
+		    (best == NULL || node->rank < best->rank)) {
+			best = node;
+			*len = depth;
+		}
+
+		n = trie_fold(s + depth, &state, loc, &ch);
+		if (n == 0)
+			break;
+		for (i = node->child; i != 0; i = trie->nodes[i].sibling) {
+			if (trie->nodes[i].ch == ch)
+				break;
+		}
+		if (i == 0)
+			break;
+		node = &trie->nodes[i];
+	}
+
+	uselocale(oldloc);
+	return best;
+}
+
+/*
+ * Build the trie $trie of the names $names of $table, case-folded in the
+ * locale $loc.
+ */
+static void
+trie_build(struct nname_trie *trie, int table, const struct nname *names,
+	   locale_t loc)
+{
+	const struct nname *nname;
+	locale_t oldloc = uselocale(loc);
+	int rank = 0;
+
+	trie->count = 0;
+	trie_new_node(trie, '\0');  /* root */
+
+	for (nname = names; nname->name != NULL; nname++) {
+		if (table == NN_SEQUENCE) {
+			/* Only the short names and national names */
+			trie_insert(trie, nname->name, rank++, nname->value,
+				    loc);
+			if (nname->n_name != NULL) {
+				trie_insert(trie, nname->n_name, rank,
+					    nname->value, loc);
+			}
+			rank++;
+			continue;
+		}
+
+		if (nname->fn_name != NULL) {
+			trie_insert(trie, nname->fn_name, rank, nname->value,
+				    loc);
+		}
+		rank++;
+		if (nname->n_name != NULL) {
+			trie_insert(trie, nname->n_name, rank, nname->value,
+				    loc);
+		}
+		rank++;
+		if (nname->f_name != NULL) {
+			trie_insert(trie, nname->f_name, rank, nname->value,
+				    loc);
+		}
+		rank++;
+		trie_insert(trie, nname->name, rank++, nname->value, loc);
+	}
+
+	uselocale(oldloc);
+	trie->dirty = false;
+	DPRINTF2("%s: table %d: %d nodes\n", __func__, table, trie->count);
+}
+
+static void
+trie_insert(struct nname_trie *trie, const char *name, int rank, int value,
+	    locale_t loc)
+{
+	mbstate_t state;
+	wint_t ch;
+	size_t len;
+	int n, i;
+
+	memset(&state, 0, sizeof(state));
+	n = 0;
+	for ( ; (len = trie_fold(name, &state, loc, &ch)) > 0; name += len) {
+		for (i = trie->nodes[n].child; i != 0;
+		     i = trie->nodes[i].sibling) {
+			if (trie->nodes[i].ch == ch)
+				break;
+		}
+		if (i == 0) {
+			i = trie_new_node(trie, ch);
+			trie->nodes[i].sibling = trie->nodes[n].child;
+			trie->nodes[n].child = i;
+		}
+		n = i;
+	}
+
+	if (trie->nodes[n].rank < 0 || rank < trie->nodes[n].rank) {
+		trie->nodes[n].rank = rank;
+		trie->nodes[n].value = value;
+	}
+}
+
+static int
+trie_new_node(struct nname_trie *trie, wint_t ch)
+{
+	struct trie_node *node;
+
+	if (trie->count == trie->cap) {
+		trie->cap = (trie->cap > 0) ? trie->cap * 2 : 256;
+		trie->nodes = xrealloc(trie->nodes,
+				       (size_t)trie->cap * sizeof(*node));
+	}
+
+	node = &trie->nodes[trie->count];
+	memset(node, 0, sizeof(*node));
+	node->rank = -1;
+	node->ch = ch;
+	return trie->count++;
+}
+
+/*
+ * Case-fold the character at the beginning of string $s (in the shift
+ * state $state) in the locale $loc, which must be the current locale of
+ * the thread (see uselocale(3)), and store it in $ch.  Return the length
+ * of the character in bytes, or 0 at the end of the string.  A byte that
+ * doesn't start a valid character is taken alone and mapped beyond the
+ * characters, so that it's still matched exactly.
+ */
+static size_t
+trie_fold(const char *s, mbstate_t *state, locale_t loc, wint_t *ch)
+{
+	wchar_t wc;
+	size_t n;
+
+	if ((unsigned char)*s < 0x80 && mbsinit(state)) {
+		/* ASCII in the initial shift state needs no conversion */
+		if (*s == '\0')
+			return 0;
+		*ch = towlower_l((wint_t)*s, loc);
+		return 1;
+	}
+
+	n = mbrtowc(&wc, s, MB_CUR_MAX, state);
+	if (n == (size_t)-1 || n == (size_t)-2) {
+		memset(state, 0, sizeof(*state));
+		*ch = 0x110000 + (unsigned char)*s;  /* beyond Unicode */
+		return 1;
+	}
+	if (n == 0)
+		return 0;
+
+	*ch = towlower_l((wint_t)wc, loc);
+	return n;
 }
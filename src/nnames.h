@@ -36,6 +36,10 @@
 #ifndef NNAMES_H_
 #define NNAMES_H_
 
+#include <locale.h>
+#include <stdbool.h>
+#include <stddef.h>
+
 #define NDOWS		7
 #define NMONTHS		12
 #define NSEQUENCES	6
@@ -52,11 +56,47 @@ struct nname {
 	size_t		 fn_len;	/* length of full national name */
 };
 
-extern struct nname dow_names[];	/* names of every day of week */
-extern struct nname month_names[];	/* names of every month */
-extern struct nname sequence_names[];	/* names of every sequence */
+extern const struct nname dow_names[];	/* names of every day of week */
+extern const struct nname month_names[];	/* names of every month */
+extern const struct nname sequence_names[];	/* names of every sequence */
+
+/* Tables of names to match */
+enum { NN_DOW, NN_MONTH, NN_SEQUENCE, NN_TABLES };
+
+struct nlocale;
+struct trie_node;
+
+/* Trie of the names of a table to match (see nnames.c) */
+struct nname_trie {
+	struct trie_node *nodes;	/* nodes[0] is the root */
+	int	count;
+	int	cap;
+	bool	dirty;			/* names changed; to rebuild */
+};
+
+/*
+ * Names of a calendar context (see context.c), i.e., the locale of the
+ * national month and weekday names, and the national sequence names
+ * defined by the calendar files.
+ */
+struct cal_names {
+	const struct nlocale *nlocale;	/* NULL for the default locale */
+	char		*sequences[NSEQUENCES];
+	struct nname_trie seq_trie;
+};
+
+bool	set_nlocale(struct cal_names *names, const char *name);
+const char *nlocale_name(struct cal_names *names);
+bool	nlocale_day_first(struct cal_names *names);
+locale_t nlocale_locale(struct cal_names *names);
+void	set_nsequences(struct cal_names *names, const char *seq);
+void	reset_nsequences(struct cal_names *names);
+void	nnames_free(struct cal_names *names);
+void	nnames_get(struct cal_names *names, int table, struct nname *buf);
 
-void	set_nnames(void);
-void	set_nsequences(const char *seq);
+bool	nname_match_prefix(struct cal_names *names, int table, const char *s,
+			   size_t *len, int *value);
+bool	nname_match(struct cal_names *names, int table, const char *s,
+		    int *value);
 
 #endif
@@ -41,6 +41,7 @@
 
 #include "calendar.h"
 #include "basics.h"
+#include "context.h"
 #include "days.h"
 #include "gregorian.h"
 #include "io.h"
@@ -48,26 +49,20 @@
 #include "parsedata.h"
 #include "utils.h"
 
-struct dateinfo {
-	int	flags;
-	int	sday_id;
-	int	year;
-	int	month;
-	int	dayofmonth;
-	int	dayofweek;
-	int	offset;
-	int	index;
-};
-
-static bool	 check_dayofweek(const char *s, size_t *len, int *dow);
-static bool	 check_month(const char *s, size_t *len, int *month);
-static bool	 determine_style(const char *date, struct dateinfo *di);
+static bool	 check_dayofweek(struct cal_context *ctx, const char *s,
+				 size_t *len, int *dow);
+static bool	 check_month(struct cal_context *ctx, const char *s,
+			     size_t *len, int *month);
+static bool	 determine_style(struct cal_context *ctx, const char *date,
+				 struct dateinfo *di);
+static int	 determine_rule(const struct dateinfo *di);
 static bool	 is_onlydigits(const char *s, bool endstar);
 static bool	 parse_angle(const char *s, double *result);
 static const char *parse_int_ranged(const char *s, size_t len, int min,
 				    int max, int *result);
-static bool	 parse_index(const char *s, int *index);
-static void	 show_dateinfo(struct dateinfo *di);
+static bool	 parse_index(struct cal_context *ctx, const char *s,
+			     int *index);
+static void	 show_dateinfo(const struct dateinfo *di);
 
 /*
  * Expected styles:
@@ -129,10 +124,11 @@ static void	 show_dateinfo(struct dateinfo *di);
  *				'JunSolstice' | 'DecSolstice'
  */
 static bool
-determine_style(const char *date, struct dateinfo *di)
+determine_style(struct cal_context *ctx, const char *date,
+		struct dateinfo *di)
 {
-	static char date2[128];
-	struct specialday *sday;
+	char date2[128];
+	const struct specialday *sday;
 	char *p, *p1, *p2;
 	size_t len;
 
@@ -144,9 +140,10 @@ determine_style(const char *date, struct dateinfo *di)
 			sday = &specialdays[i];
 			if (strncasecmp(date2, sday->name, sday->len) == 0) {
 				len = sday->len;
-			} else if (sday->n_len > 0 && strncasecmp(
-					date2, sday->n_name, sday->n_len) == 0) {
-				len = sday->n_len;
+			} else if (ctx->sday_lens[i] > 0 &&
+				   strncasecmp(date2, ctx->sday_names[i],
+					       ctx->sday_lens[i]) == 0) {
+				len = ctx->sday_lens[i];
 			} else {
 				continue;
 			}
@@ -161,11 +158,11 @@ determine_style(const char *date, struct dateinfo *di)
 			return true;
 		}
 
-		if (check_dayofweek(date2, &len, &di->dayofweek)) {
+		if (check_dayofweek(ctx, date2, &len, &di->dayofweek)) {
 			di->flags |= (F_DAYOFWEEK | F_VARIABLE);
 			if (strlen(date2) == len)
 				return true;
-			if (parse_index(date2+len, &di->index)) {
+			if (parse_index(ctx, date2+len, &di->index)) {
 				di->flags |= F_INDEX;
 				return true;
 			}
@@ -220,13 +217,13 @@ determine_style(const char *date, struct dateinfo *di)
 
 	/* Month as a number, then a weekday */
 	if (is_onlydigits(p1, false) &&
-	    check_dayofweek(p2, &len, &di->dayofweek)) {
+	    check_dayofweek(ctx, p2, &len, &di->dayofweek)) {
 		di->flags |= (F_MONTH | F_DAYOFWEEK | F_VARIABLE);
 		di->month = (int)strtol(p1, NULL, 10);
 
 		if (strlen(p2) == len)
 			return true;
-		if (parse_index(p2+len, &di->index)) {
+		if (parse_index(ctx, p2+len, &di->index)) {
 			di->flags |= F_INDEX;
 			return true;
 		}
@@ -244,8 +241,8 @@ determine_style(const char *date, struct dateinfo *di)
 	 *       confuse the date parsing if this case is checked *before*
 	 *       the month number case.
 	 */
-	if (check_month(p1, &len, &di->month) ||
-	    (check_month(p2, &len, &di->month) && (p2 = p1))) {
+	if (check_month(ctx, p1, &len, &di->month) ||
+	    (check_month(ctx, p2, &len, &di->month) && (p2 = p1))) {
 		/* Now p2 is the non-month part */
 		di->flags |= F_MONTH;
 		if (strcmp(p2, "*") == 0) {
@@ -257,11 +254,11 @@ determine_style(const char *date, struct dateinfo *di)
 			di->flags |= F_DAYOFMONTH;
 			return true;
 		}
-		if (check_dayofweek(p2, &len, &di->dayofweek)) {
+		if (check_dayofweek(ctx, p2, &len, &di->dayofweek)) {
 			di->flags |= (F_DAYOFWEEK | F_VARIABLE);
 			if (strlen(p2) == len)
 				return true;
-			if (parse_index(p2+len, &di->index)) {
+			if (parse_index(ctx, p2+len, &di->index)) {
 				di->flags |= F_INDEX;
 				return true;
 			}
@@ -278,11 +275,11 @@ error:
 }
 
 static void
-show_dateinfo(struct dateinfo *di)
+show_dateinfo(const struct dateinfo *di)
 {
-	struct specialday *sday;
+	const struct specialday *sday;
 
-	fprintf(stderr, "flags: 0x%x -", di->flags);
+	fprintf(stderr, "rule: %d, flags: 0x%x -", di->rule, di->flags);
 
 	if ((di->flags & F_YEAR) != 0)
 		fprintf(stderr, " year(%d)", di->year);
@@ -317,168 +314,233 @@ show_dateinfo(struct dateinfo *di)
 	fflush(stderr);
 }
 
-int
-parse_cal_date(const char *date, int *flags, struct cal_day **dayp, char **edp)
+/*
+ * Classify the date string $date into the date info $di, which only
+ * depends on the date string and the current month/weekday/sequence
+ * names and special day names.
+ * Return true on success, otherwise false.
+ */
+bool
+parse_cal_dateinfo(struct cal_context *ctx, const char *date,
+		   struct dateinfo *di)
 {
-	struct specialday *sday;
-	struct dateinfo di;
-	int index, offset;
-
-	memset(&di, 0, sizeof(di));
-	di.flags = F_NONE;
+	memset(di, 0, sizeof(*di));
+	di->flags = F_NONE;
 
-	if (!determine_style(date, &di)) {
-		if (Options.debug)
-			show_dateinfo(&di);
-		return -1;
+	if (!determine_style(ctx, date, di)) {
+		if (cal_debug)
+			show_dateinfo(di);
+		return false;
 	}
+	di->rule = determine_rule(di);
 
-	if (Options.debug >= 3)
-		show_dateinfo(&di);
+	if (cal_debug >= 3)
+		show_dateinfo(di);
 
-	*flags = di.flags;
-	index = (di.flags & F_INDEX) ? di.index : 0;
-	offset = (di.flags & F_OFFSET) ? di.offset : 0;
+	return true;
+}
 
-	/* Specified year, month and day (e.g., '2020/Aug/16') */
-	if ((di.flags & ~F_VARIABLE) == (F_YEAR | F_MONTH | F_DAYOFMONTH) &&
-	    Calendar->find_days_ymd != NULL) {
-		return (Calendar->find_days_ymd)(di.year, di.month,
-						 di.dayofmonth, dayp, edp);
-	}
+/*
+ * Determine the kind of date rule of the classified date $di.
+ */
+static int
+determine_rule(const struct dateinfo *di)
+{
+	if ((di->flags & ~F_VARIABLE) == (F_YEAR | F_MONTH | F_DAYOFMONTH))
+		return DR_YMD;
+	if ((di->flags & ~F_VARIABLE) == (F_MONTH | F_DAYOFMONTH))
+		return DR_MD;
+	if (di->flags == (F_ALLMONTH | F_DAYOFMONTH))
+		return DR_DOM;
+	if (di->flags == (F_ALLDAY | F_MONTH))
+		return DR_MONTH;
+	if ((di->flags & ~F_INDEX) == (F_MONTH | F_DAYOFWEEK | F_VARIABLE))
+		return DR_MDOW;
+	if ((di->flags & ~F_INDEX) == (F_DAYOFWEEK | F_VARIABLE))
+		return DR_DOW;
+	if ((di->flags & F_SPECIALDAY) != 0)
+		return DR_SPECIAL;
+
+	return DR_NONE;
+}
 
-	/* Specified month and day (e.g., 'Aug/16') */
-	if ((di.flags & ~F_VARIABLE) == (F_MONTH | F_DAYOFMONTH) &&
-	    Calendar->find_days_ymd != NULL) {
-		return (Calendar->find_days_ymd)(-1, di.month, di.dayofmonth,
-						 dayp, edp);
-	}
+/*
+ * Check whether the date info $di (e.g., loaded from a cache file) is
+ * consistent and could have been produced by 'parse_cal_dateinfo()', so
+ * that it can be resolved without classifying the date again.  Only the
+ * fields taken from the names and the index are bounded by the parser;
+ * the year, month, day of month and offset are taken from the numbers as
+ * they are (e.g., 'Jan 0', '13 Mon' or 'Easter+1000'), which the date
+ * rules resolve to other days or none.  The unsupported rules (DR_NONE)
+ * are kept as well, so that they are warned about without reclassifying.
+ */
+bool
+dateinfo_valid(const struct dateinfo *di)
+{
+	const int all_flags = (F_MONTH | F_DAYOFWEEK | F_DAYOFMONTH |
+			       F_INDEX | F_OFFSET | F_SPECIALDAY |
+			       F_ALLMONTH | F_ALLDAY | F_VARIABLE | F_YEAR);
+	bool found;
 
-	/* Same day every month (e.g., '* 16') */
-	if (di.flags == (F_ALLMONTH | F_DAYOFMONTH) &&
-	    Calendar->find_days_dom != NULL) {
-		return (Calendar->find_days_dom)(di.dayofmonth, dayp, edp);
-	}
+	if ((di->flags & ~all_flags) != 0 || di->rule != determine_rule(di))
+		return false;
 
-	/* Every day of a month (e.g., 'Aug *') */
-	if (di.flags == (F_ALLDAY | F_MONTH) &&
-	    Calendar->find_days_month != NULL) {
-		return (Calendar->find_days_month)(di.month, dayp, edp);
-	}
+	if ((di->flags & F_DAYOFWEEK) != 0 &&
+	    (di->dayofweek < 0 || di->dayofweek >= NDOWS))
+		return false;
+	if ((di->flags & F_INDEX) != 0 &&
+	    (di->index == 0 || di->index < -5 || di->index > 5))
+		return false;
 
-	/*
-	 * Every day-of-week of a month (e.g., 'Aug/Sun')
-	 * One indexed day-of-week of a month (e.g., 'Aug/Sun+3')
-	 */
-	if ((di.flags & ~F_INDEX) == (F_MONTH | F_DAYOFWEEK | F_VARIABLE) &&
-	    Calendar->find_days_mdow != NULL) {
-		return (Calendar->find_days_mdow)(di.month, di.dayofweek,
-						  index, dayp, edp);
+	if ((di->flags & F_SPECIALDAY) != 0) {
+		found = false;
+		for (size_t i = 0; specialdays[i].id != SD_NONE; i++) {
+			if (di->sday_id == specialdays[i].id)
+				found = true;
+		}
+		if (!found)
+			return false;
 	}
 
-	/*
-	 * Every day-of-week of the year (e.g., 'Sun')
-	 * One indexed day-of-week of every month (e.g., 'Sun+3')
-	 */
-	if ((di.flags & ~F_INDEX) == (F_DAYOFWEEK | F_VARIABLE) &&
-	    Calendar->find_days_mdow != NULL) {
-		return (Calendar->find_days_mdow)(-1, di.dayofweek, index,
-						  dayp, edp);
-	}
+	return true;
+}
 
-	/* Special days with optional offset (e.g., 'ChineseNewYear+14') */
-	if ((di.flags & F_SPECIALDAY) != 0) {
+/*
+ * Check whether the date rule of the date info $di is supported by the
+ * current calendar, i.e., whether find_cal_days() would resolve it
+ * instead of warning and returning -1.
+ */
+bool
+cal_dateinfo_supported(struct cal_context *ctx, const struct dateinfo *di)
+{
+	const struct calendar *cal = ctx->calendar;
+
+	switch (di->rule) {
+	case DR_YMD:
+	case DR_MD:
+		return (cal->find_days_ymd != NULL);
+	case DR_DOM:
+		return (cal->find_days_dom != NULL);
+	case DR_MONTH:
+		return (cal->find_days_month != NULL);
+	case DR_MDOW:
+	case DR_DOW:
+		return (cal->find_days_mdow != NULL);
+	case DR_SPECIAL:
 		for (size_t i = 0; specialdays[i].id != SD_NONE; i++) {
-			sday = &specialdays[i];
-			if (di.sday_id == sday->id && sday->find_days != NULL)
-				return (sday->find_days)(offset, dayp, edp);
+			if (di->sday_id == specialdays[i].id)
+				return (specialdays[i].find_days != NULL);
 		}
+		break;
 	}
 
-	warnx("%s: Unsupported date |%s| in '%s' calendar",
-	      __func__, date, Calendar->name);
-	if (Options.debug)
-		show_dateinfo(&di);
-
-	return -1;
+	return false;
 }
 
-static bool
-check_month(const char *s, size_t *len, int *month)
+/*
+ * Find the days in the date range that match the date info $di, which
+ * is classified from the date string $date.  The date rule is resolved
+ * with the current calendar, which may not support it.
+ * Return the number of days found, or -1 if the date is unsupported.
+ */
+int
+find_cal_days(struct cal_context *ctx, const char *date, struct dateinfo *di,
+	      struct cal_matches *matches)
 {
-	struct nname *nname;
+	const struct calendar *cal = ctx->calendar;
+	const struct specialday *sday;
+	int index, offset;
 
-	for (int i = 0; month_names[i].name != NULL; i++) {
-		nname = &month_names[i];
+	index = (di->flags & F_INDEX) ? di->index : 0;
+	offset = (di->flags & F_OFFSET) ? di->offset : 0;
 
-		if (nname->fn_name &&
-		    strncasecmp(s, nname->fn_name, nname->fn_len) == 0) {
-			*len = nname->fn_len;
-			*month = nname->value;
-			return (true);
+	switch (di->rule) {
+	case DR_YMD:
+		if (cal->find_days_ymd == NULL)
+			break;
+		return (cal->find_days_ymd)(ctx, di->year, di->month,
+					    di->dayofmonth, matches);
+	case DR_MD:
+		if (cal->find_days_ymd == NULL)
+			break;
+		return (cal->find_days_ymd)(ctx, -1, di->month,
+					    di->dayofmonth, matches);
+	case DR_DOM:
+		if (cal->find_days_dom == NULL)
+			break;
+		return (cal->find_days_dom)(ctx, di->dayofmonth, matches);
+	case DR_MONTH:
+		if (cal->find_days_month == NULL)
+			break;
+		return (cal->find_days_month)(ctx, di->month, matches);
+	case DR_MDOW:
+		if (cal->find_days_mdow == NULL)
+			break;
+		return (cal->find_days_mdow)(ctx, di->month, di->dayofweek,
+					     index, matches);
+	case DR_DOW:
+		if (cal->find_days_mdow == NULL)
+			break;
+		return (cal->find_days_mdow)(ctx, -1, di->dayofweek, index,
+					     matches);
+	case DR_SPECIAL:
+		for (size_t i = 0; specialdays[i].id != SD_NONE; i++) {
+			sday = &specialdays[i];
+			if (di->sday_id == sday->id && sday->find_days != NULL)
+				return (sday->find_days)(ctx, offset, matches);
 		}
+		break;
+	}
 
-		if (nname->n_name &&
-		    strncasecmp(s, nname->n_name, nname->n_len) == 0) {
-			*len = nname->n_len;
-			*month = nname->value;
-			return (true);
-		}
+	warnx("%s: Unsupported date |%s| in '%s' calendar",
+	      __func__, date, cal->name);
+	if (cal_debug)
+		show_dateinfo(di);
 
-		if (nname->f_name &&
-		    strncasecmp(s, nname->f_name, nname->f_len) == 0) {
-			*len = nname->f_len;
-			*month = nname->value;
-			return (true);
-		}
+	return -1;
+}
 
-		if (strncasecmp(s, nname->name, nname->len) == 0) {
-			*len = nname->len;
-			*month = nname->value;
-			return (true);
+/*
+ * Calculate the signature of all the names that parse_cal_dateinfo()
+ * depends on, so that a classified date info can be reused as long as
+ * the signature stays the same.  The signature is never 0.
+ */
+uint64_t
+dateinfo_signature(struct cal_context *ctx)
+{
+	uint64_t h = HASH_INIT;
+	const int tables[] = { NN_MONTH, NN_DOW, NN_SEQUENCE };
+	struct nname names[NMONTHS+1];
+	const struct nname *nname;
+
+	for (size_t t = 0; t < nitems(tables); t++) {
+		nnames_get(&ctx->names, tables[t], names);
+		for (nname = names; nname->name != NULL; nname++) {
+			h = hash_string(h, nname->name);
+			h = hash_string(h, nname->f_name);
+			h = hash_string(h, nname->n_name);
+			h = hash_string(h, nname->fn_name);
 		}
 	}
 
-	return (false);
+	for (size_t i = 0; specialdays[i].id != SD_NONE; i++) {
+		h = hash_string(h, specialdays[i].name);
+		h = hash_string(h, ctx->sday_names[i]);
+	}
+
+	return (h != 0) ? h : 1;
 }
 
 static bool
-check_dayofweek(const char *s, size_t *len, int *dow)
+check_month(struct cal_context *ctx, const char *s, size_t *len, int *month)
 {
-	struct nname *nname;
-
-	for (int i = 0; dow_names[i].name != NULL; i++) {
-		nname = &dow_names[i];
-
-		if (nname->fn_name &&
-		    strncasecmp(s, nname->fn_name, nname->fn_len) == 0) {
-			*len = nname->fn_len;
-			*dow = nname->value;
-			return (true);
-		}
-
-		if (nname->n_name &&
-		    strncasecmp(s, nname->n_name, nname->n_len) == 0) {
-			*len = nname->n_len;
-			*dow = nname->value;
-			return (true);
-		}
-
-		if (nname->f_name &&
-		    strncasecmp(s, nname->f_name, nname->f_len) == 0) {
-			*len = nname->f_len;
-			*dow = nname->value;
-			return (true);
-		}
-
-		if (strncasecmp(s, nname->name, nname->len) == 0) {
-			*len = nname->len;
-			*dow = nname->value;
-			return (true);
-		}
-	}
+	return nname_match_prefix(&ctx->names, NN_MONTH, s, len, month);
+}
 
-	return (false);
+static bool
+check_dayofweek(struct cal_context *ctx, const char *s, size_t *len, int *dow)
+{
+	return nname_match_prefix(&ctx->names, NN_DOW, s, len, dow);
 }
 
 static bool
@@ -494,9 +556,8 @@ is_onlydigits(const char *s, bool endstar)
 }
 
 static bool
-parse_index(const char *s, int *index)
+parse_index(struct cal_context *ctx, const char *s, int *index)
 {
-	struct nname *nname;
 	bool parsed = false;
 
 	if (s[0] == '+' || s[0] == '-') {
@@ -513,14 +574,8 @@ parse_index(const char *s, int *index)
 		parsed = true;
 	}
 
-	for (int i = 0; !parsed && sequence_names[i].name != NULL; i++) {
-		nname = &sequence_names[i];
-		if (strcasecmp(s, nname->name) == 0 ||
-		    (nname->n_name && strcasecmp(s, nname->n_name) == 0)) {
-			*index = nname->value;
-			parsed = true;
-		}
-	}
+	if (!parsed && nname_match(&ctx->names, NN_SEQUENCE, s, index))
+		parsed = true;
 
 	DPRINTF2("%s: |%s| -> %d (status=%s)\n",
 		 __func__, s, *index, (parsed ? "ok" : "fail"));
@@ -638,46 +693,50 @@ parse_location(const char *s, double *latitude, double *longitude,
 {
 	char *ds = xstrdup(s);
 	const char *sep = ",";
-	char *p;
+	char *p, *last;
 	double v;
+	bool ok = false;
 
-	p = strtok(ds, sep);
+	p = strtok_r(ds, sep, &last);
 	if (parse_angle(p, &v) && fabs(v) <= 90) {
 		*latitude = v;
 	} else {
 		warnx("%s: invalid latitude: |%s|", __func__, p);
-		return false;
+		goto out;
 	}
 
-	p = strtok(NULL, sep);
+	p = strtok_r(NULL, sep, &last);
 	if (p == NULL) {
 		warnx("%s: missing longitude", __func__);
-		return false;
+		goto out;
 	}
 	if (parse_angle(p, &v) && fabs(v) <= 180) {
 		*longitude = v;
 	} else {
 		warnx("%s: invalid longitude: |%s|", __func__, p);
-		return false;
+		goto out;
 	}
 
-	p = strtok(NULL, sep);
+	p = strtok_r(NULL, sep, &last);
 	if (p != NULL) {
 		char *endp;
 		v = strtod(p, &endp);
 		if (p == endp || *endp != '\0' || v < 0) {
 			warnx("%s: invalid elevation: |%s|", __func__, p);
-			return false;
+			goto out;
 		}
 		*elevation = v;
 	}
 
-	if ((p = strtok(NULL, sep)) != NULL) {
+	if ((p = strtok_r(NULL, sep, &last)) != NULL) {
 		warnx("%s: unknown value: |%s|", __func__, p);
-		return false;
+		goto out;
 	}
 
-	return true;
+	ok = true;
+out:
+	free(ds);
+	return ok;
 }
 
 /*
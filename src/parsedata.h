@@ -38,6 +38,7 @@
 #define PARSEDATA_H_
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #define	F_NONE			0x00000
 #define	F_MONTH			0x00001
@@ -51,10 +52,47 @@
 #define	F_VARIABLE		0x00100
 #define	F_YEAR			0x00200
 
-struct cal_day;
+/*
+ * Kinds of date rules, i.e., how the days of a classified date are found
+ */
+enum {
+	DR_NONE,	/* unsupported */
+	DR_YMD,		/* year, month and day (e.g., '2020/Aug/16') */
+	DR_MD,		/* month and day (e.g., 'Aug/16') */
+	DR_DOM,		/* same day every month (e.g., '* 16') */
+	DR_MONTH,	/* every day of a month (e.g., 'Aug *') */
+	DR_MDOW,	/* day-of-week of a month (e.g., 'Aug/Sun+3') */
+	DR_DOW,		/* day-of-week of every month (e.g., 'Sun+3') */
+	DR_SPECIAL,	/* special day (e.g., 'ChineseNewYear+14') */
+};
+
+struct cal_context;
+struct cal_matches;
+
+/*
+ * Classified date of a calendar entry, i.e., the compiled date rule that
+ * is resolved against the date range by find_cal_days().
+ */
+struct dateinfo {
+	int	rule;
+	int	flags;
+	int	sday_id;
+	int	year;
+	int	month;
+	int	dayofmonth;
+	int	dayofweek;
+	int	offset;
+	int	index;
+};
 
-int	parse_cal_date(const char *date, int *flags, struct cal_day **dayp,
-		       char **edp);
+bool	parse_cal_dateinfo(struct cal_context *ctx, const char *date,
+			   struct dateinfo *di);
+bool	cal_dateinfo_supported(struct cal_context *ctx,
+			       const struct dateinfo *di);
+bool	dateinfo_valid(const struct dateinfo *di);
+int	find_cal_days(struct cal_context *ctx, const char *date,
+		      struct dateinfo *di, struct cal_matches *matches);
+uint64_t dateinfo_signature(struct cal_context *ctx);
 
 bool	parse_timezone(const char *s, int *result);
 bool	parse_location(const char *s, double *latitude, double *longitude,
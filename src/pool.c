@@ -0,0 +1,252 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2020 The DragonFly Project.  All rights reserved.
+ *
+ * This code is derived from software contributed to The DragonFly Project
+ * by Aaron LI <aly@aaronly.me>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of The DragonFly Project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific, prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Thread pool to run a batch of independent jobs, e.g., to resolve the
+ * calendar entries (see '-j').
+ *
+ * The jobs are identified by their indexes, and each worker initially
+ * owns an equal contiguous range of them.  A worker takes the jobs from
+ * the front of its own range, and once it runs out, it steals the back
+ * half of the largest range left to the others, so that the workers keep
+ * busy even if a few jobs (e.g., the astronomical ones) take much longer
+ * than the rest.  As the jobs are run in no particular order, the caller
+ * should save the results by the indexes and merge them afterwards.
+ *
+ * A fatal error in a job stops the worker, whose jobs left are stolen by
+ * the others, and is then raised again in the calling thread once all the
+ * workers are done.
+ */
+
+#include <err.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "calendar.h"
+#include "pool.h"
+#include "utils.h"
+
+struct pool;
+
+struct pool_worker {
+	struct pool	*pool;
+	pthread_t	 thread;
+	pthread_mutex_t	 lock;		/* protects the range */
+	size_t		 begin;		/* range [begin, end) of owned jobs */
+	size_t		 end;
+	size_t		 nrun;		/* number of jobs run */
+	size_t		 nstolen;	/* number of jobs stolen */
+	bool		 failed;	/* stopped by a fatal error */
+};
+
+struct pool {
+	struct pool_worker *workers;
+	int	 nworkers;
+	void	(*func)(size_t index, void *arg);
+	void	*arg;
+};
+
+static void	*pool_work(void *arg);
+static bool	 pool_take(struct pool_worker *w, size_t *index);
+static bool	 pool_steal(struct pool_worker *w);
+
+
+/*
+ * Call $func with every job index in [0, $njobs) and $arg on up to
+ * $nthreads threads (including the calling one), and return when all
+ * the jobs are done.
+ */
+void
+pool_run(size_t njobs, int nthreads,
+	 void (*func)(size_t index, void *arg), void *arg)
+{
+	struct pool pool;
+	struct pool_worker *w;
+	int i, nstarted, nfailed, ret;
+
+	if (nthreads < 1)
+		nthreads = 1;
+	if ((size_t)nthreads > njobs)
+		nthreads = (int)njobs;
+	if (nthreads <= 1) {
+		for (size_t k = 0; k < njobs; k++)
+			func(k, arg);
+		return;
+	}
+
+	pool.workers = xcalloc((size_t)nthreads, sizeof(*pool.workers));
+	pool.nworkers = nthreads;
+	pool.func = func;
+	pool.arg = arg;
+	for (i = 0; i < nthreads; i++) {
+		w = &pool.workers[i];
+		w->pool = &pool;
+		pthread_mutex_init(&w->lock, NULL);
+		w->begin = njobs * (size_t)i / (size_t)nthreads;
+		w->end = njobs * (size_t)(i + 1) / (size_t)nthreads;
+	}
+
+	/*
+	 * The calling thread is the first worker.  The jobs of a worker
+	 * that failed to start are simply stolen by the others.
+	 */
+	for (nstarted = 1; nstarted < nthreads; nstarted++) {
+		w = &pool.workers[nstarted];
+		ret = pthread_create(&w->thread, NULL, pool_work, w);
+		if (ret != 0) {
+			warnx("%s: pthread_create: %s", __func__,
+			      strerror(ret));
+			break;
+		}
+	}
+	pool_work(&pool.workers[0]);
+	for (i = 1; i < nstarted; i++)
+		pthread_join(pool.workers[i].thread, NULL);
+
+	nfailed = 0;
+	for (i = 0; i < nthreads; i++) {
+		w = &pool.workers[i];
+		DPRINTF2("%s: worker %d: %zu jobs run, %zu stolen%s\n",
+			 __func__, i, w->nrun, w->nstolen,
+			 w->failed ? ", failed" : "");
+		if (w->failed)
+			nfailed++;
+		pthread_mutex_destroy(&w->lock);
+	}
+	DPRINTF("%s: %zu jobs done by %d threads\n",
+		__func__, njobs, nstarted);
+	free(pool.workers);
+
+	if (nfailed > 0)
+		fatal("%s: %d workers failed", __func__, nfailed);
+}
+
+static void *
+pool_work(void *arg)
+{
+	struct pool_worker *w = arg;
+	struct pool *pool = w->pool;
+	struct fatal_jmp fj;
+	size_t index;
+
+	fatal_push(&fj);
+	if (setjmp(fj.env) != 0) {
+		w->failed = true;
+		return NULL;
+	}
+
+	do {
+		while (pool_take(w, &index)) {
+			(pool->func)(index, pool->arg);
+			w->nrun++;
+		}
+	} while (pool_steal(w));
+
+	fatal_pop(&fj);
+	return NULL;
+}
+
+/*
+ * Take the next job from the front of the range of worker $w.
+ * Return false if the range is empty.
+ */
+static bool
+pool_take(struct pool_worker *w, size_t *index)
+{
+	bool ok = false;
+
+	pthread_mutex_lock(&w->lock);
+	if (w->begin < w->end) {
+		*index = w->begin++;
+		ok = true;
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	return ok;
+}
+
+/*
+ * Steal the back half of the largest range of the other workers into
+ * the (empty) range of worker $w.  Return false if no jobs are left.
+ * Only the owner adds jobs to its range, so a range found empty stays
+ * empty, unless its owner is stealing and will then run the jobs itself.
+ */
+static bool
+pool_steal(struct pool_worker *w)
+{
+	struct pool *pool = w->pool;
+	struct pool_worker *victim;
+	size_t n, nmax, begin, end;
+
+	for (;;) {
+		victim = NULL;
+		nmax = 0;
+		for (int i = 0; i < pool->nworkers; i++) {
+			if (&pool->workers[i] == w)
+				continue;
+			pthread_mutex_lock(&pool->workers[i].lock);
+			n = pool->workers[i].end - pool->workers[i].begin;
+			pthread_mutex_unlock(&pool->workers[i].lock);
+			if (n > nmax) {
+				nmax = n;
+				victim = &pool->workers[i];
+			}
+		}
+		if (victim == NULL)
+			return false;
+
+		pthread_mutex_lock(&victim->lock);
+		n = victim->end - victim->begin;
+		begin = victim->begin + n / 2;
+		end = victim->end;
+		victim->end = begin;
+		pthread_mutex_unlock(&victim->lock);
+		if (begin == end)
+			continue;  /* drained meanwhile; look again */
+
+		pthread_mutex_lock(&w->lock);
+		w->begin = begin;
+		w->end = end;
+		pthread_mutex_unlock(&w->lock);
+		w->nstolen += end - begin;
+		return true;
+	}
+}
@@ -0,0 +1,846 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2020 The DragonFly Project.  All rights reserved.
+ *
+ * This code is derived from software contributed to The DragonFly Project
+ * by Aaron LI <aly@aaronly.me>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of The DragonFly Project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific, prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Daemon to answer the calendar queries over a Unix socket (see '-S'),
+ * and the client of it (see '-c').
+ *
+ * The daemon keeps a few calendar contexts with the system calendar file
+ * preloaded for the recently queried date ranges and locations, besides
+ * the astronomical memos and the national names that are kept by the
+ * modules anyway, so a query only needs to parse the user's own calendar
+ * file.  The client passes the descriptors of its calendar file and its
+ * current directory instead of their paths, so the calendar file is read
+ * with the privileges of the client, and the included files are looked
+ * up in the same directories as the in-process evaluation.
+ *
+ * The main loop waits for the queries of all the connections at the same
+ * time, and each query is answered by a forked child, which inherits the
+ * preloaded context, so neither an idle nor a slow client blocks the
+ * others.  Only the contexts of short date ranges are built and kept by
+ * the main loop, while the child builds its own context for a longer
+ * range.  The child captures its warnings and sends them back to the
+ * client along with the events.
+ *
+ * Only the owner of the daemon can query it, unless it runs as root, in
+ * which case the child switches to the credentials of the client before
+ * reading any of its files.  The included files are only looked up by
+ * relative paths without '..' (see cal_context_set_include_dir()).
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include <err.h>
+#include <errno.h>
+#include <grp.h>  /* required on Linux for initgroups() */
+#include <locale.h>
+#include <math.h>
+#include <poll.h>
+#include <pwd.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "calendar.h"
+#include "libcalendar.h"
+#include "server.h"
+#include "utils.h"
+
+/* number of contexts kept for the recent date ranges and locations */
+#define SERVER_NCONTEXTS	4
+/* maximum number of connections waiting for their queries */
+#define SERVER_MAXCONNS		64
+/* maximum number of children answering the queries at the same time */
+#define SERVER_MAXCHILDREN	16
+/* maximum time in seconds to wait for the other end of a query */
+#define SERVER_TIMEOUT		10
+/* maximum number of days of the date ranges whose contexts are kept */
+#define SERVER_KEPT_DAYS	62
+
+/*
+ * Do not let the client die of SIGPIPE when the daemon rejects it or goes
+ * away; Darwin lacks MSG_NOSIGNAL and uses SO_NOSIGPIPE instead.
+ */
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS		MSG_NOSIGNAL
+#else
+#define SEND_FLAGS		0
+#endif
+
+struct server_slot {
+	struct server_query key;
+	struct cal_context *ctx;
+	unsigned long	 used;	/* serial of the last use; 0 if empty */
+};
+
+/* Connection waiting for its query */
+struct server_conn {
+	int	 fd;		/* -1 if unused */
+	uid_t	 uid;		/* credentials of the client */
+	gid_t	 gid;
+	time_t	 deadline;	/* to receive the query */
+};
+
+static struct server_slot server_slots[SERVER_NCONTEXTS];
+static struct server_conn server_conns[SERVER_MAXCONNS];
+static unsigned long server_serial;
+static unsigned long server_nqueries;
+static const char *server_preload;
+static const char *server_cache_dir;
+static int	server_sock = -1;
+static int	server_nchildren = 0;
+static volatile sig_atomic_t server_quit;
+
+static bool	drop_privileges(uid_t uid, gid_t gid);
+static void	handle_quit(int signo);
+static time_t	monotonic_time(void);
+static bool	peer_cred(int fd, uid_t *uid, gid_t *gid);
+static bool	read_full(int fd, void *buf, size_t len);
+static bool	recv_query(int fd, struct server_query *q, int fds[2]);
+static void	reply_status(int fd, int status);
+static bool	same_key(const struct server_query *a,
+			 const struct server_query *b);
+static bool	send_query(int fd, const struct server_query *q,
+			   int cal_fd, int dir_fd);
+static void	server_accept(void);
+static void	server_child(struct server_conn *conn,
+			     const struct server_query *q, int fds[2],
+			     struct cal_context *ctx) __dead2;
+static int	server_connect(const char *path);
+static struct cal_context *server_context(const struct server_query *q);
+static struct cal_context *server_new_context(const struct server_query *q);
+static void	server_dispatch(struct server_conn *conn);
+static void	server_reap(bool block);
+static void	set_timeout(int fd);
+static bool	socket_addr(const char *path, struct sockaddr_un *addr);
+static bool	valid_query(const struct server_query *q);
+
+
+/*
+ * Serve the queries on the Unix socket $path until SIGINT or SIGTERM,
+ * with the calendar file $preload (if not NULL) preloaded for them, and
+ * the compiled files kept in $cache_dir (if not NULL).
+ * Return false if failed to set up the socket.
+ */
+bool
+server_run(const char *path, const char *preload, const char *cache_dir)
+{
+	struct pollfd pfds[1 + SERVER_MAXCONNS];
+	struct server_conn *conns[1 + SERVER_MAXCONNS];
+	struct sockaddr_un addr;
+	struct sigaction sa;
+	mode_t omask;
+	nfds_t npfds;
+	time_t now;
+	int fd;
+
+	if (!socket_addr(path, &addr)) {
+		warnx("%s: socket path too long: '%s'", __func__, path);
+		return false;
+	}
+
+	/* Refuse to take over the socket of a running daemon */
+	if ((fd = server_connect(path)) != -1) {
+		close(fd);
+		warnx("Daemon already running on socket: '%s'", path);
+		return false;
+	}
+	unlink(path);  /* stale socket */
+
+	if ((server_sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		warn("socket");
+		return false;
+	}
+	/* Only the owner can connect, unless running as root (see above) */
+	omask = umask(0177);
+	if (bind(server_sock, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+	    listen(server_sock, SOMAXCONN) == -1) {
+		warn("Cannot listen on socket: '%s'", path);
+		umask(omask);
+		close(server_sock);
+		return false;
+	}
+	umask(omask);
+	if (geteuid() == 0)
+		chmod(path, 0666);
+
+	/* interrupt poll() to quit */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handle_quit;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	for (int i = 0; i < SERVER_MAXCONNS; i++)
+		server_conns[i].fd = -1;
+	server_preload = preload;
+	server_cache_dir = cache_dir;
+	DPRINTF("%s: listening on '%s'\n", __func__, path);
+
+	while (!server_quit) {
+		server_reap(false);
+
+		npfds = 0;
+		pfds[npfds].fd = server_sock;
+		pfds[npfds].events = POLLIN;
+		conns[npfds++] = NULL;
+		for (int i = 0; i < SERVER_MAXCONNS; i++) {
+			if (server_conns[i].fd == -1)
+				continue;
+			pfds[npfds].fd = server_conns[i].fd;
+			pfds[npfds].events = POLLIN;
+			conns[npfds++] = &server_conns[i];
+		}
+
+		/* wake up every second to reap the children */
+		if (poll(pfds, npfds, 1000) == -1) {
+			if (errno != EINTR)
+				warn("poll");
+			continue;
+		}
+
+		now = monotonic_time();
+		for (nfds_t i = 1; i < npfds; i++) {
+			if (pfds[i].revents != 0) {
+				server_dispatch(conns[i]);
+			} else if (now >= conns[i]->deadline) {
+				DPRINTF("%s: query timed out\n", __func__);
+				close(conns[i]->fd);
+				conns[i]->fd = -1;
+			}
+		}
+		if (pfds[0].revents != 0)
+			server_accept();
+	}
+
+	for (int i = 0; i < SERVER_MAXCONNS; i++) {
+		if (server_conns[i].fd != -1)
+			close(server_conns[i].fd);
+	}
+	close(server_sock);
+	unlink(path);
+	server_reap(true);
+	for (int i = 0; i < SERVER_NCONTEXTS; i++)
+		cal_context_free(server_slots[i].ctx);
+
+	DPRINTF("%s: answered %lu queries\n", __func__, server_nqueries);
+	return true;
+}
+
+/*
+ * Query the daemon on socket $path for the calendar file $cal_fd, with
+ * the included files looked up in directory $dir_fd.  The formatted
+ * events are returned in the allocated $data of length $len, and the
+ * warnings of the daemon are printed to the standard error.
+ */
+int
+server_query(const char *path, const struct server_query *q,
+	     int cal_fd, int dir_fd, char **data, size_t *len)
+{
+	struct server_reply reply;
+	int fd, status = SERVER_UNAVAILABLE;
+	char *buf = NULL, *diag = NULL;
+
+	*data = NULL;
+	*len = 0;
+
+	if ((fd = server_connect(path)) == -1) {
+		DPRINTF("%s: no daemon on '%s'\n", __func__, path);
+		return SERVER_UNAVAILABLE;
+	}
+	set_timeout(fd);
+
+	/*
+	 * A rejected client may fail to send the query, but still reads
+	 * the reply of the daemon.
+	 */
+	if (!send_query(fd, q, cal_fd, dir_fd))
+		DPRINTF("%s: failed to send query\n", __func__);
+	if (!read_full(fd, &reply, sizeof(reply)) ||
+	    reply.magic != SERVER_MAGIC) {
+		warnx("%s: invalid reply from daemon on '%s'", __func__, path);
+		goto out;
+	}
+
+	buf = xmalloc((size_t)reply.len + 1);
+	diag = xmalloc((size_t)reply.errlen + 1);
+	if (!read_full(fd, buf, (size_t)reply.len) ||
+	    !read_full(fd, diag, (size_t)reply.errlen)) {
+		warnx("%s: truncated reply from daemon on '%s'",
+		      __func__, path);
+		goto out;
+	}
+	fwrite(diag, 1, (size_t)reply.errlen, stderr);
+
+	if (reply.status == SERVER_OK) {
+		buf[reply.len] = '\0';
+		*data = buf;
+		*len = (size_t)reply.len;
+		buf = NULL;
+	}
+	status = reply.status;
+	DPRINTF("%s: daemon replied status %d with %zu bytes\n",
+		__func__, status, *len);
+
+out:
+	free(buf);
+	free(diag);
+	close(fd);
+	return status;
+}
+
+
+static void
+handle_quit(int signo __unused)
+{
+	server_quit = 1;
+}
+
+/*
+ * Accept a connection, and wait for its query in the main loop.  Only
+ * the owner of the daemon is accepted, unless running as root.
+ */
+static void
+server_accept(void)
+{
+	struct server_conn *conn = NULL;
+	uid_t uid = (uid_t)-1;
+	gid_t gid = (gid_t)-1;
+	int fd;
+
+	if ((fd = accept(server_sock, NULL, NULL)) == -1) {
+		if (errno != EINTR && errno != ECONNABORTED)
+			warn("accept");
+		return;
+	}
+
+	if (!peer_cred(fd, &uid, &gid) ||
+	    (geteuid() != 0 && uid != geteuid())) {
+		DPRINTF("%s: reject client of uid %ld\n",
+			__func__, (long)uid);
+		reply_status(fd, SERVER_UNAVAILABLE);
+		close(fd);
+		return;
+	}
+
+	for (int i = 0; i < SERVER_MAXCONNS; i++) {
+		if (server_conns[i].fd == -1) {
+			conn = &server_conns[i];
+			break;
+		}
+	}
+	if (conn == NULL) {
+		DPRINTF("%s: too many connections\n", __func__);
+		reply_status(fd, SERVER_UNAVAILABLE);
+		close(fd);
+		return;
+	}
+
+	conn->fd = fd;
+	conn->uid = uid;
+	conn->gid = gid;
+	conn->deadline = monotonic_time() + SERVER_TIMEOUT;
+}
+
+/*
+ * Receive the query of connection $conn, and fork a child to answer it
+ * with the context of its date range and location.
+ */
+static void
+server_dispatch(struct server_conn *conn)
+{
+	struct server_query q;
+	struct cal_context *ctx;
+	int fds[2] = { -1, -1 };
+	pid_t pid;
+
+	if (!recv_query(conn->fd, &q, fds)) {
+		DPRINTF("%s: invalid query\n", __func__);
+		reply_status(conn->fd, SERVER_UNAVAILABLE);
+		goto out;
+	}
+
+	/*
+	 * The national names are those of the daemon's locale, so let the
+	 * client process in-place if its locale is different.
+	 */
+	if (strcmp(q.locale, setlocale(LC_ALL, NULL)) != 0) {
+		DPRINTF("%s: locale mismatch: |%s|\n", __func__, q.locale);
+		reply_status(conn->fd, SERVER_UNAVAILABLE);
+		goto out;
+	}
+	if (server_nchildren >= SERVER_MAXCHILDREN) {
+		DPRINTF("%s: too many queries\n", __func__);
+		reply_status(conn->fd, SERVER_UNAVAILABLE);
+		goto out;
+	}
+
+	/*
+	 * Get the kept context first, which may preload and change
+	 * directory; the context of a long range is left to the child,
+	 * which would otherwise block the main loop for long.
+	 */
+	ctx = NULL;
+	if (q.day_end - q.day_begin < SERVER_KEPT_DAYS &&
+	    (ctx = server_context(&q)) == NULL) {
+		reply_status(conn->fd, SERVER_UNAVAILABLE);
+		goto out;
+	}
+
+	switch (pid = fork()) {
+	case -1:
+		warn("fork");
+		reply_status(conn->fd, SERVER_UNAVAILABLE);
+		break;
+	case 0:
+		server_child(conn, &q, fds, ctx);
+		/* NOTREACHED */
+	default:
+		server_nchildren++;
+		server_nqueries++;
+		DPRINTF2("%s: forked child %ld\n", __func__, (long)pid);
+		break;
+	}
+
+out:
+	for (int i = 0; i < 2; i++) {
+		if (fds[i] != -1)
+			close(fds[i]);
+	}
+	close(conn->fd);
+	conn->fd = -1;
+}
+
+/*
+ * Answer the query $q of connection $conn in the child, with the
+ * descriptors $fds of the calendar file and the include directory.
+ * The context $ctx is built here if NULL.
+ */
+static void
+server_child(struct server_conn *conn, const struct server_query *q,
+	     int fds[2], struct cal_context *ctx)
+{
+	struct server_reply reply = { .magic = SERVER_MAGIC };
+	struct iovec iov[3];
+	size_t len = 0, dlen = 0;
+	char *data = NULL, *diag = NULL;
+	FILE *fp, *errfp;
+	off_t off;
+
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	close(server_sock);
+	for (int i = 0; i < SERVER_MAXCONNS; i++) {
+		if (server_conns[i].fd != -1 && &server_conns[i] != conn)
+			close(server_conns[i].fd);
+	}
+	set_timeout(conn->fd);
+
+	/* Capture the warnings to send them back to the client */
+	if (!drop_privileges(conn->uid, conn->gid) ||
+	    (ctx == NULL && (ctx = server_new_context(q)) == NULL) ||
+	    (errfp = tmpfile()) == NULL ||
+	    dup2(fileno(errfp), STDERR_FILENO) == -1 ||
+	    (fp = fdopen(fds[0], "r")) == NULL) {
+		reply_status(conn->fd, SERVER_UNAVAILABLE);
+		_exit(1);
+	}
+
+	cal_context_set_time(ctx, q->time);
+	cal_context_set_include_dir(ctx, fds[1]);
+	if (cal_context_load(ctx, fp) &&
+	    (data = cal_context_format(ctx, &len)) != NULL)
+		reply.status = SERVER_OK;
+	else
+		reply.status = SERVER_FAILED;
+
+	if ((off = lseek(fileno(errfp), 0, SEEK_END)) > 0 &&
+	    lseek(fileno(errfp), 0, SEEK_SET) == 0) {
+		dlen = (size_t)off;
+		diag = xmalloc(dlen);
+		if (!read_full(fileno(errfp), diag, dlen))
+			dlen = 0;
+	}
+
+	reply.len = len;
+	reply.errlen = dlen;
+	iov[0].iov_base = &reply;
+	iov[0].iov_len = sizeof(reply);
+	iov[1].iov_base = data;
+	iov[1].iov_len = len;
+	iov[2].iov_base = diag;
+	iov[2].iov_len = dlen;
+	_exit(write_iov(conn->fd, iov, (int)nitems(iov)) ? 0 : 1);
+}
+
+/*
+ * Reap the exited children, or wait for all of them if $block.
+ */
+static void
+server_reap(bool block)
+{
+	while (server_nchildren > 0 &&
+	       waitpid(-1, NULL, block ? 0 : WNOHANG) > 0)
+		server_nchildren--;
+}
+
+/*
+ * Switch to the credentials of the client if running as root.
+ */
+static bool
+drop_privileges(uid_t uid, gid_t gid)
+{
+	struct passwd *pw;
+
+	if (geteuid() != 0 || uid == 0)
+		return true;
+
+	if ((pw = getpwuid(uid)) == NULL) {
+		DPRINTF("%s: unknown uid %ld\n", __func__, (long)uid);
+		return false;
+	}
+	if (setgid(gid) == -1 ||
+	    initgroups(pw->pw_name, gid) == -1 ||
+	    setuid(uid) == -1) {
+		DPRINTF("%s: cannot switch to uid %ld\n", __func__, (long)uid);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Get the credentials of the client connected on socket $fd.
+ */
+static bool
+peer_cred(int fd, uid_t *uid, gid_t *gid)
+{
+#if defined(__linux__)
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1)
+		return false;
+	*uid = cred.uid;
+	*gid = cred.gid;
+	return true;
+#else
+	return (getpeereid(fd, uid, gid) == 0);
+#endif
+}
+
+/*
+ * Send the reply of $status without any data, which does not block.
+ */
+static void
+reply_status(int fd, int status)
+{
+	struct server_reply reply = { .magic = SERVER_MAGIC };
+
+	reply.status = status;
+	if (send(fd, &reply, sizeof(reply), MSG_DONTWAIT) !=
+	    (ssize_t)sizeof(reply))
+		DPRINTF("%s: failed to write reply\n", __func__);
+}
+
+/*
+ * Get the context for the date range and location of query $q, which
+ * replaces the least recently used one if not found.  Return NULL if
+ * failed to create the context.
+ */
+static struct cal_context *
+server_context(const struct server_query *q)
+{
+	struct server_slot *slot, *lru = &server_slots[0];
+	struct cal_context *ctx;
+
+	for (int i = 0; i < SERVER_NCONTEXTS; i++) {
+		slot = &server_slots[i];
+		if (slot->used != 0 && same_key(&slot->key, q)) {
+			slot->used = ++server_serial;
+			return slot->ctx;
+		}
+		if (slot->used < lru->used)
+			lru = slot;
+	}
+
+	cal_context_free(lru->ctx);
+	lru->ctx = NULL;
+	lru->used = 0;
+	if ((ctx = server_new_context(q)) == NULL)
+		return NULL;
+
+	lru->key = *q;
+	lru->ctx = ctx;
+	lru->used = ++server_serial;
+	return ctx;
+}
+
+/*
+ * Create the context for the date range and location of query $q, with
+ * the system calendar file preloaded.  Return NULL if failed.
+ */
+static struct cal_context *
+server_new_context(const struct server_query *q)
+{
+	struct cal_context *ctx;
+
+	if ((ctx = cal_context_new()) == NULL)
+		return NULL;
+	cal_context_set_cache_dir(ctx, server_cache_dir);
+	cal_context_set_location(ctx, q->latitude, q->longitude,
+				 q->elevation, q->zone);
+	if (!cal_context_set_range(ctx, q->today, q->day_begin,
+				   q->day_end)) {
+		cal_context_free(ctx);
+		return NULL;
+	}
+	if (server_preload != NULL && chdir(calendarDirs[1]) == 0)
+		cal_context_preload(ctx, server_preload);
+
+	DPRINTF("%s: new context for [%d, %d] (today: %d)\n",
+		__func__, q->day_begin, q->day_end, q->today);
+	return ctx;
+}
+
+static bool
+same_key(const struct server_query *a, const struct server_query *b)
+{
+	return (a->today == b->today &&
+		a->day_begin == b->day_begin &&
+		a->day_end == b->day_end &&
+		a->latitude == b->latitude &&
+		a->longitude == b->longitude &&
+		a->elevation == b->elevation &&
+		a->zone == b->zone);
+}
+
+static bool
+send_query(int fd, const struct server_query *q, int cal_fd, int dir_fd)
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(2 * sizeof(int))];
+	} control;
+	struct server_query query = *q;
+	struct iovec iov = { .iov_base = &query, .iov_len = sizeof(query) };
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	int fds[2] = { cal_fd, dir_fd };
+
+	memset(&msg, 0, sizeof(msg));
+	memset(&control, 0, sizeof(control));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	return (sendmsg(fd, &msg, SEND_FLAGS) == (ssize_t)sizeof(query));
+}
+
+/*
+ * Receive a query and the descriptors of the calendar file and directory
+ * into $fds, which are set to -1 if not received.  Any other descriptors
+ * received are closed, and so are these two if the query is invalid.
+ */
+static bool
+recv_query(int fd, struct server_query *q, int fds[2])
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(8 * sizeof(int))];
+	} control;
+	struct iovec iov = { .iov_base = q, .iov_len = sizeof(*q) };
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	size_t nfds;
+	ssize_t n;
+	int *rfds;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	while ((n = recvmsg(fd, &msg, MSG_DONTWAIT)) == -1 && errno == EINTR)
+		;
+	if (n == -1)
+		return false;
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+	     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+		rfds = (int *)(void *)CMSG_DATA(cmsg);
+		nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (size_t i = 0; i < nfds; i++) {
+			if (nfds == 2 && fds[i] == -1)
+				fds[i] = rfds[i];
+			else
+				close(rfds[i]);
+		}
+	}
+
+	/* the query is sent at once along with the descriptors */
+	if ((size_t)n != sizeof(*q) || (msg.msg_flags & MSG_CTRUNC) ||
+	    fds[0] == -1 || fds[1] == -1 ||
+	    q->magic != SERVER_MAGIC || !valid_query(q)) {
+		for (int i = 0; i < 2; i++) {
+			if (fds[i] != -1)
+				close(fds[i]);
+			fds[i] = -1;
+		}
+		return false;
+	}
+
+	q->locale[sizeof(q->locale) - 1] = '\0';
+	return true;
+}
+
+/*
+ * Check the dates and location of query $q against the limits of the
+ * options (see '-t', '-A', '-B', '-L', '-T' and '-U').  The date range
+ * is checked against today, which is bounded first, so that the
+ * arithmetic cannot overflow.
+ */
+static bool
+valid_query(const struct server_query *q)
+{
+	if (q->today < CAL_DATE_MIN || q->today > CAL_DATE_MAX)
+		return false;
+	if (q->day_begin > q->today || q->day_begin < q->today - CAL_DAYS_MAX ||
+	    q->day_end < q->today || q->day_end > q->today + CAL_DAYS_MAX)
+		return false;
+
+	return (q->time >= 0.0 && q->time <= 1.0 && isfinite(q->elevation) &&
+		fabs(q->latitude) <= 90.0 && fabs(q->longitude) <= 180.0 &&
+		fabs(q->zone) <= 1.0);
+}
+
+static bool
+read_full(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = read(fd, p, len)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		if (n == 0)
+			return false;
+		p += n;
+		len -= (size_t)n;
+	}
+
+	return true;
+}
+
+static int
+server_connect(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (!socket_addr(path, &addr))
+		return -1;
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+		return -1;
+#ifdef SO_NOSIGPIPE
+	setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &(int){ 1 }, sizeof(int));
+#endif
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static time_t
+monotonic_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+/*
+ * Limit the time to wait for the other end, so neither a stuck client
+ * blocks the daemon nor a stuck daemon blocks the client.
+ */
+static void
+set_timeout(int fd)
+{
+	struct timeval tv = { .tv_sec = SERVER_TIMEOUT, .tv_usec = 0 };
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+static bool
+socket_addr(const char *path, struct sockaddr_un *addr)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr->sun_path))
+		return false;
+	strcpy(addr->sun_path, path);
+	return true;
+}
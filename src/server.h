@@ -0,0 +1,86 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2020 The DragonFly Project.  All rights reserved.
+ *
+ * This code is derived from software contributed to The DragonFly Project
+ * by Aaron LI <aly@aaronly.me>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of The DragonFly Project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific, prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef SERVER_H_
+#define SERVER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SERVER_MAGIC	0x43414c32U  /* "CAL2"; changed with the protocol */
+
+/* status of a query */
+enum {
+	SERVER_OK,		/* events formatted */
+	SERVER_FAILED,		/* failed to parse the calendar file */
+	SERVER_UNAVAILABLE,	/* no daemon to answer; process in-place */
+};
+
+/*
+ * Query sent to the daemon, along with the descriptors of the calendar
+ * file and the directory to look up the included files in.
+ */
+struct server_query {
+	uint32_t magic;
+	int	today;
+	int	day_begin;
+	int	day_end;
+	double	time;
+	double	latitude;
+	double	longitude;
+	double	elevation;
+	double	zone;
+	char	locale[64];  /* LC_ALL of the client */
+};
+
+/*
+ * Reply of the daemon, followed by the formatted events (if SERVER_OK)
+ * and then the warnings of the daemon to print
+ */
+struct server_reply {
+	uint32_t magic;
+	int	status;
+	uint64_t len;		/* length of the events */
+	uint64_t errlen;	/* length of the warnings */
+};
+
+bool	server_run(const char *path, const char *preload,
+		   const char *cache_dir);
+int	server_query(const char *path, const struct server_query *q,
+		     int cal_fd, int dir_fd, char **data, size_t *len);
+
+#endif
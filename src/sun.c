@@ -39,12 +39,16 @@
  * 2018, Cambridge University Press
  */
 
+#include <assert.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "basics.h"
+#include "ephemeris.h"
 #include "gregorian.h"
 #include "sun.h"
 #include "utils.h"
@@ -55,6 +59,13 @@
  */
 const double mean_tropical_year = 365.242189;
 
+static double	solar_longitude_series(double t);
+struct solar_term_moment;
+static void	solar_terms_sweep(int year, struct solar_term_moment *terms);
+
+static struct ephemeris solar_longitude_eph =
+	EPHEMERIS_INIT("solar_longitude", solar_longitude_series, true, 32, 12);
+
 /*
  * Calculate the longitudinal nutation (in degrees) at moment $t.
  * Ref: Sec.(14.4), Eq.(14.34)
@@ -84,80 +95,63 @@ aberration(double t)
 
 /*
  * Argument data used by 'solar_longitude()' for calculating the solar
- * longitude.
+ * longitude, in the structure-of-arrays form.
  * Ref: Sec.(14.4), Table(14.1)
  */
-static const struct solar_longitude_arg {
-	int	x;
-	double	y;
-	double	z;
-} solar_longitude_data[] = {
-	{ 403406, 270.54861,      0.9287892 },
-	{ 195207, 340.19128,  35999.1376958 },
-	{ 119433,  63.91854,  35999.4089666 },
-	{ 112392, 331.26220,  35998.7287385 },
-	{   3891, 317.843  ,  71998.20261   },
-	{   2819,  86.631  ,  71998.4403    },
-	{   1721, 240.052  ,  36000.35726   },
-	{    660, 310.26   ,  71997.4812    },
-	{    350, 247.23   ,  32964.4678    },
-	{    334, 260.87   ,    -19.4410    },
-	{    314, 297.82   , 445267.1117    },
-	{    268, 343.14   ,  45036.8840    },
-	{    242, 166.79   ,      3.1008    },
-	{    234,  81.53   ,  22518.4434    },
-	{    158,   3.50   ,    -19.9739    },
-	{    132, 132.75   ,  65928.9345    },
-	{    129, 182.95   ,   9038.0293    },
-	{    114, 162.03   ,   3034.7684    },
-	{     99,  29.8    ,  33718.148     },
-	{     93, 266.4    ,   3034.448     },
-	{     86, 249.2    ,  -2280.773     },
-	{     78, 157.6    ,  29929.992     },
-	{     72, 257.8    ,  31556.493     },
-	{     68, 185.1    ,    149.588     },
-	{     64,  69.9    ,   9037.750     },
-	{     46,   8.0    , 107997.405     },
-	{     38, 197.1    ,  -4444.176     },
-	{     37, 250.4    ,    151.771     },
-	{     32,  65.3    ,  67555.316     },
-	{     29, 162.7    ,  31556.080     },
-	{     28, 341.5    ,  -4561.540     },
-	{     27, 291.6    , 107996.706     },
-	{     27,  98.5    ,   1221.655     },
-	{     25, 146.7    ,  62894.167     },
-	{     24, 110.0    ,  31437.369     },
-	{     21,   5.2    ,  14578.298     },
-	{     21, 342.6    , -31931.757     },
-	{     20, 230.9    ,  34777.243     },
-	{     18, 256.1    ,   1221.999     },
-	{     17,  45.3    ,  62894.511     },
-	{     14, 242.9    ,  -4442.039     },
-	{     13, 115.2    , 107997.909     },
-	{     13, 151.8    ,    119.066     },
-	{     13, 285.3    ,  16859.071     },
-	{     12,  53.3    ,     -4.578     },
-	{     10, 126.6    ,  26895.292     },
-	{     10, 205.7    ,    -39.127     },
-	{     10,  85.9    ,  12297.536     },
-	{     10, 146.1    ,  90073.778     },
+static const int solar_longitude_x[] = {
+	403406, 195207, 119433, 112392,   3891,   2819,   1721,    660,
+	   350,    334,    314,    268,    242,    234,    158,    132,
+	   129,    114,     99,     93,     86,     78,     72,     68,
+	    64,     46,     38,     37,     32,     29,     28,     27,
+	    27,     25,     24,     21,     21,     20,     18,     17,
+	    14,     13,     13,     13,     12,     10,     10,     10,
+	    10,
+};
+static const double solar_longitude_y[] = {
+	270.54861, 340.19128,  63.91854, 331.26220,   317.843,    86.631,
+	  240.052,    310.26,    247.23,    260.87,    297.82,    343.14,
+	   166.79,     81.53,      3.50,    132.75,    182.95,    162.03,
+	     29.8,     266.4,     249.2,     157.6,     257.8,     185.1,
+	     69.9,       8.0,     197.1,     250.4,      65.3,     162.7,
+	    341.5,     291.6,      98.5,     146.7,     110.0,       5.2,
+	    342.6,     230.9,     256.1,      45.3,     242.9,     115.2,
+	    151.8,     285.3,      53.3,     126.6,     205.7,      85.9,
+	    146.1,
+};
+static const double solar_longitude_z[] = {
+	    0.9287892, 35999.1376958, 35999.4089666, 35998.7287385,
+	  71998.20261,    71998.4403,   36000.35726,    71997.4812,
+	   32964.4678,      -19.4410,   445267.1117,    45036.8840,
+	       3.1008,    22518.4434,      -19.9739,    65928.9345,
+	    9038.0293,     3034.7684,     33718.148,      3034.448,
+	    -2280.773,     29929.992,     31556.493,       149.588,
+	     9037.750,    107997.405,     -4444.176,       151.771,
+	    67555.316,     31556.080,     -4561.540,    107996.706,
+	     1221.655,     62894.167,     31437.369,     14578.298,
+	   -31931.757,     34777.243,      1221.999,     62894.511,
+	    -4442.039,    107997.909,       119.066,     16859.071,
+	       -4.578,     26895.292,       -39.127,     12297.536,
+	    90073.778,
 };
 
 /*
-* Calculate the longitude (in degrees) of Sun at moment $t.
+ * Calculate the longitude (in degrees) of Sun at moment $t.
  * Ref: Sec.(14.4), Eq.(14.33)
  */
-double
-solar_longitude(double t)
+static double
+solar_longitude_series(double t)
 {
 	double c = julian_centuries(t);
 
+	const size_t n = nitems(solar_longitude_x);
+	double arg[nitems(solar_longitude_x)], sine[nitems(solar_longitude_x)];
+	for (size_t i = 0; i < n; i++)
+		arg[i] = solar_longitude_y[i] + solar_longitude_z[i] * c;
+	sin_deg_array(arg, sine, n);
+
 	double sum = 0.0;
-	const struct solar_longitude_arg *arg;
-	for (size_t i = 0; i < nitems(solar_longitude_data); i++) {
-		arg = &solar_longitude_data[i];
-		sum += arg->x * sin_deg(arg->y + arg->z * c);
-	}
+	for (size_t i = 0; i < n; i++)
+		sum += solar_longitude_x[i] * sine[i];
 	double lambda = (282.7771834 + 36000.76953744 * c +
 			 0.000005729577951308232 * sum);
 
@@ -167,6 +161,35 @@ solar_longitude(double t)
 	return mod_f(lambda + ab + nu, 360);
 }
 
+/*
+ * Same as above, but use the tabulated ephemeris if it covers $t.
+ */
+double
+solar_longitude(double t)
+{
+	double lambda;
+
+	if (ephemeris_eval(&solar_longitude_eph, t, &lambda))
+		return lambda;
+	return solar_longitude_series(t);
+}
+
+/*
+ * Estimate the interval [$a, $b] to search for the first time at or after
+ * the given moment $t when the solar longitude will be $lambda degree.
+ */
+static void
+solar_longitude_interval(double lambda, double t, double *a, double *b)
+{
+	double rate = mean_tropical_year / 360.0;
+	double lon = solar_longitude(t);
+	double tau = t + rate * mod_f(lambda - lon, 360);
+
+	/* estimate range (within 5 days) */
+	*a = (t > tau - 5) ? t : tau - 5;
+	*b = tau + 5;
+}
+
 /*
  * Calculate the moment (in universal time) of the first time at or after
  * the given moment $t when the solar longitude will be $lambda degree.
@@ -176,14 +199,136 @@ double
 solar_longitude_atafter(double lambda, double t)
 {
 	double rate = mean_tropical_year / 360.0;
-	double lon = solar_longitude(t);
-	double tau = t + rate * mod_f(lambda - lon, 360);
+	double a, b;
 
-	/* estimate range (within 5 days) */
-	double a = (t > tau - 5) ? t : tau - 5;
-	double b = tau + 5;
+	solar_longitude_interval(lambda, t, &a, &b);
+	return invert_angular_secant(solar_longitude, lambda, a, b, rate);
+}
 
-	return invert_angular(solar_longitude, lambda, a, b);
+/*
+ * Memo of the 24 solar terms (i.e., every 15 degrees of solar longitude)
+ * of the recently used Gregorian years, together with the tight brackets
+ * (see 'invert_angular_bracket()') of their moments.
+ */
+#define SOLAR_TERMS		24
+#define SOLAR_TERMS_CACHE_SIZE	8	/* power of 2 */
+struct solar_term_moment {
+	double	t;	/* moment of longitude (i * 15) degree */
+	double	lo;	/* bracket of the moment */
+	double	hi;
+};
+static struct solar_terms_entry {
+	bool	valid;
+	int	year;
+	struct solar_term_moment terms[SOLAR_TERMS];
+} solar_terms_cache[SOLAR_TERMS_CACHE_SIZE];
+static pthread_mutex_t solar_terms_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Look up the solar term of $lambda degree (a multiple of 15) in Gregorian
+ * year $year from the memo, or sweep the year if it's not there.
+ */
+static void
+solar_term_lookup(int year, int lambda, struct solar_term_moment *term)
+{
+	struct solar_terms_entry *e;
+	struct solar_term_moment terms[SOLAR_TERMS];
+	int i;
+
+	assert(lambda % 15 == 0);
+	i = mod(lambda, 360) / 15;
+	e = &solar_terms_cache[(unsigned int)year &
+			       (SOLAR_TERMS_CACHE_SIZE - 1)];
+	pthread_mutex_lock(&solar_terms_lock);
+	if (e->valid && e->year == year) {
+		*term = e->terms[i];
+		pthread_mutex_unlock(&solar_terms_lock);
+		return;
+	}
+	pthread_mutex_unlock(&solar_terms_lock);
+
+	/*
+	 * Sweep without the lock; a concurrent sweep of the same year just
+	 * stores the same terms.
+	 */
+	solar_terms_sweep(year, terms);
+	pthread_mutex_lock(&solar_terms_lock);
+	memcpy(e->terms, terms, sizeof(e->terms));
+	e->valid = true;
+	e->year = year;
+	pthread_mutex_unlock(&solar_terms_lock);
+
+	*term = terms[i];
+}
+
+/*
+ * Calculate the moment (in universal time) in Gregorian year $year when
+ * the solar longitude is $lambda degree, which must be a multiple of 15,
+ * i.e., one of the solar terms (including the equinoxes and solstices).
+ */
+double
+solar_term(int year, int lambda)
+{
+	struct solar_term_moment term;
+
+	solar_term_lookup(year, lambda, &term);
+	return term.t;
+}
+
+/*
+ * Same as 'solar_longitude_atafter($lambda, $t)' for the solar term of
+ * $lambda degree in Gregorian year $year, but the search is replayed
+ * against the memoized bracket of the term, so that it only costs the
+ * estimate of the search interval.  The result therefore depends on $t
+ * exactly as that of 'solar_longitude_atafter()' does, down to the
+ * printed seconds.
+ */
+double
+solar_term_atafter(int year, int lambda, double t)
+{
+	struct solar_term_moment term;
+	double a, b;
+
+	solar_term_lookup(year, lambda, &term);
+	solar_longitude_interval(lambda, t, &a, &b);
+	return invert_angular_replay(solar_longitude, lambda, a, b,
+				     term.lo, term.hi);
+}
+
+/*
+ * Calculate all the 24 solar terms of Gregorian year $year in one ordered
+ * sweep, from the first term of the year (Xiǎohán at 285 degree, around
+ * January 5) to the last (Dōngzhì at 270 degree, around December 22).
+ * Each term seeds the search of the next one, which is about 15.2 days
+ * later, so the solar longitude at the start needs not be calculated.
+ */
+static void
+solar_terms_sweep(int year, struct solar_term_moment *terms)
+{
+	double rate = mean_tropical_year / 360.0;
+	struct date date = { year, 1, 1 };
+	struct solar_term_moment *term;
+	double a, b, tau;
+	int lambda;
+
+	lambda = 285;
+	solar_longitude_interval(lambda, fixed_from_gregorian(&date),
+				 &a, &b);
+	for (int i = 0; i < SOLAR_TERMS; i++) {
+		if (i > 0) {
+			lambda = (lambda + 15) % 360;
+			tau = term->t + rate * 15.0;
+			a = tau - 5;
+			b = tau + 5;
+		}
+		term = &terms[lambda / 15];
+		term->lo = a;
+		term->hi = b;
+		invert_angular_bracket(solar_longitude, lambda, rate,
+				       &term->lo, &term->hi);
+		term->t = invert_angular_replay(solar_longitude, lambda,
+						a, b, term->lo, term->hi);
+	}
 }
 
 /*
@@ -405,7 +550,7 @@ show_sun_info(double t, const struct location *loc)
 		date.month = event->month;
 		date.day = 1;
 		day_approx = fixed_from_gregorian(&date);
-		t = solar_longitude_atafter(lambda, day_approx) + loc->zone;
+		t = solar_term_atafter(year, lambda, day_approx) + loc->zone;
 		gregorian_from_fixed((int)floor(t), &date);
 		format_time(buf, sizeof(buf), t);
 		printf("%-17s: %3d°, %d-%02d-%02d %s\n",
@@ -47,6 +47,8 @@ double	nutation(double t);
 double	estimate_prior_solar_longitude(double lambda, double t);
 double	solar_longitude(double t);
 double	solar_longitude_atafter(double lambda, double t);
+double	solar_term(int year, int lambda);
+double	solar_term_atafter(int year, int lambda, double t);
 
 double	solar_altitude(double t, double latitude, double longitude);
 
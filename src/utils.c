@@ -39,13 +39,21 @@
  * 2018, Cambridge University Press
  */
 
+#include <sys/uio.h>
+
 #include <err.h>
+#include <errno.h>
+#include <float.h>
 #include <math.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "utils.h"
 
@@ -65,6 +73,69 @@ poly(double x, const double *coefs, size_t n)
 	return p;
 }
 
+/*
+ * Kernel to calculate $result = sin_deg($x), where $type is either double
+ * or a vector of doubles.  The angle is reduced to $q * 90 + $f degrees,
+ * with $q in [-2, 2] and $f in [-45, 45], and then sin($f) and cos($f)
+ * are calculated with the Taylor series (error < 1e-16).  There is no
+ * branch or library call, so that it can be vectorized.
+ * NOTE: Rounding by adding and subtracting 1.5 * 2^52 needs the additions
+ * to be evaluated in double precision (i.e., FLT_EVAL_METHOD == 0, not
+ * on the x87 FPU) and is valid for |$x| < 2^51 degrees; otherwise, use
+ * 'nearbyint()' and only the scalar kernel.
+ */
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+#define SIN_DEG_ROUND(v)	(((v) + 0x1.8p52) - 0x1.8p52)
+#define SIN_DEG_VECTOR		1
+#else
+#define SIN_DEG_ROUND(v)	nearbyint(v)
+#endif
+#define SIN_DEG_KERNEL(type, x, result)	do {				\
+	type r_ = (x) / 360.0;						\
+	type y_ = 4.0 * (r_ - SIN_DEG_ROUND(r_));			\
+	type q_ = SIN_DEG_ROUND(y_);					\
+	type f_ = (y_ - q_) * (M_PI / 2.0);				\
+	type f2_ = f_ * f_;						\
+	type s_ = f_ * (1.0 + f2_ * (-1.0/6 + f2_ * (1.0/120 +		\
+		f2_ * (-1.0/5040 + f2_ * (1.0/362880 +			\
+		f2_ * (-1.0/39916800 + f2_ * (1.0/6227020800 +		\
+		f2_ * (-1.0/1307674368000))))))));			\
+	type c_ = 1.0 + f2_ * (-1.0/2 + f2_ * (1.0/24 +			\
+		f2_ * (-1.0/720 + f2_ * (1.0/40320 +			\
+		f2_ * (-1.0/3628800 + f2_ * (1.0/479001600 +		\
+		f2_ * (-1.0/87178291200 +				\
+		f2_ * (1.0/20922789888000))))))));			\
+	/* $q is odd iff q^2 == 1 */					\
+	type e_ = q_ * q_;						\
+	type odd_ = e_ * (4.0 - e_) / 3.0;				\
+	(result) = odd_ * q_ * c_ + (1.0 - odd_) * s_ * (1.0 - e_ / 2.0); \
+} while (0)
+
+/*
+ * Calculate sin_deg() of the $n angles (in degrees) in $x and save the
+ * results in $y.  Use the vector extension of GCC/Clang (i.e., SSE2/AVX2
+ * or alike, depending on the target) if available.
+ */
+void
+sin_deg_array(const double *x, double *y, size_t n)
+{
+	size_t i = 0;
+
+#if defined(__GNUC__) && defined(SIN_DEG_VECTOR)
+	typedef double v4df __attribute__((vector_size(4 * sizeof(double))));
+	v4df vx, vy;
+
+	for (; i + 4 <= n; i += 4) {
+		memcpy(&vx, &x[i], sizeof(vx));
+		SIN_DEG_KERNEL(v4df, vx, vy);
+		memcpy(&y[i], &vy, sizeof(vy));
+	}
+#endif
+
+	for (; i < n; i++)
+		SIN_DEG_KERNEL(double, x[i], y[i]);
+}
+
 /*
  * Use bisection search to find the inverse of the given angular function
  * $f(x) at value $y (degrees) within time interval [$a, $b].
@@ -87,128 +158,471 @@ invert_angular(double (*f)(double), double y, double a, double b)
 	return x;
 }
 
+/*
+ * Narrow the interval [$lo, $hi] bracketing the inverse of the given
+ * angular function $f(x) at value $y (degrees) down to 1e-8 days with the
+ * secant method, which starts with the mean rate $rate (days per degree)
+ * of $f(x) as the derivative hint, and falls back to bisection whenever
+ * the step leaves the bracket.  Each step slightly overshoots, so that the
+ * root soon gets bracketed tightly from both sides.
+ * It takes about 5 evaluations of $f(x).
+ */
+void
+invert_angular_bracket(double (*f)(double), double y, double rate,
+		       double *lo, double *hi)
+{
+	static const double eps = 1e-8;
+	double x, g, x_prev, g_prev, slope;
+
+	slope = 1.0 / rate;
+	x = (*lo + *hi) / 2.0;
+	x_prev = g_prev = NAN;
+
+	for (int i = 0; i < 100; i++) {
+		g = mod3_f(f(x) - y, -180, 180);
+		if (g >= 0.0)
+			*hi = x;
+		else
+			*lo = x;
+		if (*hi - *lo < eps)
+			break;
+
+		if (!isnan(x_prev) && g != g_prev &&
+		    (g - g_prev) / (x - x_prev) > 0.0)
+			slope = (g - g_prev) / (x - x_prev);
+		x_prev = x;
+		g_prev = g;
+
+		x -= g / slope;
+		x += (g < 0.0) ? eps / 2.0 : -eps / 2.0;
+		if (!(x > *lo && x < *hi))
+			x = (*lo + *hi) / 2.0;
+	}
+}
 
 /*
- * Like malloc(3) but exit if allocation fails.
+ * Replay the bisection of 'invert_angular()' over [$a, $b] against the
+ * bracket [$lo, $hi] from 'invert_angular_bracket()', so that the result
+ * is identical to it; $f(x) is only evaluated for a midpoint that falls
+ * into the bracket, which is rare.
+ */
+double
+invert_angular_replay(double (*f)(double), double y, double a, double b,
+		      double lo, double hi)
+{
+	static const double eps = 1e-6;
+	double x;
+
+	do {
+		x = (a + b) / 2.0;
+		if (x >= hi ||
+		    (x > lo && mod_f(f(x) - y, 360) < 180.0))
+			b = x;
+		else
+			a = x;
+	} while (fabs(a-b) >= eps);
+
+	return x;
+}
+
+/*
+ * Same as 'invert_angular()', but bracket the inverse with the secant
+ * method first (see above), with the mean rate $rate (days per degree)
+ * of $f(x).
+ * It takes about 5 evaluations of $f(x) instead of about 23.
+ */
+double
+invert_angular_secant(double (*f)(double), double y, double a, double b,
+		      double rate)
+{
+	double lo = a, hi = b;
+
+	invert_angular_bracket(f, y, rate, &lo, &hi);
+	return invert_angular_replay(f, y, a, b, lo, hi);
+}
+
+
+/*
+ * Recovery points of the fatal errors, per thread.  A library call (see
+ * context.c) sets one to fail the call instead of exiting the process,
+ * and so does a worker of the thread pool (see pool.c).
+ */
+static pthread_key_t fatal_key;
+static pthread_once_t fatal_once = PTHREAD_ONCE_INIT;
+
+static void
+fatal_init(void)
+{
+	if (pthread_key_create(&fatal_key, NULL) != 0)
+		errx(1, "%s: pthread_key_create", __func__);
+}
+
+/*
+ * Set the recovery point $fj of the calling thread, which must then be
+ * armed by setjmp($fj->env) and removed by fatal_pop() before the caller
+ * returns.
+ */
+void
+fatal_push(struct fatal_jmp *fj)
+{
+	pthread_once(&fatal_once, fatal_init);
+	fj->prev = pthread_getspecific(fatal_key);
+	pthread_setspecific(fatal_key, fj);
+}
+
+void
+fatal_pop(struct fatal_jmp *fj)
+{
+	pthread_setspecific(fatal_key, fj->prev);
+}
+
+/*
+ * Report the fatal error, and then jump to the recovery point of the
+ * calling thread (which is removed), or exit if there is none.  The
+ * memory allocated by the interrupted code may be leaked, and no lock
+ * may be held when raising it.
+ */
+void
+fatal(const char *fmt, ...)
+{
+	struct fatal_jmp *fj;
+	va_list ap;
+
+	va_start(ap, fmt);
+	vwarnx(fmt, ap);
+	va_end(ap);
+
+	pthread_once(&fatal_once, fatal_init);
+	if ((fj = pthread_getspecific(fatal_key)) == NULL)
+		exit(1);
+
+	pthread_setspecific(fatal_key, fj->prev);
+	longjmp(fj->env, 1);
+}
+
+
+/*
+ * Like malloc(3) but fail if allocation fails.
  */
 void *
 xmalloc(size_t size)
 {
 	void *ptr = malloc(size);
 	if (ptr == NULL)
-		errx(1, "mcalloc(%zu): out of memory", size);
+		fatal("mcalloc(%zu): out of memory", size);
 	return ptr;
 }
 
 /*
- * Like calloc(3) but exit if allocation fails.
+ * Like calloc(3) but fail if allocation fails.
  */
 void *
 xcalloc(size_t number, size_t size)
 {
 	void *ptr = calloc(number, size);
 	if (ptr == NULL)
-		errx(1, "xcalloc(%zu, %zu): out of memory", number, size);
+		fatal("xcalloc(%zu, %zu): out of memory", number, size);
 	return ptr;
 }
 
 /*
- * Like realloc(3) but exit if allocation fails.
+ * Like realloc(3) but fail if allocation fails.
  */
 void *
 xrealloc(void *ptr, size_t size)
 {
 	ptr = realloc(ptr, size);
 	if (ptr == NULL)
-		errx(1, "xrealloc: out of memory (size: %zu)", size);
+		fatal("xrealloc: out of memory (size: %zu)", size);
 	return ptr;
 }
 
 /*
- * Like strdup(3) but exit if fail.
+ * Like strdup(3) but fail if fail.
  */
 char *
 xstrdup(const char *str)
 {
 	char *p = strdup(str);
 	if (p == NULL)
-		errx(1, "xstrdup: out of memory (length: %zu)", strlen(str));
+		fatal("xstrdup: out of memory (length: %zu)", strlen(str));
 	return p;
 }
 
 
 /*
- * Linked list implementation
+ * Arena (bump) allocator for the objects living as long as one run of
+ * cal() (e.g., the event descriptions and the events), which are then
+ * released at once by arena_freeall() instead of one by one.
  */
 
-struct node {
-	char		*name;
-	void		*data;
-	struct node	*next;
+#define ARENA_CHUNK_SIZE	(64 * 1024)
+
+/* Alignment of the arena allocations */
+union arena_align {
+	long double	ld;
+	long long	ll;
+	void		*ptr;
+	void		(*fn)(void);
+};
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t	size;		/* size of the data area */
+	size_t	used;
+	union arena_align data[];
 };
 
 /*
- * Create a new list node with the given $name and $data.
+ * Allocate zero-filled memory of $size bytes from the arena $arena.
  */
-struct node *
-list_newnode(char *name, void *data)
+void *
+arena_alloc(struct arena *arena, size_t size)
+{
+	struct arena_chunk *chunk;
+	size_t align = sizeof(union arena_align);
+	size_t n;
+	void *ptr;
+
+	size = (size + align - 1) / align * align;
+	chunk = arena->chunks;
+	if (chunk == NULL || chunk->size - chunk->used < size) {
+		n = (size > ARENA_CHUNK_SIZE / 4) ? size : ARENA_CHUNK_SIZE;
+		chunk = xmalloc(sizeof(*chunk) + n);
+		chunk->size = n;
+		chunk->used = 0;
+		if (n == size && arena->chunks != NULL) {
+			/* Keep using the current chunk for small objects */
+			chunk->next = arena->chunks->next;
+			arena->chunks->next = chunk;
+		} else {
+			chunk->next = arena->chunks;
+			arena->chunks = chunk;
+		}
+	}
+
+	ptr = (char *)chunk->data + chunk->used;
+	chunk->used += size;
+	memset(ptr, 0, size);
+	return ptr;
+}
+
+/*
+ * Like xstrdup() but allocate from the arena.
+ */
+char *
+arena_strdup(struct arena *arena, const char *str)
+{
+	size_t len = strlen(str) + 1;
+
+	return memcpy(arena_alloc(arena, len), str, len);
+}
+
+/*
+ * Release all the memory allocated from the arena $arena.
+ */
+void
+arena_freeall(struct arena *arena)
+{
+	struct arena_chunk *chunk;
+
+	while ((chunk = arena->chunks) != NULL) {
+		arena->chunks = chunk->next;
+		free(chunk);
+	}
+}
+
+/*
+ * Growable string buffer, e.g., to format the output in memory and then
+ * write it at once.
+ */
+
+void
+strbuf_append(struct strbuf *sb, const char *s, size_t len)
+{
+	if (sb->cap - sb->len <= len) {
+		while (sb->cap - sb->len <= len)
+			sb->cap = (sb->cap > 0) ? sb->cap * 2 : 4096;
+		sb->data = xrealloc(sb->data, sb->cap);
+	}
+	memcpy(sb->data + sb->len, s, len);
+	sb->len += len;
+	sb->data[sb->len] = '\0';
+}
+
+void
+strbuf_puts(struct strbuf *sb, const char *s)
+{
+	strbuf_append(sb, s, strlen(s));
+}
+
+void
+strbuf_putc(struct strbuf *sb, char ch)
+{
+	strbuf_append(sb, &ch, 1);
+}
+
+void
+strbuf_printf(struct strbuf *sb, const char *fmt, ...)
 {
-	struct node *newp;
+	va_list ap;
+	char buf[1024];
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if (n < 0)
+		fatal("%s: invalid format: |%s|", __func__, fmt);
 
-	newp = xcalloc(1, sizeof(*newp));
-	newp->name = name;
-	newp->data = data;
+	if ((size_t)n < sizeof(buf)) {
+		strbuf_append(sb, buf, (size_t)n);
+	} else {
+		char *p = xmalloc((size_t)n + 1);
+		va_start(ap, fmt);
+		vsnprintf(p, (size_t)n + 1, fmt, ap);
+		va_end(ap);
+		strbuf_append(sb, p, (size_t)n);
+		free(p);
+	}
+}
 
-	return newp;
+void
+strbuf_free(struct strbuf *sb)
+{
+	free(sb->data);
+	memset(sb, 0, sizeof(*sb));
 }
 
 /*
- * Add $newp to the front of list $listp.
+ * Write all the $iovcnt buffers of $iov to $fd, resuming after partial
+ * writes and interruptions.  The $iov array is modified.
  */
-struct node *
-list_addfront(struct node *listp, struct node *newp)
+bool
+write_iov(int fd, struct iovec *iov, int iovcnt)
 {
-	newp->next = listp;
-	return newp;
+	ssize_t n;
+
+	while (iovcnt > 0) {
+		if (iov->iov_len == 0) {
+			iov++;
+			iovcnt--;
+			continue;
+		}
+		if ((n = writev(fd, iov, iovcnt)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+			n -= (ssize_t)iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= (size_t)n;
+		}
+	}
+
+	return true;
 }
 
+
 /*
- * Lookup the given $name in the list $listp.
- * The $cmp function compares two names and return 0 if they equal.
- * Return the associated data with the found node, otherwise NULL.
+ * String table implemented as an open-addressing hash table with linear
+ * probing.  The keys are copied, and the associated data are owned by
+ * the table.
+ */
+
+struct strtab_slot {
+	char	*key;		/* NULL if empty */
+	void	*data;
+};
+
+static struct strtab_slot *
+strtab_find(const struct strtab *tab, const char *key)
+{
+	struct strtab_slot *slot;
+	size_t mask = tab->cap - 1;
+	size_t i;
+
+	i = (size_t)hash_string(HASH_INIT, key) & mask;
+	for (;;) {
+		slot = &tab->slots[i];
+		if (slot->key == NULL || strcmp(slot->key, key) == 0)
+			return slot;
+		i = (i + 1) & mask;
+	}
+}
+
+/*
+ * Add $key with $data to the table $tab.  Return false if $key already
+ * exists, in which case its data is not changed.
  */
 bool
-list_lookup(struct node *listp, const char *name,
-	    int (*cmp)(const char *, const char *), void **data_out)
-{
-	for ( ; listp; listp = listp->next) {
-		if ((*cmp)(name, listp->name) == 0) {
-			if (data_out)
-				*data_out = listp->data;
-			return true;
+strtab_add(struct strtab *tab, const char *key, void *data)
+{
+	struct strtab_slot *slots, *slot;
+	size_t cap;
+
+	/* Keep the load factor below 3/4 */
+	if ((tab->count + 1) * 4 > tab->cap * 3) {
+		slots = tab->slots;
+		cap = tab->cap;
+		tab->cap = (cap > 0) ? cap * 2 : 64;
+		tab->slots = xcalloc(tab->cap, sizeof(*tab->slots));
+		for (size_t i = 0; i < cap; i++) {
+			if (slots[i].key != NULL)
+				*strtab_find(tab, slots[i].key) = slots[i];
 		}
+		free(slots);
 	}
 
-	return false;
+	slot = strtab_find(tab, key);
+	if (slot->key != NULL)
+		return false;
+
+	slot->key = xstrdup(key);
+	slot->data = data;
+	tab->count++;
+	return true;
 }
 
 /*
- * Free all nodes of list $listp.
+ * Lookup the given $key in the table $tab.
+ * Return true if found, and store its associated data in $data_out.
  */
-void
-list_freeall(struct node *listp,
-	     void (*free_name)(void *),
-	     void (*free_data)(void *))
+bool
+strtab_lookup(const struct strtab *tab, const char *key, void **data_out)
 {
-	struct node *cur;
+	struct strtab_slot *slot;
+
+	if (tab->count == 0)
+		return false;
+
+	slot = strtab_find(tab, key);
+	if (slot->key == NULL)
+		return false;
+
+	if (data_out)
+		*data_out = slot->data;
+	return true;
+}
 
-	while (listp) {
-		cur = listp;
-		listp = listp->next;
-		if (free_name)
-			(*free_name)(cur->name);
+/*
+ * Free all entries of table $tab, with $free_data to free the data.
+ */
+void
+strtab_freeall(struct strtab *tab, void (*free_data)(void *))
+{
+	for (size_t i = 0; i < tab->cap; i++) {
+		if (tab->slots[i].key == NULL)
+			continue;
+		free(tab->slots[i].key);
 		if (free_data)
-			(*free_data)(cur->data);
-		free(cur);
+			(*free_data)(tab->slots[i].data);
 	}
+	free(tab->slots);
+	memset(tab, 0, sizeof(*tab));
 }
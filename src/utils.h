@@ -41,14 +41,27 @@
 #include <err.h>
 #include <errno.h>
 #include <math.h>
+#include <setjmp.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 
 #ifndef nitems
 #define nitems(x)	(sizeof(x) / sizeof((x)[0]))
 #endif
 
+/* Recovery point of the fatal errors (see fatal()) */
+struct fatal_jmp {
+	jmp_buf		 env;
+	struct fatal_jmp *prev;
+};
+
+void	fatal_push(struct fatal_jmp *fj);
+void	fatal_pop(struct fatal_jmp *fj);
+void	fatal(const char *fmt, ...)
+		__attribute__((__noreturn__, __format__(__printf__, 1, 2)));
+
 
 /*
  * Return true if string $s1 starts with the string $s2.
@@ -104,6 +117,27 @@ trimr(char *s)
 	return s;
 }
 
+/* Initial value of the 64-bit FNV-1a hash */
+#define HASH_INIT	UINT64_C(0xcbf29ce484222325)
+
+/*
+ * Update the FNV-1a hash $h with the string $s, including its
+ * terminating NUL so that concatenated strings hash differently.
+ * A NULL string is hashed the same as an empty string.
+ */
+static inline uint64_t
+hash_string(uint64_t h, const char *s)
+{
+	if (s != NULL) {
+		for ( ; *s; s++) {
+			h ^= (unsigned char)*s;
+			h *= UINT64_C(0x100000001b3);
+		}
+	}
+	h *= UINT64_C(0x100000001b3);  /* the terminating NUL */
+	return h;
+}
+
 
 /*
  * Swap the values of two integers.
@@ -237,7 +271,7 @@ arctan_deg(double y, double x)
 	errno = 0;
 	double v = atan2(y, x);
 	if (errno == EDOM)
-		errx(10, "%s(%g, %g) invalid!", __func__, y, x);
+		fatal("%s(%g, %g) invalid!", __func__, y, x);
 	return mod_f(v * 180.0 / M_PI, 360);
 }
 
@@ -252,20 +286,55 @@ angle2deg(int deg, int min, double sec)
 
 
 double	poly(double x, const double *coefs, size_t n);
+void	sin_deg_array(const double *x, double *y, size_t n);
 double	invert_angular(double (*f)(double), double y, double a, double b);
+void	invert_angular_bracket(double (*f)(double), double y, double rate,
+			       double *lo, double *hi);
+double	invert_angular_replay(double (*f)(double), double y, double a,
+			      double b, double lo, double hi);
+double	invert_angular_secant(double (*f)(double), double y, double a,
+			      double b, double rate);
 
 void *	xmalloc(size_t size);
 void *	xcalloc(size_t number, size_t size);
 void *	xrealloc(void *ptr, size_t size);
 char *	xstrdup(const char *str);
 
-struct node;
-struct node *	list_newnode(char *name, void *data);
-struct node *	list_addfront(struct node *listp, struct node *newp);
-bool		list_lookup(struct node *listp, const char *name,
-			    int (*cmp)(const char *, const char *),
-			    void **data_out);
-void		list_freeall(struct node *listp, void (*free_name)(void *),
-			     void (*free_data)(void *));
+struct arena_chunk;
+struct arena {
+	struct arena_chunk *chunks;
+};
+
+void *	arena_alloc(struct arena *arena, size_t size);
+char *	arena_strdup(struct arena *arena, const char *str);
+void	arena_freeall(struct arena *arena);
+
+struct strbuf {
+	char	*data;		/* NUL-terminated */
+	size_t	 len;
+	size_t	 cap;
+};
+
+void	strbuf_append(struct strbuf *sb, const char *s, size_t len);
+void	strbuf_puts(struct strbuf *sb, const char *s);
+void	strbuf_putc(struct strbuf *sb, char ch);
+void	strbuf_printf(struct strbuf *sb, const char *fmt, ...)
+		__attribute__((__format__(__printf__, 2, 3)));
+void	strbuf_free(struct strbuf *sb);
+
+struct iovec;
+bool	write_iov(int fd, struct iovec *iov, int iovcnt);
+
+struct strtab_slot;
+struct strtab {
+	struct strtab_slot *slots;
+	size_t	 cap;		/* power of 2 */
+	size_t	 count;
+};
+
+bool	strtab_add(struct strtab *tab, const char *key, void *data);
+bool	strtab_lookup(const struct strtab *tab, const char *key,
+		      void **data_out);
+void	strtab_freeall(struct strtab *tab, void (*free_data)(void *));
 
 #endif
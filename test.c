@@ -1,34 +1,39 @@
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <dirent.h>
 #include <err.h>
+#include <fcntl.h>
+#include <langinfo.h>
+#include <limits.h>
+#include <locale.h>
 #include <math.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <wchar.h>
+#include <wctype.h>
 
 #include "calendar.h"
 #include "basics.h"
+#include "cache.h"
 #include "chinese.h"
 #include "ecclesiastical.h"
+#include "ephemeris.h"
 #include "gregorian.h"
 #include "julian.h"
+#include "libcalendar.h"
 #include "moon.h"
+#include "nnames.h"
 #include "parsedata.h"
+#include "server.h"
 #include "sun.h"
 #include "utils.h"
 
 
-/*
- * globals
- * for compatible with calendar.c ... files
- */
-struct cal_options Options;
-struct calendar *Calendar;
-const char *calendarDirs[] = { NULL };
-
-bool set_calendar(const char *name __unused) { return true; }
-
-
 static void
 test1(void)
 {
@@ -319,6 +324,896 @@ test3()
 	}
 }
 
+/*
+ * Compare the tabulated ephemeris against the series over the span of
+ * years [$year1, $year2], and benchmark them.
+ */
+static void
+test_ephemeris(int year1, int year2)
+{
+	static const struct {
+		const char *name;
+		double (*func)(double t);
+		bool angular;
+	} funcs[] = {
+		{ "solar_longitude", solar_longitude, true },
+		{ "lunar_longitude", lunar_longitude, true },
+		{ "lunar_latitude", lunar_latitude, false },
+		{ "lunar_distance", lunar_distance, false },
+	};
+	const double step = 0.0371;  /* not commensurate with segments */
+	double t_begin = gregorian_new_year(year1);
+	double t_end = gregorian_new_year(year2 + 1);
+	size_t n = (size_t)((t_end - t_begin) / step);
+	double *values = xcalloc(n, sizeof(*values));
+	double err, maxerr, t_series, t_cold, t_warm;
+	struct timespec ts1, ts2;
+
+	printf("\n-----------------------------------------------------------\n");
+	printf("Ephemeris [%d, %d]: %zu samples per function\n",
+	       year1, year2, n);
+	printf("Function\tMaxError\tSeries[s]\tCold[s]\tWarm[s]\tSpeedup\n");
+
+	for (size_t i = 0; i < nitems(funcs); i++) {
+		/* the series, as the ephemeris is not enabled yet */
+		ephemeris_set_span(year1, year1 - 1);
+		clock_gettime(CLOCK_MONOTONIC, &ts1);
+		for (size_t k = 0; k < n; k++)
+			values[k] = (funcs[i].func)(t_begin + (double)k * step);
+		clock_gettime(CLOCK_MONOTONIC, &ts2);
+		t_series = (double)(ts2.tv_sec - ts1.tv_sec) +
+			(double)(ts2.tv_nsec - ts1.tv_nsec) / 1e9;
+
+		/* the first pass also builds the segments */
+		ephemeris_set_span(year1, year2);
+		maxerr = 0.0;
+		clock_gettime(CLOCK_MONOTONIC, &ts1);
+		for (size_t k = 0; k < n; k++) {
+			err = (funcs[i].func)(t_begin + (double)k * step) -
+				values[k];
+			if (funcs[i].angular)
+				err = mod3_f(err, -180, 180);
+			if (fabs(err) > maxerr)
+				maxerr = fabs(err);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &ts2);
+		t_cold = (double)(ts2.tv_sec - ts1.tv_sec) +
+			(double)(ts2.tv_nsec - ts1.tv_nsec) / 1e9;
+
+		clock_gettime(CLOCK_MONOTONIC, &ts1);
+		for (size_t k = 0; k < n; k++)
+			values[k] = (funcs[i].func)(t_begin + (double)k * step);
+		clock_gettime(CLOCK_MONOTONIC, &ts2);
+		t_warm = (double)(ts2.tv_sec - ts1.tv_sec) +
+			(double)(ts2.tv_nsec - ts1.tv_nsec) / 1e9;
+
+		printf("%s\t%.3e\t%.3f\t\t%.3f\t%.3f\t%.1fx\n",
+		       funcs[i].name, maxerr, t_series, t_cold, t_warm,
+		       t_series / t_warm);
+	}
+
+	free(values);
+}
+
+static unsigned long nevals;
+
+static double
+solar_longitude_counted(double t)
+{
+	nevals++;
+	return solar_longitude(t);
+}
+
+static double
+lunar_phase_counted(double t)
+{
+	nevals++;
+	return lunar_phase(t);
+}
+
+/*
+ * Compare the bisection and secant inversions of the solar longitude and
+ * lunar phase, for the equinoxes, solstices and the four lunar phases
+ * over the years [$year1, $year2], which must be identical.
+ */
+static void
+test_invert(int year1, int year2)
+{
+	const struct {
+		const char *name;
+		double (*func)(double t);
+		double rate;  /* days per degree */
+		double range;  /* days around the estimate */
+	} funcs[] = {
+		{ "solar_longitude", solar_longitude_counted,
+		  mean_tropical_year / 360.0, 5.0 },
+		{ "lunar_phase", lunar_phase_counted,
+		  mean_synodic_month / 360.0, 2.0 },
+	};
+	double t_begin = gregorian_new_year(year1);
+	double t_end = gregorian_new_year(year2 + 1);
+	double t, y, tau, a, b, x1, x2, maxdiff;
+	unsigned long n1, n2, count, mismatches;
+
+	printf("\n-----------------------------------------------------------\n");
+	printf("Inversion [%d, %d]\n", year1, year2);
+	printf("Function\tCount\tBisection\tSecant\tMaxDiff[s]\tDateDiffs\n");
+
+	for (size_t i = 0; i < nitems(funcs); i++) {
+		n1 = n2 = count = mismatches = 0;
+		maxdiff = 0.0;
+		for (t = t_begin; t < t_end; t = x2 + 1.0) {
+			/* the next multiple of 90 degrees */
+			y = mod_f(ceil((funcs[i].func)(t) / 90.0) * 90.0, 360);
+			tau = t + funcs[i].rate *
+				mod_f(y - (funcs[i].func)(t), 360);
+			a = (t > tau - funcs[i].range) ? t : tau - funcs[i].range;
+			b = tau + funcs[i].range;
+
+			nevals = 0;
+			x1 = invert_angular(funcs[i].func, y, a, b);
+			n1 += nevals;
+			nevals = 0;
+			x2 = invert_angular_secant(funcs[i].func, y, a, b,
+						   funcs[i].rate);
+			n2 += nevals;
+
+			count++;
+			if (fabs(x1 - x2) > maxdiff)
+				maxdiff = fabs(x1 - x2);
+			if (floor(x1) != floor(x2))
+				mismatches++;
+		}
+		printf("%s\t%lu\t%.1f\t\t%.1f\t%.4f\t\t%lu\n",
+		       funcs[i].name, count, (double)n1 / (double)count,
+		       (double)n2 / (double)count, maxdiff * 86400.0,
+		       mismatches);
+		if (maxdiff > 0.0)
+			errx(1, "%s: secant differs from bisection",
+			     funcs[i].name);
+	}
+
+	/*
+	 * The memoized solar terms and lunar events must be found exactly
+	 * as the searches from the same moments, as 'show_sun_info()',
+	 * 'show_chinese_calendar()' and 'show_moon_info()' do.
+	 */
+	for (int year = year1; year <= year2; year++) {
+		struct date date = { year, 2, 1 };
+		t = fixed_from_gregorian(&date);
+		for (int lambda = 315; lambda < 315 + 360; lambda += 15) {
+			y = mod(lambda, 360);
+			x1 = solar_longitude_atafter(y, floor(t));
+			x2 = solar_term_atafter((lambda >= 645) ? year + 1 : year,
+						(int)y, floor(t));
+			if (x1 != x2) {
+				errx(1, "solar_term_atafter: %d° in %d differs",
+				     (int)y, year);
+			}
+			t = x1;
+		}
+	}
+
+	struct lunar_event *events;
+	size_t nevents = lunar_events(t_begin, t_end, LUNAR_PHASES_ALL,
+				      &events);
+	for (size_t i = 1; i < nevents; i++) {
+		t = events[i-1].t + 0.5;  /* as if in a zone of +12:00 */
+		if (events[i].phase == LUNAR_NEW_MOON)
+			continue;
+		x1 = lunar_phase_atafter(90.0 * events[i].phase, t);
+		x2 = lunar_event_atafter(&events[i], t);
+		if (x1 != x2)
+			errx(1, "lunar_event_atafter: %.6f differs", x1);
+	}
+	free(events);
+	printf("Memoized solar terms and lunar events: OK\n");
+}
+
+/*
+ * Reference data and series of the solar and lunar longitudes, which sum
+ * up the terms one by one with 'sin_deg()', as before the batched
+ * evaluation with 'sin_deg_array()'.
+ * Ref: Sec.(14.4), Table(14.1); Sec.(14.6), Table(14.5)
+ */
+static const struct {
+	int	x;
+	double	y;
+	double	z;
+} ref_solar_longitude_data[] = {
+	{ 403406, 270.54861,      0.9287892 },
+	{ 195207, 340.19128,  35999.1376958 },
+	{ 119433,  63.91854,  35999.4089666 },
+	{ 112392, 331.26220,  35998.7287385 },
+	{   3891, 317.843  ,  71998.20261   },
+	{   2819,  86.631  ,  71998.4403    },
+	{   1721, 240.052  ,  36000.35726   },
+	{    660, 310.26   ,  71997.4812    },
+	{    350, 247.23   ,  32964.4678    },
+	{    334, 260.87   ,    -19.4410    },
+	{    314, 297.82   , 445267.1117    },
+	{    268, 343.14   ,  45036.8840    },
+	{    242, 166.79   ,      3.1008    },
+	{    234,  81.53   ,  22518.4434    },
+	{    158,   3.50   ,    -19.9739    },
+	{    132, 132.75   ,  65928.9345    },
+	{    129, 182.95   ,   9038.0293    },
+	{    114, 162.03   ,   3034.7684    },
+	{     99,  29.8    ,  33718.148     },
+	{     93, 266.4    ,   3034.448     },
+	{     86, 249.2    ,  -2280.773     },
+	{     78, 157.6    ,  29929.992     },
+	{     72, 257.8    ,  31556.493     },
+	{     68, 185.1    ,    149.588     },
+	{     64,  69.9    ,   9037.750     },
+	{     46,   8.0    , 107997.405     },
+	{     38, 197.1    ,  -4444.176     },
+	{     37, 250.4    ,    151.771     },
+	{     32,  65.3    ,  67555.316     },
+	{     29, 162.7    ,  31556.080     },
+	{     28, 341.5    ,  -4561.540     },
+	{     27, 291.6    , 107996.706     },
+	{     27,  98.5    ,   1221.655     },
+	{     25, 146.7    ,  62894.167     },
+	{     24, 110.0    ,  31437.369     },
+	{     21,   5.2    ,  14578.298     },
+	{     21, 342.6    , -31931.757     },
+	{     20, 230.9    ,  34777.243     },
+	{     18, 256.1    ,   1221.999     },
+	{     17,  45.3    ,  62894.511     },
+	{     14, 242.9    ,  -4442.039     },
+	{     13, 115.2    , 107997.909     },
+	{     13, 151.8    ,    119.066     },
+	{     13, 285.3    ,  16859.071     },
+	{     12,  53.3    ,     -4.578     },
+	{     10, 126.6    ,  26895.292     },
+	{     10, 205.7    ,    -39.127     },
+	{     10,  85.9    ,  12297.536     },
+	{     10, 146.1    ,  90073.778     },
+};
+
+static const struct {
+	int	v;
+	int	w;
+	int	x;
+	int	y;
+	int	z;
+} ref_lunar_longitude_data[] = {
+	{ 6288774, 0,  0,  1,  0 },
+	{ 1274027, 2,  0, -1,  0 },
+	{  658314, 2,  0,  0,  0 },
+	{  213618, 0,  0,  2,  0 },
+	{ -185116, 0,  1,  0,  0 },
+	{ -114332, 0,  0,  0,  2 },
+	{   58793, 2,  0, -2,  0 },
+	{   57066, 2, -1, -1,  0 },
+	{   53322, 2,  0,  1,  0 },
+	{   45758, 2, -1,  0,  0 },
+	{  -40923, 0,  1, -1,  0 },
+	{  -34720, 1,  0,  0,  0 },
+	{  -30383, 0,  1,  1,  0 },
+	{   15327, 2,  0,  0, -2 },
+	{  -12528, 0,  0,  1,  2 },
+	{   10980, 0,  0,  1, -2 },
+	{   10675, 4,  0, -1,  0 },
+	{   10034, 0,  0,  3,  0 },
+	{    8548, 4,  0, -2,  0 },
+	{   -7888, 2,  1, -1,  0 },
+	{   -6766, 2,  1,  0,  0 },
+	{   -5163, 1,  0, -1,  0 },
+	{    4987, 1,  1,  0,  0 },
+	{    4036, 2, -1,  1,  0 },
+	{    3994, 2,  0,  2,  0 },
+	{    3861, 4,  0,  0,  0 },
+	{    3665, 2,  0, -3,  0 },
+	{   -2689, 0,  1, -2,  0 },
+	{   -2602, 2,  0, -1,  2 },
+	{    2390, 2, -1, -2,  0 },
+	{   -2348, 1,  0,  1,  0 },
+	{    2236, 2, -2,  0,  0 },
+	{   -2120, 0,  1,  2,  0 },
+	{   -2069, 0,  2,  0,  0 },
+	{    2048, 2, -2, -1,  0 },
+	{   -1773, 2,  0,  1, -2 },
+	{   -1595, 2,  0,  0,  2 },
+	{    1215, 4, -1, -1,  0 },
+	{   -1110, 0,  0,  2,  2 },
+	{    -892, 3,  0, -1,  0 },
+	{    -810, 2,  1,  1,  0 },
+	{     759, 4, -1, -2,  0 },
+	{    -713, 0,  2, -1,  0 },
+	{    -700, 2,  2, -1,  0 },
+	{     691, 2,  1, -2,  0 },
+	{     596, 2, -1,  0, -2 },
+	{     549, 4,  0,  1,  0 },
+	{     537, 0,  0,  4,  0 },
+	{     520, 4, -1,  0,  0 },
+	{    -487, 1,  0, -2,  0 },
+	{    -399, 2,  1,  0, -2 },
+	{    -381, 0,  0,  2, -2 },
+	{     351, 1,  1,  1,  0 },
+	{    -340, 3,  0, -2,  0 },
+	{     330, 4,  0, -3,  0 },
+	{     327, 2, -1,  2,  0 },
+	{    -323, 0,  2,  1,  0 },
+	{     299, 1,  1, -1,  0 },
+	{     294, 2,  0,  3,  0 },
+};
+
+static double
+ref_solar_longitude(double t)
+{
+	double c = julian_centuries(t);
+	double sum = 0.0;
+
+	for (size_t i = 0; i < nitems(ref_solar_longitude_data); i++) {
+		sum += ref_solar_longitude_data[i].x * sin_deg(
+				ref_solar_longitude_data[i].y +
+				ref_solar_longitude_data[i].z * c);
+	}
+	double lambda = (282.7771834 + 36000.76953744 * c +
+			 0.000005729577951308232 * sum);
+
+	return mod_f(lambda + aberration(t) + nutation(t), 360);
+}
+
+static double
+ref_lunar_longitude(double t)
+{
+	double c = julian_centuries(t);
+	double coefs_L[] = { 218.3164477, 481267.88123421, -0.0015786,
+			     1.0 / 538841.0, -1.0 / 65194000.0 };
+	double coefs_D[] = { 297.8501921, 445267.1114034, -0.0018819,
+			     1.0 / 545868.0, -1.0 / 113065000.0 };
+	double coefs_M[] = { 357.5291092, 35999.0502909, -0.0001536,
+			     1.0 / 24490000.0 };
+	double coefs_Mp[] = { 134.9633964, 477198.8675055, 0.0087414,
+			      1.0 / 69699.0, -1.0 / 14712000.0 };
+	double coefs_F[] = { 93.2720950, 483202.0175233, -0.0036539,
+			     -1.0 / 3526000.0, 1.0 / 863310000.0 };
+	double L_prime = mod_f(poly(c, coefs_L, nitems(coefs_L)), 360);
+	double D = mod_f(poly(c, coefs_D, nitems(coefs_D)), 360);
+	double M = mod_f(poly(c, coefs_M, nitems(coefs_M)), 360);
+	double M_prime = mod_f(poly(c, coefs_Mp, nitems(coefs_Mp)), 360);
+	double F = mod_f(poly(c, coefs_F, nitems(coefs_F)), 360);
+	double E = 1.0 - 0.002516 * c - 0.0000074 * c*c;
+
+	double sum = 0.0;
+	for (size_t i = 0; i < nitems(ref_lunar_longitude_data); i++) {
+		sum += ref_lunar_longitude_data[i].v *
+			pow(E, abs(ref_lunar_longitude_data[i].x)) * sin_deg(
+				ref_lunar_longitude_data[i].w * D +
+				ref_lunar_longitude_data[i].x * M +
+				ref_lunar_longitude_data[i].y * M_prime +
+				ref_lunar_longitude_data[i].z * F);
+	}
+	double correction = sum / 1e6;
+
+	double venus = sin_deg(119.75 + 131.849 * c) * 3958 / 1e6;
+	double jupiter = sin_deg(53.09 + 479264.29 * c) * 318 / 1e6;
+	double flat_earth = sin_deg(L_prime - F) * 1962 / 1e6;
+
+	return mod_f((L_prime + correction + venus + jupiter +
+		      flat_earth + nutation(t)), 360);
+}
+
+/*
+ * Check 'sin_deg_array()' against 'sin_deg()' over the range of angles
+ * seen in the series, and the solar and lunar longitudes against the
+ * reference series over the years 1900-2100.  Benchmark them as well.
+ */
+static void
+test_sin_deg_array(void)
+{
+	const size_t n = 1000000;
+	const int rounds = 10;
+	double *x = xcalloc(n, sizeof(*x));
+	double *y1 = xcalloc(n, sizeof(*y1));
+	double *y2 = xcalloc(n, sizeof(*y2));
+	double maxerr, t_array, t_scalar, t;
+	struct timespec ts1, ts2;
+
+	printf("\n-----------------------------------------------------------\n");
+	srand(1);
+	for (size_t i = 0; i < n; i++)
+		x[i] = ((double)rand() / RAND_MAX - 0.5) * 2e6;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts1);
+	for (int k = 0; k < rounds; k++)
+		sin_deg_array(x, y1, n);
+	clock_gettime(CLOCK_MONOTONIC, &ts2);
+	t_array = (double)(ts2.tv_sec - ts1.tv_sec) +
+		(double)(ts2.tv_nsec - ts1.tv_nsec) / 1e9;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts1);
+	for (int k = 0; k < rounds; k++) {
+		for (size_t i = 0; i < n; i++)
+			y2[i] = sin_deg(x[i]);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts2);
+	t_scalar = (double)(ts2.tv_sec - ts1.tv_sec) +
+		(double)(ts2.tv_nsec - ts1.tv_nsec) / 1e9;
+
+	maxerr = 0.0;
+	for (size_t i = 0; i < n; i++) {
+		if (fabs(y1[i] - y2[i]) > maxerr)
+			maxerr = fabs(y1[i] - y2[i]);
+	}
+	printf("sin_deg_array: max error %.3e in [-1e6, 1e6] degrees, "
+	       "%.1f vs. %.1f ns per angle (%.1fx)\n",
+	       maxerr, t_array / ((double)n * rounds) * 1e9,
+	       t_scalar / ((double)n * rounds) * 1e9, t_scalar / t_array);
+	if (maxerr > 1e-10)
+		errx(1, "sin_deg_array: error too large: %g", maxerr);
+
+	/* the series, as the ephemeris may be enabled by '-E' */
+	ephemeris_set_span(1, 0);
+	const struct {
+		const char *name;
+		double (*func)(double t);
+		double (*ref)(double t);
+	} refs[] = {
+		{ "solar_longitude", solar_longitude, ref_solar_longitude },
+		{ "lunar_longitude", lunar_longitude, ref_lunar_longitude },
+	};
+	const double step = 0.0371;  /* not commensurate with days */
+	double t_first = gregorian_new_year(1900);
+	double t_last = gregorian_new_year(2101);
+	for (size_t i = 0; i < nitems(refs); i++) {
+		maxerr = 0.0;
+		for (t = t_first; t < t_last; t += step) {
+			double err = mod3_f((refs[i].func)(t) -
+					    (refs[i].ref)(t), -180, 180);
+			if (fabs(err) > maxerr)
+				maxerr = fabs(err);
+		}
+		printf("%s: max error %.3e degree against the reference "
+		       "in [1900, 2100]\n", refs[i].name, maxerr);
+		if (maxerr > 1e-8)
+			errx(1, "%s: error too large: %g",
+			     refs[i].name, maxerr);
+	}
+
+	/* series, one evaluation per hour in 2000-2099 */
+	const struct {
+		const char *name;
+		double (*func)(double t);
+	} funcs[] = {
+		{ "solar_longitude", solar_longitude },
+		{ "lunar_longitude", lunar_longitude },
+		{ "lunar_latitude", lunar_latitude },
+		{ "lunar_distance", lunar_distance },
+	};
+	double t_begin = gregorian_new_year(2000);
+	double t_end = gregorian_new_year(2100);
+	double sum = 0.0;
+	for (size_t i = 0; i < nitems(funcs); i++) {
+		clock_gettime(CLOCK_MONOTONIC, &ts1);
+		for (t = t_begin; t < t_end; t += 1.0 / 24.0)
+			sum += (funcs[i].func)(t);
+		clock_gettime(CLOCK_MONOTONIC, &ts2);
+		printf("%s: %.1f ns per evaluation\n", funcs[i].name,
+		       ((double)(ts2.tv_sec - ts1.tv_sec) * 1e9 +
+			(double)(ts2.tv_nsec - ts1.tv_nsec)) /
+		       ((t_end - t_begin) * 24.0));
+	}
+	if (isnan(sum))
+		errx(1, "series: invalid results");
+
+	free(x);
+	free(y1);
+	free(y2);
+}
+
+
+/* Name tokens and 'LANG' values collected from the calendar files */
+struct name_tokens {
+	char	**tokens;
+	size_t	  ntokens;
+	char	**langs;
+	size_t	  nlangs;
+};
+
+static void
+collect_names(const char *path, struct name_tokens *nt)
+{
+	char line[1024], sub[PATH_MAX];
+	char *p, *tab;
+	struct dirent *ent;
+	struct stat sb;
+	DIR *dir;
+	FILE *fp;
+
+	if (stat(path, &sb) != 0)
+		return;
+
+	if (S_ISDIR(sb.st_mode)) {
+		if ((dir = opendir(path)) == NULL)
+			return;
+		while ((ent = readdir(dir)) != NULL) {
+			if (ent->d_name[0] == '.')
+				continue;
+			snprintf(sub, sizeof(sub), "%s/%s", path, ent->d_name);
+			collect_names(sub, nt);
+		}
+		closedir(dir);
+		return;
+	}
+
+	if ((fp = fopen(path, "r")) == NULL)
+		return;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (strncmp(line, "LANG=", 5) == 0) {
+			line[strcspn(line, "\n")] = '\0';
+			for (size_t i = 0; i < nt->nlangs; i++) {
+				if (strcmp(nt->langs[i], line + 5) == 0)
+					goto next;
+			}
+			nt->langs = xrealloc(nt->langs,
+					     (nt->nlangs + 1) * sizeof(char *));
+			nt->langs[nt->nlangs++] = xstrdup(line + 5);
+			continue;
+		}
+		if (strchr("\t #/*\n", line[0]) != NULL ||
+		    (tab = strchr(line, '\t')) == NULL)
+			continue;
+
+		/* the date fields split by ' ' or '/' */
+		*tab = '\0';
+		for (p = strtok(line, " /"); p; p = strtok(NULL, " /")) {
+			nt->tokens = xrealloc(nt->tokens,
+					      (nt->ntokens + 1) * sizeof(char *));
+			nt->tokens[nt->ntokens++] = xstrdup(p);
+		}
+next:
+		;
+	}
+	fclose(fp);
+}
+
+/*
+ * Compare the beginning of $s with $name case-insensitively, character by
+ * character in the current locale of the thread, and return the length
+ * of the matched part of $s, or 0 if not matched.  The invalid bytes are
+ * compared exactly.
+ */
+static size_t
+casecmp_prefix(const char *s, const char *name)
+{
+	mbstate_t st1, st2;
+	wchar_t c1, c2;
+	size_t n1, n2;
+	const char *p = s;
+
+	memset(&st1, 0, sizeof(st1));
+	memset(&st2, 0, sizeof(st2));
+	while (*name != '\0') {
+		n1 = mbrtowc(&c1, p, MB_CUR_MAX, &st1);
+		n2 = mbrtowc(&c2, name, MB_CUR_MAX, &st2);
+		if (n1 >= (size_t)-2 || n2 >= (size_t)-2) {
+			/* both invalid and the same byte */
+			if (n1 < (size_t)-2 || n2 < (size_t)-2 || *p != *name)
+				return 0;
+			memset(&st1, 0, sizeof(st1));
+			memset(&st2, 0, sizeof(st2));
+			n1 = n2 = 1;
+		} else if (n1 == 0 || towlower((wint_t)c1) !=
+			   towlower((wint_t)c2)) {
+			return 0;
+		}
+		p += n1;
+		name += n2;
+	}
+	return (size_t)(p - s);
+}
+
+static bool
+casecmp_whole(const char *s, const char *name)
+{
+	size_t n = casecmp_prefix(s, name);
+	return (n > 0 && s[n] == '\0');
+}
+
+/* Reference matching by checking the names one by one */
+static bool
+match_prefix_linear(const struct nname *names, const char *s, size_t *len,
+		    int *value)
+{
+	size_t n;
+
+	for (const struct nname *nn = names; nn->name != NULL; nn++) {
+		if ((nn->fn_name && (n = casecmp_prefix(s, nn->fn_name)) > 0) ||
+		    (nn->n_name && (n = casecmp_prefix(s, nn->n_name)) > 0) ||
+		    (nn->f_name && (n = casecmp_prefix(s, nn->f_name)) > 0) ||
+		    (n = casecmp_prefix(s, nn->name)) > 0) {
+			*len = n;
+			*value = nn->value;
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool
+match_linear(const struct nname *names, const char *s, int *value)
+{
+	for (const struct nname *nn = names; nn->name != NULL; nn++) {
+		if (casecmp_whole(s, nn->name) ||
+		    (nn->n_name && casecmp_whole(s, nn->n_name))) {
+			*value = nn->value;
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Check the trie matching of the month, weekday and sequence names
+ * against the linear matching, and benchmark them, with the date tokens
+ * and the locales of all calendar files under directory $path.
+ */
+static void
+test_nnames(const char *path)
+{
+	const int rounds = 200;
+	struct name_tokens nt = { 0 };
+	struct cal_names names = { 0 };
+	struct nname months[NMONTHS+1], dows[NDOWS+1], seqs[NSEQUENCES+1];
+	struct timespec ts1, ts2;
+	const char *lang;
+	locale_t oldloc;
+	size_t len1, len2;
+	int v1, v2, found;
+	unsigned long mismatches;
+	double t_linear, t_trie;
+	bool b1, b2;
+
+	collect_names(path, &nt);
+	/* UTF-8 names that differ only in case */
+	set_nsequences(&names, "Первый Второй Третий Четвертый Пятый Последний");
+	const char *extra[] = { "ПЕРВЫЙ", "последний", "Пятый",
+				"Последнийx", "Пя" };
+	for (size_t i = 0; i < nitems(extra); i++) {
+		nt.tokens = xrealloc(nt.tokens,
+				     (nt.ntokens + 1) * sizeof(char *));
+		nt.tokens[nt.ntokens++] = xstrdup(extra[i]);
+	}
+	/* to fold them in a UTF-8 locale even without such calendar files */
+	nt.langs = xrealloc(nt.langs, (nt.nlangs + 1) * sizeof(char *));
+	nt.langs[nt.nlangs++] = xstrdup("C.UTF-8");
+
+	printf("\n-----------------------------------------------------------\n");
+	printf("Names: %zu tokens from '%s'\n", nt.ntokens, path);
+	printf("Locale\t\tFound\tMismatches\tLinear[ns]\tTrie[ns]\n");
+	for (size_t l = 0; l <= nt.nlangs; l++) {
+		lang = (l == 0) ? "C" : nt.langs[l-1];
+		if (!set_nlocale(&names, lang)) {
+			printf("%-15s\t(unavailable)\n", lang);
+			continue;
+		}
+		nnames_get(&names, NN_MONTH, months);
+		nnames_get(&names, NN_DOW, dows);
+		nnames_get(&names, NN_SEQUENCE, seqs);
+		oldloc = uselocale(nlocale_locale(&names));
+
+		found = 0;
+		mismatches = 0;
+		for (size_t i = 0; i < nt.ntokens; i++) {
+			const char *s = nt.tokens[i];
+			len1 = len2 = 0;
+			v1 = v2 = 0;
+			b1 = match_prefix_linear(months, s, &len1, &v1);
+			b2 = nname_match_prefix(&names, NN_MONTH, s, &len2,
+						&v2);
+			found += b2;
+			if (b1 != b2 || (b1 && (len1 != len2 || v1 != v2)))
+				mismatches++;
+			b1 = match_prefix_linear(dows, s, &len1, &v1);
+			b2 = nname_match_prefix(&names, NN_DOW, s, &len2,
+						&v2);
+			found += b2;
+			if (b1 != b2 || (b1 && (len1 != len2 || v1 != v2)))
+				mismatches++;
+			b1 = match_linear(seqs, s, &v1);
+			b2 = nname_match(&names, NN_SEQUENCE, s, &v2);
+			found += b2;
+			if (b1 != b2 || (b1 && v1 != v2))
+				mismatches++;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &ts1);
+		for (int k = 0; k < rounds; k++) {
+			for (size_t i = 0; i < nt.ntokens; i++) {
+				match_prefix_linear(months, nt.tokens[i],
+						    &len1, &v1);
+				match_prefix_linear(dows, nt.tokens[i],
+						    &len1, &v1);
+				match_linear(seqs, nt.tokens[i], &v1);
+			}
+		}
+		clock_gettime(CLOCK_MONOTONIC, &ts2);
+		t_linear = (double)(ts2.tv_sec - ts1.tv_sec) * 1e9 +
+			(double)(ts2.tv_nsec - ts1.tv_nsec);
+
+		clock_gettime(CLOCK_MONOTONIC, &ts1);
+		for (int k = 0; k < rounds; k++) {
+			for (size_t i = 0; i < nt.ntokens; i++) {
+				nname_match_prefix(&names, NN_MONTH,
+						   nt.tokens[i], &len2, &v2);
+				nname_match_prefix(&names, NN_DOW,
+						   nt.tokens[i], &len2, &v2);
+				nname_match(&names, NN_SEQUENCE,
+					    nt.tokens[i], &v2);
+			}
+		}
+		clock_gettime(CLOCK_MONOTONIC, &ts2);
+		t_trie = (double)(ts2.tv_sec - ts1.tv_sec) * 1e9 +
+			(double)(ts2.tv_nsec - ts1.tv_nsec);
+
+		printf("%-15s\t%d\t%lu\t\t%.1f\t\t%.1f\n", lang, found,
+		       mismatches, t_linear / ((double)nt.ntokens * rounds),
+		       t_trie / ((double)nt.ntokens * rounds));
+		if (mismatches > 0)
+			errx(1, "names: %lu mismatches in locale %s",
+			     mismatches, lang);
+
+		/* the case of the non-ASCII names is folded as well */
+		if (strcmp(nl_langinfo(CODESET), "UTF-8") == 0 &&
+		    (!nname_match(&names, NN_SEQUENCE, "ПЕРВЫЙ", &v2) ||
+		     v2 != 1)) {
+			errx(1, "names: 'ПЕРВЫЙ' not matched in locale %s",
+			     lang);
+		}
+		uselocale(oldloc);
+	}
+
+	for (size_t i = 0; i < nt.ntokens; i++)
+		free(nt.tokens[i]);
+	for (size_t i = 0; i < nt.nlangs; i++)
+		free(nt.langs[i]);
+	free(nt.tokens);
+	free(nt.langs);
+	nnames_free(&names);
+}
+
+
+/*
+ * Check that the date info classified by the parser survives a round trip
+ * through the compiled records of a cache file, i.e., it's stored as is
+ * and accepted by 'dateinfo_valid()' when loaded, for the dates with the
+ * fields at or beyond their usual ranges.
+ */
+static void
+test_dateinfo_cache(void)
+{
+	const char *dates[] = {
+		"Jan 0", "* 0", "0 5", "5 0", "Feb 31", "13 Mon",
+		"2147483647 3", "Easter+1000", "Easter-400", "Easter+0",
+		"ChineseNewYear+14", "Sun+3", "Aug/Sun-1", "2020/Aug/16",
+		"Jan *", "2020 Jan Sun",
+	};
+	struct dateinfo di[nitems(dates)], di2;
+	struct cache_buf cb = { 0 };
+	struct cache_reader rd;
+	struct cal_context *ctx;
+	int failed = 0;
+
+	if ((ctx = cal_context_new()) == NULL)
+		errx(1, "cal_context_new() failed");
+	for (size_t i = 0; i < nitems(dates); i++) {
+		if (!parse_cal_dateinfo(ctx, dates[i], &di[i]))
+			errx(1, "dateinfo: cannot parse |%s|", dates[i]);
+		cache_put(&cb, &di[i], sizeof(di[i]));
+	}
+
+	printf("\n-----------------------------------------------------------\n");
+	printf("Date info round trip: %zu dates\n", nitems(dates));
+	rd.pos = cb.data;
+	rd.end = cb.data + cb.len;
+	for (size_t i = 0; i < nitems(dates); i++) {
+		if (!cache_get(&rd, &di2, sizeof(di2)) ||
+		    memcmp(&di[i], &di2, sizeof(di2)) != 0 ||
+		    !dateinfo_valid(&di2)) {
+			printf("|%s|: rule %d, flags 0x%x: rejected\n",
+			       dates[i], di2.rule, di2.flags);
+			failed++;
+		}
+	}
+
+	free(cb.data);
+	cal_context_free(ctx);
+	if (failed > 0)
+		errx(1, "dateinfo: %d dates reclassified", failed);
+	printf("OK\n");
+}
+
+
+/*
+ * Load-test the daemon on socket $sock with $nclients clients, which send
+ * $nqueries queries in total for the calendar file $file of today, and
+ * report the throughput and the latencies.
+ */
+static void
+test_server(const char *sock, const char *file, int nqueries, int nclients)
+{
+	struct server_query q = { .magic = SERVER_MAGIC };
+	struct timespec ts0, ts1, ts2;
+	double latency, total, maxlat;
+	size_t len;
+	char *data;
+	int cal_fd, dir_fd, status, nfailed, kidstat;
+
+	printf("\n-----------------------------------------------------------\n");
+	printf("Daemon on '%s': %d queries by %d clients for '%s'\n",
+	       sock, nqueries, nclients, file);
+
+	/* the daemon answers only the clients of the same locale */
+	setlocale(LC_ALL, "");
+	snprintf(q.locale, sizeof(q.locale), "%s", setlocale(LC_ALL, NULL));
+	q.today = (int)(time(NULL) / 86400) + 719163;  /* R.D. of 1970-01-01 */
+	q.day_begin = q.today;
+	q.day_end = q.today + 1;
+	q.time = 0.5;
+
+	if ((dir_fd = open(".", O_RDONLY)) == -1)
+		err(1, "open('.')");
+
+	fflush(stdout);
+	clock_gettime(CLOCK_MONOTONIC, &ts0);
+	for (int c = 0; c < nclients; c++) {
+		switch (fork()) {
+		case -1:
+			err(1, "fork");
+		case 0:
+			break;
+		default:
+			continue;
+		}
+
+		nfailed = 0;
+		total = maxlat = 0.0;
+		for (int i = c; i < nqueries; i += nclients) {
+			if ((cal_fd = open(file, O_RDONLY)) == -1)
+				err(1, "open(%s)", file);
+			clock_gettime(CLOCK_MONOTONIC, &ts1);
+			status = server_query(sock, &q, cal_fd, dir_fd,
+					      &data, &len);
+			clock_gettime(CLOCK_MONOTONIC, &ts2);
+			close(cal_fd);
+			free(data);
+
+			if (status != SERVER_OK)
+				nfailed++;
+			latency = (double)(ts2.tv_sec - ts1.tv_sec) +
+				(double)(ts2.tv_nsec - ts1.tv_nsec) / 1e9;
+			total += latency;
+			if (latency > maxlat)
+				maxlat = latency;
+		}
+		printf("client %d: %d failed, latency %.3f ms mean, "
+		       "%.3f ms max\n", c, nfailed,
+		       total / ((nqueries - c + nclients - 1) / nclients) * 1e3,
+		       maxlat * 1e3);
+		fflush(stdout);
+		_exit(nfailed > 0);
+	}
+
+	nfailed = 0;
+	while (wait(&kidstat) > 0) {
+		if (!WIFEXITED(kidstat) || WEXITSTATUS(kidstat) != 0)
+			nfailed++;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts2);
+	close(dir_fd);
+
+	total = (double)(ts2.tv_sec - ts0.tv_sec) +
+		(double)(ts2.tv_nsec - ts0.tv_nsec) / 1e9;
+	printf("%d queries in %.3f seconds: %.1f queries/second\n",
+	       nqueries, total, nqueries / total);
+	if (nfailed > 0)
+		errx(1, "daemon: %d clients failed", nfailed);
+}
+
 
 /* Return the seconds east of UTC */
 static int
@@ -335,7 +1230,11 @@ get_utcoffset(void)
 static void
 usage(const char *progname)
 {
-	fprintf(stderr, "usage: %s [-L location] [-T] [-U timezone]\n", progname);
+	fprintf(stderr, "usage: %s [-C] [-E year1:year2] [-G] "
+		"[-I year1:year2] [-L location] [-N calendar_dir]\n"
+		"\t[-Q socket:calendar_file[:queries[:clients]]] [-T] "
+		"[-U timezone] [-V]\n",
+		progname);
 	exit(2);
 }
 
@@ -343,19 +1242,61 @@ int
 main(int argc, char *argv[])
 {
 	int ch;
+	int eph_year1 = 0, eph_year2 = -1;
+	int inv_year1 = 0, inv_year2 = -1;
 	int utcoffset = get_utcoffset();
 	bool run_test = false;
+	bool gen_table = false;
+	bool test_vector = false;
+	bool test_cache = false;
+	const char *names_dir = NULL;
+	char *server_sock = NULL, *server_file = NULL, *p;
+	int server_queries = 1000, server_clients = 1;
 	double latitude = 0.0;
 	double longitude = 0.0;
 	double elevation = 0.0;
 	const char *progname = argv[0];
 
-	while ((ch = getopt(argc, argv, "hL:TU:")) != -1) {
+	while ((ch = getopt(argc, argv, "CE:GhI:L:N:Q:TU:V")) != -1) {
 		switch (ch) {
+		case 'C':
+			test_cache = true;
+			break;
+		case 'E':
+			if (sscanf(optarg, "%d:%d", &eph_year1, &eph_year2) != 2 ||
+			    eph_year1 > eph_year2)
+				errx(1, "invalid span of years: '%s'", optarg);
+			break;
+		case 'G':
+			gen_table = true;
+			break;
+		case 'I':
+			if (sscanf(optarg, "%d:%d", &inv_year1, &inv_year2) != 2 ||
+			    inv_year1 > inv_year2)
+				errx(1, "invalid span of years: '%s'", optarg);
+			break;
 		case 'L':
 			if (!parse_location(optarg, &latitude, &longitude, &elevation))
 				errx(1, "invalid location: '%s'", optarg);
 			break;
+		case 'N':
+			names_dir = optarg;
+			break;
+		case 'Q':
+			server_sock = optarg;
+			if ((p = strchr(optarg, ':')) == NULL)
+				errx(1, "invalid daemon test: '%s'", optarg);
+			*p++ = '\0';
+			server_file = p;
+			if ((p = strchr(p, ':')) != NULL) {
+				*p++ = '\0';
+				if (sscanf(p, "%d:%d", &server_queries,
+					   &server_clients) < 1 ||
+				    server_clients <= 0 ||
+				    server_queries < server_clients)
+					errx(1, "invalid daemon test: '%s'", p);
+			}
+			break;
 		case 'T':
 			run_test = true;
 			break;
@@ -363,6 +1304,9 @@ main(int argc, char *argv[])
 			if (!parse_timezone(optarg, &utcoffset))
 				errx(1, "invalid timezone: '%s'", optarg);
 			break;
+		case 'V':
+			test_vector = true;
+			break;
 		case 'h':
 		case '?':
 		default:
@@ -375,6 +1319,14 @@ main(int argc, char *argv[])
 	if (argc)
 		usage(progname);
 
+	if (gen_table) {
+		/* regenerate the Chinese year table */
+		int errors = chinese_check_table(true);
+		if (errors > 0)
+			errx(1, "Chinese year table: %d mismatches", errors);
+		return 0;
+	}
+
 	printf("UTC offset: %d [seconds]\n", utcoffset);
 	printf("Location: (latitude=%lf°, longitude=%lf°, elevation=%lfm)\n",
 			latitude, longitude, elevation);
@@ -384,6 +1336,19 @@ main(int argc, char *argv[])
 		test2();
 		test3();
 	}
+	if (eph_year1 <= eph_year2)
+		test_ephemeris(eph_year1, eph_year2);
+	if (inv_year1 <= inv_year2)
+		test_invert(inv_year1, inv_year2);
+	if (test_vector)
+		test_sin_deg_array();
+	if (names_dir != NULL)
+		test_nnames(names_dir);
+	if (test_cache)
+		test_dateinfo_cache();
+	if (server_sock != NULL)
+		test_server(server_sock, server_file, server_queries,
+			    server_clients);
 
 	return 0;
 }
@@ -1,8 +1,9 @@
 #!/bin/sh
 
-SRCS="basics.c chinese.c ecclesiastical.c gregorian.c julian.c moon.c sun.c utils.c"
-SRCS="${SRCS} dates.c days.c nnames.c parsedata.c io.c"
-CFLAGS="-std=c99 -pedantic -O2 -pipe"
+SRCS="basics.c chinese.c ecclesiastical.c ephemeris.c gregorian.c julian.c moon.c sun.c utils.c"
+SRCS="${SRCS} cache.c dates.c days.c nnames.c parsedata.c io.c pool.c"
+SRCS="${SRCS} context.c server.c"
+CFLAGS="-std=c99 -pedantic -O2 -pipe -pthread"
 CFLAGS="${CFLAGS} -Wall -Wextra -Wlogical-op -Wshadow -Wformat=2
 	-Wwrite-strings -Wcast-qual -Wcast-align
 	-Wduplicated-cond -Wduplicated-branches
@@ -10,7 +11,7 @@ CFLAGS="${CFLAGS} -Wall -Wextra -Wlogical-op -Wshadow -Wformat=2
 CFLAGS="${CFLAGS} -I."
 CFLAGS="${CFLAGS} -DCALENDAR_DIR=\"/usr/local/share/calendar\""
 CFLAGS="${CFLAGS} -DCALENDAR_ETCDIR=\"/usr/local/etc/calendar\""
-LDFLAGS="-lm"
+LDFLAGS="-lm -pthread"
 
 if [ "$(uname -s)" = "Linux" ]; then
 	CFLAGS="${CFLAGS} -D_GNU_SOURCE"